@@ -0,0 +1,95 @@
+/**
+ * @file bench_bot.cpp
+ * @brief Бенчмарк обработки обновлений бота: синхронная обработка против UpdateDispatcher и TelegramOutbox.
+ *
+ * Bot API заменён локальной заглушкой, которая отвечает с заданной задержкой,
+ * имитируя сетевой запрос к api.telegram.org. Лимиты Telegram в бенчмарке
+ * отключены, чтобы измерять пропускную способность самой обработки.
+ *
+ * Запуск: bench_bot [количество обновлений] [количество чатов] [задержка Bot API в мс]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Заглушка Bot API с фиксированной задержкой ответа
+ */
+class StubTransport : public BotTransport {
+public:
+    explicit StubTransport(std::chrono::milliseconds latency) : latency_(latency) {}
+
+    void sendMessage(int64_t, const std::string&, TgBot::GenericReply::Ptr) override {
+        std::this_thread::sleep_for(latency_);
+        ++calls;
+    }
+
+    void answerCallbackQuery(const std::string&) override {
+        std::this_thread::sleep_for(latency_);
+        ++calls;
+    }
+
+    std::atomic<size_t> calls{0};
+
+private:
+    std::chrono::milliseconds latency_;
+};
+
+TgBot::Message::Ptr makeStartMessage(int64_t chatId) {
+    TgBot::Message::Ptr message(new TgBot::Message);
+    message->chat.reset(new TgBot::Chat);
+    message->chat->id = chatId;
+    message->text = "/start";
+    return message;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t updates = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t chats = argc > 2 ? std::stoul(argv[2]) : 200;
+    std::chrono::milliseconds latency(argc > 3 ? std::stoul(argv[3]) : 20);
+
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+    const int64_t firstChat = 9000000000;
+
+    // Прежняя схема: обновления обрабатываются в потоке long poll, каждый вызов Bot API блокирует его
+    {
+        StubTransport transport(latency);
+        size_t legacyUpdates = std::min<size_t>(updates, 200);
+        auto start = bench::Clock::now();
+        for (size_t i = 0; i < legacyUpdates; ++i) {
+            int64_t chatId = firstChat + static_cast<int64_t>(i % chats);
+            addUserToDatabase(chatId);
+            std::string token = getUserToken(chatId);
+            transport.sendMessage(chatId, "Welcome to Cloud Storage Bot!" + token, nullptr);
+        }
+        double seconds = bench::seconds_since(start);
+        std::cout << "synchronous: " << legacyUpdates / seconds << " updates/s" << std::endl;
+    }
+
+    // Асинхронная схема: UpdateDispatcher + TelegramOutbox
+    StubTransport transport(latency);
+    size_t calls = 0;
+    double seconds = 0;
+    {
+        TelegramOutbox outbox(transport, BOT_SENDER_THREADS * 4, 1e9, std::chrono::milliseconds(0));
+        UpdateDispatcher dispatcher(BOT_WORKER_THREADS, BOT_WORKER_QUEUE);
+        auto start = bench::Clock::now();
+        for (size_t i = 0; i < updates; ++i) {
+            TgBot::Message::Ptr message = makeStartMessage(firstChat + static_cast<int64_t>(i % chats));
+            dispatcher.post(message->chat->id, [&outbox, message] { handleStartCommand(outbox, message); });
+        }
+        dispatcher.drain();
+        outbox.flush();
+        seconds = bench::seconds_since(start);
+        calls = transport.calls;
+    }
+    std::cout << "dispatcher:  " << updates / seconds << " updates/s, "
+              << calls << " Bot API calls for " << updates << " replies" << std::endl;
+
+    flushLog();
+    return calls > 0 && calls <= updates ? 0 : 1;
+}
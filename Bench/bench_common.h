@@ -0,0 +1,149 @@
+/**
+ * @file bench_common.h
+ * @brief Общие части бенчмарков: замер времени, потоки нагрузки, сводка задержек и отчёт в JSON.
+ *
+ * Задержки собираются в std::vector<double> в единицах, выбранных бенчмарком
+ * (мкс или мс), и сводятся summarize() в LatencySummary. Результат сценария
+ * (CaseResult) записывается в JSON функцией case_json — так же, как в отчёте
+ * bench_suite.
+ */
+
+#ifndef CLOUDHSE_BENCH_COMMON_H
+#define CLOUDHSE_BENCH_COMMON_H
+
+#include "../cloudhse.h"
+
+#include <chrono>
+#include <iomanip>
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Секунды, прошедшие с момента start
+ */
+inline double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Время выполнения body() в секундах
+ */
+template <typename Body>
+double timed(Body body) {
+    auto start = Clock::now();
+    body();
+    return seconds_since(start);
+}
+
+/**
+ * @brief Выполнение body(номер потока) в threads потоках
+ *
+ * @return double Время от запуска первого потока до завершения последнего (в секундах)
+ */
+template <typename Body>
+double run_threads(size_t threads, Body body) {
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&body, t] { body(t); });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return seconds_since(start);
+}
+
+/**
+ * @brief Значение перцентиля p (от 0 до 1) в отсортированном наборе
+ */
+inline double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+/**
+ * @brief Сводка набора задержек
+ */
+struct LatencySummary {
+    size_t count = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+};
+
+inline LatencySummary summarize(std::vector<double> latencies) {
+    LatencySummary summary;
+    if (latencies.empty()) {
+        return summary;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (double value : latencies) {
+        total += value;
+    }
+    summary.count = latencies.size();
+    summary.mean = total / latencies.size();
+    summary.p50 = percentile(latencies, 0.50);
+    summary.p90 = percentile(latencies, 0.90);
+    summary.p99 = percentile(latencies, 0.99);
+    summary.p999 = percentile(latencies, 0.999);
+    summary.max = latencies.back();
+    return summary;
+}
+
+/**
+ * @brief Число с тремя знаками после запятой для отчётов
+ */
+inline std::string number(double value) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << value;
+    return out.str();
+}
+
+/**
+ * @brief Строка отчёта "p50 X unit, p99 Y unit"
+ */
+inline std::string latency_line(const LatencySummary& summary, const std::string& unit) {
+    return "p50 " + number(summary.p50) + " " + unit + ", p99 " + number(summary.p99) + " " + unit;
+}
+
+/**
+ * @brief Результат одного сценария
+ */
+struct CaseResult {
+    std::string name;
+    size_t ops = 0;
+    size_t errors = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    std::vector<double> latencies;  ///< Задержки успешных операций (мкс)
+};
+
+/**
+ * @brief Объект JSON с итогами сценария: операции, ошибки, скорость и задержки в мкс
+ */
+inline std::string case_json(const CaseResult& result) {
+    LatencySummary latency = summarize(result.latencies);
+    return "{\"name\": \"" + json_escape(result.name) + "\"" +
+           ", \"ops\": " + std::to_string(result.ops) +
+           ", \"errors\": " + std::to_string(result.errors) +
+           ", \"seconds\": " + number(result.seconds) +
+           ", \"ops_per_sec\": " + number(result.seconds > 0 ? result.ops / result.seconds : 0) +
+           ", \"bytes_per_sec\": " + number(result.seconds > 0 ? result.bytes / result.seconds : 0) +
+           ", \"latency_us\": {\"p50\": " + number(latency.p50) +
+           ", \"p90\": " + number(latency.p90) +
+           ", \"p99\": " + number(latency.p99) +
+           ", \"p999\": " + number(latency.p999) +
+           ", \"max\": " + number(latency.max) + "}}";
+}
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file bench_database.cpp
+ * @brief Микробенчмарк операций с базой данных: соединение на каждый вызов против пула DbPool.
+ *
+ * Запуск: bench_database [количество итераций] [количество потоков]
+ *
+ * Логирование в обоих вариантах исключено, чтобы измерялась только работа с SQLite.
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Прежняя реализация updateUserToken: новое соединение и подготовка запроса на каждый вызов
+ */
+void legacyUpdateUserToken(int64_t userId, const std::string& token) {
+    SQLite::Database db(DB_PATH, SQLite::OPEN_READWRITE);
+    SQLite::Statement query(db, "UPDATE users SET token = ? WHERE id = ?");
+    query.bind(1, token);
+    query.bind(2, userId);
+    query.exec();
+}
+
+/**
+ * @brief Прежняя реализация getUserToken: новое соединение и подготовка запроса на каждый вызов
+ */
+std::string legacyGetUserToken(int64_t userId) {
+    SQLite::Database db(DB_PATH, SQLite::OPEN_READONLY);
+    SQLite::Statement query(db, "SELECT token FROM users WHERE id = ?");
+    query.bind(1, userId);
+    if (query.executeStep()) {
+        return query.getColumn(0).getText();
+    }
+    return "";
+}
+
+void pooledUpdateUserToken(int64_t userId, const std::string& token) {
+    auto db = getDbPool().writer();
+    SQLite::Statement& query = db->statement("UPDATE users SET token = ? WHERE id = ?");
+    query.bind(1, token);
+    query.bind(2, userId);
+    query.exec();
+}
+
+std::string pooledGetUserToken(int64_t userId) {
+    auto db = getDbPool().reader();
+    SQLite::Statement& query = db->statement("SELECT token FROM users WHERE id = ?");
+    query.bind(1, userId);
+    if (query.executeStep()) {
+        return query.getColumn(0).getText();
+    }
+    return "";
+}
+
+/**
+ * @brief Замер пропускной способности операции, выполняемой в нескольких потоках
+ */
+template <typename Operation>
+void measure(const std::string& name, size_t iterations, size_t threads, Operation operation) {
+    double seconds = bench::run_threads(threads, [&](size_t t) {
+        for (size_t i = 0; i < iterations; ++i) {
+            operation(static_cast<int64_t>(t * iterations + i));
+        }
+    });
+    double ops = static_cast<double>(iterations * threads) / seconds;
+    std::cout << name << " (" << threads << " threads): " << static_cast<uint64_t>(ops) << " ops/sec" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t threads = argc > 2 ? std::stoul(argv[2]) : 4;
+    const int64_t users = 100;
+
+    initDatabase();
+    for (int64_t id = 0; id < users; ++id) {
+        addUserToDatabase(id);
+        updateUserToken(id, generate_send_token(18));
+    }
+
+    measure("legacy getUserToken", iterations, 1, [&](int64_t i) { legacyGetUserToken(i % users); });
+    measure("pooled getUserToken", iterations, 1, [&](int64_t i) { pooledGetUserToken(i % users); });
+    measure("legacy getUserToken", iterations, threads, [&](int64_t i) { legacyGetUserToken(i % users); });
+    measure("pooled getUserToken", iterations, threads, [&](int64_t i) { pooledGetUserToken(i % users); });
+    measure("legacy updateUserToken", iterations, 1, [&](int64_t i) { legacyUpdateUserToken(i % users, "bench"); });
+    measure("pooled updateUserToken", iterations, 1, [&](int64_t i) { pooledUpdateUserToken(i % users, "bench"); });
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file bench_io.cpp
+ * @brief Сравнение реализаций ввода-вывода хранилища: пропускная способность и CPU на гигабайт.
+ *
+ * Для каждой реализации (posix, uring, uring с O_DIRECT) файл записывается через
+ * StorageFile::write_at частями, как при приёме загрузки, затем читается подряд
+ * через read_chunk фрагментами DOWNLOAD_CHUNK_SIZE, как при отдаче. CPU считается
+ * по getrusage (пользовательское и системное время процесса). Отдельно замеряется
+ * открытие и чтение маленького файла SMALL_OPENS раз — цена открытия файла.
+ *
+ * Запуск: bench_io [размер файла в МиБ] [размер части записи в КиБ] [глубина очереди uring]
+ */
+
+#include "bench_common.h"
+
+#include <sys/resource.h>
+
+namespace {
+
+const int SMALL_OPENS = 2000;
+const size_t SMALL_FILE_SIZE = 16 * 1024;
+
+double cpuSeconds() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/**
+ * @brief Замер одной фазы: время и CPU
+ */
+struct Phase {
+    double seconds = 0;
+    double cpu = 0;
+    bool ok = true;
+};
+
+template <typename Body>
+Phase measure(Body body) {
+    Phase phase;
+    double cpu = cpuSeconds();
+    phase.seconds = bench::timed([&] { phase.ok = body(); });
+    phase.cpu = cpuSeconds() - cpu;
+    return phase;
+}
+
+void report(const char* backend, const char* name, const Phase& phase, uint64_t bytes) {
+    double gib = bytes / double(1 << 30);
+    std::cout << "  " << backend << " " << name << ": " << bytes / double(1 << 20) / phase.seconds << " MiB/s"
+              << ", CPU " << phase.cpu / gib << " s/GiB"
+              << (phase.ok ? "" : " (FAILED)") << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint64_t bytes = (argc > 1 ? std::stoull(argv[1]) : 1024) << 20;
+    size_t piece = (argc > 2 ? std::stoul(argv[2]) : 64) << 10;
+    unsigned depth = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 8;
+
+    setLogLevel(LogLevel::Warning);
+    std::string path = BASE_PATH + "/bench_io_" + generate_send_token(6) + ".tmp";
+    std::string source(piece, '\0');
+    for (size_t i = 0; i < source.size(); ++i) {
+        source[i] = static_cast<char>(i * 31 + 7);
+    }
+
+    std::vector<std::unique_ptr<StorageBackend>> backends;
+    backends.push_back(std::make_unique<PosixStorage>());
+#ifdef HAVE_IO_URING
+    if (IoRing(2).is_valid()) {
+        backends.push_back(std::make_unique<UringStorage>(depth, false));
+        backends.push_back(std::make_unique<UringStorage>(depth, true));
+    }
+    else {
+        std::cout << "io_uring is not available on this kernel" << std::endl;
+    }
+#else
+    std::cout << "built without io_uring support" << std::endl;
+#endif
+
+    std::cout << bytes / (1 << 20) << " MiB file, " << piece / 1024 << " KiB writes, "
+              << DOWNLOAD_CHUNK_SIZE / 1024 << " KiB reads, uring depth " << depth << std::endl;
+    bool ok = true;
+    for (auto& backend : backends) {
+        Phase write = measure([&] {
+            auto file = backend->open(path, StorageMode::Write);
+            if (!file) {
+                return false;
+            }
+            for (uint64_t offset = 0; offset < bytes; offset += piece) {
+                if (!file->write_at(offset, source.data(), static_cast<size_t>(std::min<uint64_t>(piece, bytes - offset)))) {
+                    return false;
+                }
+            }
+            return file->flush();
+        });
+        report(backend->name(), "write", write, bytes);
+
+        uint64_t checksum = 0;
+        Phase read = measure([&] {
+            auto file = backend->open(path, StorageMode::Read);
+            if (!file || file->size() != bytes) {
+                return false;
+            }
+            const char* data;
+            size_t got;
+            for (uint64_t offset = 0; offset < bytes; offset += got) {
+                if (!file->read_chunk(offset, DOWNLOAD_CHUNK_SIZE, data, got) || got == 0) {
+                    return false;
+                }
+                checksum += static_cast<unsigned char>(data[0]) + static_cast<unsigned char>(data[got - 1]);
+            }
+            return true;
+        });
+        report(backend->name(), "read", read, bytes);
+        ok = ok && write.ok && read.ok;
+
+        {
+            std::ofstream small(path, std::ios::binary | std::ios::trunc);
+            small.write(source.data(), static_cast<std::streamsize>(std::min(SMALL_FILE_SIZE, source.size())));
+        }
+        Phase opens = measure([&] {
+            for (int i = 0; i < SMALL_OPENS; ++i) {
+                auto file = backend->open(path, StorageMode::Read);
+                const char* data;
+                size_t got;
+                if (!file || !file->read_chunk(0, DOWNLOAD_CHUNK_SIZE, data, got) || got == 0) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        std::cout << "  " << backend->name() << " small open+read: " << opens.seconds * 1e6 / SMALL_OPENS << " us/file"
+                  << (opens.ok ? "" : " (FAILED)") << std::endl;
+        ok = ok && opens.ok;
+
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    flushLog();
+    return ok ? 0 : 1;
+}
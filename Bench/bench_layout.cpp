@@ -0,0 +1,87 @@
+/**
+ * @file bench_layout.cpp
+ * @brief Сравнение задержки поиска папки токена в плоском и шардированном дереве.
+ *
+ * В отдельной папке создаются два дерева с одинаковым набором токенов: плоское
+ * (<root>/<token>) и шардированное (<root>/ab/cd/<token>). Для каждого измеряются
+ * время создания, проверка существующей папки, промах по несуществующему токену
+ * и создание новой папки — это операции validate/createFolderForUser/открытия
+ * ссылки на диске.
+ *
+ * Запуск: bench_layout [число токенов] [число запросов] [глубина шардирования]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Замер одной операции над набором путей
+ */
+template <typename Operation>
+void measure(const std::string& name, const std::vector<std::string>& paths, Operation operation) {
+    std::vector<double> latencies;
+    latencies.reserve(paths.size());
+    size_t hits = 0;
+    for (const auto& path : paths) {
+        auto begin = bench::Clock::now();
+        hits += operation(path) ? 1 : 0;
+        latencies.push_back(bench::seconds_since(begin) * 1e6);
+    }
+    bench::LatencySummary summary = bench::summarize(std::move(latencies));
+    std::cout << "  " << name << ": mean " << bench::number(summary.mean) << " us"
+              << ", " << bench::latency_line(summary, "us")
+              << " (" << hits << "/" << paths.size() << " ok)" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t tokens = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t lookups = argc > 2 ? std::stoul(argv[2]) : 100000;
+    size_t depth = argc > 3 ? std::stoul(argv[3]) : 2;
+
+    setLogLevel(LogLevel::Warning);
+    std::string root = BASE_PATH + "/bench_layout_" + generate_send_token(6);
+
+    std::vector<std::string> names(tokens);
+    for (auto& name : names) {
+        name = random_token(USER_TOKEN_LENGTH);
+    }
+
+    std::cout << tokens << " tokens, " << lookups << " lookups, shard depth " << depth << std::endl;
+    for (size_t layout : { size_t(0), depth }) {
+        std::string base = root + (layout == 0 ? "/flat/" : "/sharded/");
+        auto path_for = [&](const std::string& token) { return base + shard_prefix(token, layout) + token; };
+
+        double seconds = bench::timed([&] {
+            for (const auto& name : names) {
+                fs::create_directories(path_for(name));
+            }
+        });
+        std::cout << (layout == 0 ? "flat" : "sharded") << ": created in " << seconds << " s" << std::endl;
+
+        std::vector<std::string> existing, missing, fresh;
+        for (size_t i = 0; i < lookups; ++i) {
+            existing.push_back(path_for(names[(i * 7919) % names.size()]));
+            missing.push_back(path_for(random_token(USER_TOKEN_LENGTH)));
+            fresh.push_back(path_for(random_token(USER_TOKEN_LENGTH)));
+        }
+        measure("lookup existing", existing, [](const std::string& path) {
+            std::error_code ec;
+            return fs::is_directory(path, ec);
+        });
+        measure("lookup missing", missing, [](const std::string& path) {
+            std::error_code ec;
+            return !fs::exists(path, ec);
+        });
+        measure("create folder", fresh, [](const std::string& path) {
+            std::error_code ec;
+            return fs::create_directories(path, ec);
+        });
+    }
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+    return 0;
+}
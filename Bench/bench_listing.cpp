@@ -0,0 +1,62 @@
+/**
+ * @file bench_listing.cpp
+ * @brief Бенчмарк листинга папки: обход directory_iterator против FolderCache (холодный и тёплый).
+ *
+ * Запуск: bench_listing [количество файлов] [количество повторов]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Прежняя реализация get_files: обход папки на каждый запрос
+ */
+std::vector<std::string> legacyGetFiles(const std::string& folder_path) {
+    std::vector<std::string> file_list;
+    for (const auto& entry : fs::directory_iterator(folder_path)) {
+        file_list.push_back(entry.path().filename().string());
+    }
+    return file_list;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t fileCount = argc > 1 ? std::stoul(argv[1]) : 50000;
+    size_t repeats = argc > 2 ? std::stoul(argv[2]) : 100;
+
+    std::string folder = BASE_PATH + "/files/bench_listing_" + generate_send_token(8);
+    fs::create_directories(folder);
+    for (size_t i = 0; i < fileCount; ++i) {
+        std::ofstream(folder + "/file_" + std::to_string(i) + ".txt") << i;
+    }
+    std::cout << "Created " << fileCount << " files in " << folder << std::endl;
+
+    size_t total = 0;
+    double seconds = bench::timed([&] {
+        for (size_t i = 0; i < repeats; ++i) {
+            total += legacyGetFiles(folder).size();
+        }
+    });
+    std::cout << "directory_iterator: " << seconds * 1e3 / repeats << " ms per listing" << std::endl;
+
+    seconds = bench::timed([&] { total += getFolderCache().list(folder)->size(); });
+    std::cout << "FolderCache cold:   " << seconds * 1e3 << " ms" << std::endl;
+
+    seconds = bench::timed([&] {
+        for (size_t i = 0; i < repeats; ++i) {
+            total += getFolderCache().list(folder)->size();
+        }
+    });
+    std::cout << "FolderCache warm:   " << seconds * 1e3 / repeats << " ms per listing" << std::endl;
+
+    // Изменение в папке должно сбросить снимок через inotify
+    std::ofstream(folder + "/file_new.txt") << "new";
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    size_t afterChange = getFolderCache().list(folder)->size();
+    std::cout << "After change: " << afterChange << " files (expected " << fileCount + 1 << ")" << std::endl;
+
+    fs::remove_all(folder);
+    return total > 0 && afterChange == fileCount + 1 ? 0 : 1;
+}
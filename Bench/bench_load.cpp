@@ -0,0 +1,101 @@
+/**
+ * @file bench_load.cpp
+ * @brief Нагрузочный тест HTTP сервера: задержки и пропускная способность при разной конкурентности.
+ *
+ * Сервер поднимается в этом же процессе через setupServer на свободном порту.
+ * Каждый клиентский поток держит своё keep-alive соединение и по очереди
+ * запрашивает листинг папки и скачивание файла.
+ *
+ * Запуск: bench_load [запросов на поток] [размер файла в байтах]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Результаты прогона при одном уровне конкурентности
+ */
+struct LoadResult {
+    std::vector<double> latencies;  ///< Задержки успешных запросов (мс)
+    size_t errors = 0;              ///< Ответы с кодом, отличным от 200, и сетевые ошибки
+    size_t overloaded = 0;          ///< Ответы 503
+    double seconds = 0;             ///< Длительность прогона
+};
+
+LoadResult runLoad(int port, const std::string& token, size_t concurrency, size_t requests) {
+    LoadResult result;
+    std::mutex mutex;
+    result.seconds = bench::run_threads(concurrency, [&](size_t) {
+        httplib::Client client("127.0.0.1", port);
+        client.set_keep_alive(true);
+        std::vector<double> latencies;
+        size_t errors = 0, overloaded = 0;
+        for (size_t i = 0; i < requests; ++i) {
+            std::string path = i % 2 == 0 ? "/files/" + token : "/download/" + token + "/bench.bin";
+            auto begin = bench::Clock::now();
+            auto res = client.Get(path);
+            double ms = bench::seconds_since(begin) * 1e3;
+            if (res && res->status == 200) {
+                latencies.push_back(ms);
+            }
+            else {
+                ++errors;
+                if (res && res->status == 503) {
+                    ++overloaded;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        result.latencies.insert(result.latencies.end(), latencies.begin(), latencies.end());
+        result.errors += errors;
+        result.overloaded += overloaded;
+    });
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t requests = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t fileSize = argc > 2 ? std::stoul(argv[2]) : 64 * 1024;
+
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string token = "bench_load_" + generate_send_token(8);
+    std::string folder = token_folder(TokenKind::User, token);
+    fs::create_directories(folder);
+    std::ofstream(folder + "/bench.bin", std::ios::binary) << std::string(fileSize, 'x');
+    getTokenIndex().add(TokenKind::User, token);
+
+    httplib::Server svr;
+    setupServer(svr);
+    int port = svr.bind_to_any_port("127.0.0.1");
+    std::thread server([&svr] { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    const ServerConfig& config = getServerConfig();
+    std::cout << "worker_threads=" << config.worker_threads
+              << " max_queued_requests=" << config.max_queued_requests
+              << " file=" << fileSize << " bytes" << std::endl;
+
+    size_t totalErrors = 0;
+    for (size_t concurrency : {1, 4, 16, 64}) {
+        LoadResult result = runLoad(port, token, concurrency, requests);
+        size_t total = result.latencies.size() + result.errors;
+        std::cout << "concurrency " << concurrency
+                  << ": " << total / result.seconds << " req/s"
+                  << ", " << bench::latency_line(bench::summarize(result.latencies), "ms")
+                  << ", errors " << result.errors
+                  << " (503: " << result.overloaded << ")" << std::endl;
+        totalErrors += result.errors - result.overloaded;
+    }
+
+    svr.stop();
+    server.join();
+    getTokenIndex().remove(TokenKind::User, token);
+    fs::remove_all(folder);
+    flushLog();
+    return totalErrors == 0 ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file bench_metrics.cpp
+ * @brief Бенчмарк стоимости записи метрик: счётчик, гистограмма и ScopedTimer на один и несколько потоков.
+ *
+ * Запуск: bench_metrics [количество записей на поток] [количество потоков]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Средняя стоимость записи на одно ядро (время × занятые ядра / число записей)
+ */
+template <typename Sample>
+double nanosecondsPerSample(size_t count, size_t threads, Sample sample) {
+    double elapsed = bench::run_threads(threads, [&](size_t t) {
+        for (size_t i = 0; i < count; ++i) {
+            sample(t * count + i);
+        }
+    }) * 1e9;
+    return elapsed * std::min<size_t>(threads, std::max<size_t>(1, std::thread::hardware_concurrency())) / (count * threads);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 10000000;
+    size_t threads = argc > 2 ? std::stoul(argv[2]) : 8;
+
+    MetricCounter& counter = getMetrics().counter("bench_counter_total", "Benchmark counter.");
+    LatencyHistogram& histogram = getMetrics().histogram("bench_duration_seconds", "Benchmark histogram.");
+
+    for (size_t t : {size_t(1), threads}) {
+        std::cout << t << " thread(s):" << std::endl;
+        std::cout << "  counter.add:        "
+                  << nanosecondsPerSample(count, t, [&](size_t) { counter.add(); }) << " ns/sample" << std::endl;
+        std::cout << "  histogram.record:   "
+                  << nanosecondsPerSample(count, t, [&](size_t i) { histogram.record(i & 0xFFFFF); }) << " ns/sample" << std::endl;
+        std::cout << "  ScopedTimer:        "
+                  << nanosecondsPerSample(count, t, [&](size_t) { ScopedTimer timer(histogram); }) << " ns/sample" << std::endl;
+    }
+
+    // Погрешность квантилей: равномерное распределение 0..1 мс
+    LatencyHistogram uniform;
+    for (uint64_t i = 0; i < 1000000; ++i) {
+        uniform.record(i);
+    }
+    auto snapshot = uniform.snapshot();
+    std::cout << "uniform 0..1ms: p50 " << snapshot.quantile(0.5) << " ns (exact 500000), p99 "
+              << snapshot.quantile(0.99) << " ns (exact 990000)" << std::endl;
+
+    uint64_t expected = count * (1 + threads) * 1;
+    return counter.value() == expected ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+/**
+ * @file bench_ratelimit.cpp
+ * @brief Нагрузочный тест ограничения скорости: справедливость между 1000 одновременных клиентов.
+ *
+ * Каждый клиент — отдельный поток, который проходит тот же путь, что и запрос к
+ * серверу: admit_request из pre-routing обработчика, затем account_download на
+ * каждый фрагмент отдачи. Сеть не используется, поэтому измеряется ограничитель,
+ * а не пропускная способность сокетов. Сценарии:
+ * - запросы: у каждого клиента свой IP, плюс «жадный» IP с множеством потоков;
+ * - отдача по IP: то же для скорости отдачи;
+ * - отдача по токену: все клиенты качают по одной ссылке и делят её скорость.
+ * Для каждого выводятся минимум, среднее и максимум на клиента и индекс
+ * справедливости Джайна (1 — поровну).
+ *
+ * Запуск: bench_ratelimit [клиентов] [длительность, с] [потоков жадного клиента]
+ */
+
+#include "../cloudhse.h"
+
+#include <chrono>
+#include <cstdlib>
+
+namespace {
+
+const double IP_RATE = 20;
+const double IP_BURST = 10;
+const uint64_t IP_BANDWIDTH = 1024 * 1024;
+const uint64_t TOKEN_BANDWIDTH = 256 * 1024 * 1024;
+const size_t CHUNK = 64 * 1024;
+const char* const HOG_IP = "192.0.2.1";
+
+/**
+ * @brief Итог сценария по обычным клиентам
+ */
+struct Summary {
+    double min = 0;
+    double mean = 0;
+    double max = 0;
+    double jain = 0;
+};
+
+Summary summarize(const std::vector<double>& values) {
+    Summary summary;
+    double sum = 0, squares = 0;
+    summary.min = values.empty() ? 0 : values[0];
+    for (double value : values) {
+        sum += value;
+        squares += value * value;
+        summary.min = std::min(summary.min, value);
+        summary.max = std::max(summary.max, value);
+    }
+    summary.mean = values.empty() ? 0 : sum / values.size();
+    summary.jain = squares > 0 ? sum * sum / (values.size() * squares) : 0;
+    return summary;
+}
+
+/**
+ * @brief Запуск клиентов на заданное время
+ *
+ * @param clients Число обычных клиентов (у каждого свой IP 10.x.y.z)
+ * @param hog_threads Потоков жадного клиента с одним IP
+ * @param seconds Длительность
+ * @param body Работа одного потока: (IP, флаг остановки) -> накопленное значение
+ * @param hog Сумма по потокам жадного клиента
+ * @return std::vector<double> Значения обычных клиентов
+ */
+template <typename Body>
+std::vector<double> run(size_t clients, size_t hog_threads, double seconds, Body body, double& hog) {
+    // Отсчёт начинается, когда запущены все потоки, иначе ранние клиенты работают дольше
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::vector<double> results(clients, 0);
+    std::vector<double> hog_results(hog_threads, 0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < clients; ++i) {
+        threads.emplace_back([&, i] {
+            std::string ip = "10." + std::to_string(i >> 16 & 255) + "." + std::to_string(i >> 8 & 255) + "." + std::to_string(i & 255);
+            while (!start) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            results[i] = body(ip, stop);
+        });
+    }
+    for (size_t i = 0; i < hog_threads; ++i) {
+        threads.emplace_back([&, i] {
+            while (!start) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            hog_results[i] = body(HOG_IP, stop);
+        });
+    }
+    start = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    hog = 0;
+    for (double value : hog_results) {
+        hog += value;
+    }
+    return results;
+}
+
+/**
+ * @brief Один запрос через pre-routing проверку
+ */
+bool request(const std::string& ip, const std::string& path) {
+    httplib::Request req;
+    req.remote_addr = ip;
+    req.path = path;
+    httplib::Response res;
+    return admit_request(req, res);
+}
+
+/**
+ * @brief Скачивание фрагментами, пока не выставлен флаг остановки
+ *
+ * @return double Отдано байтов
+ */
+double download(const std::string& ip, const std::string& path, const std::atomic<bool>& stop) {
+    double bytes = 0;
+    while (!stop) {
+        if (!request(ip, path)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            continue;
+        }
+        // Один запрос — файл из 64 фрагментов
+        for (int i = 0; i < 64 && !stop; ++i) {
+            account_download(CHUNK);
+            // Фрагмент, дождавшийся своей очереди после остановки, в отведённое время не передан
+            if (!stop) {
+                bytes += CHUNK;
+            }
+        }
+    }
+    return bytes;
+}
+
+bool report(const char* name, const Summary& summary, double expected, const char* unit, double hog) {
+    bool fair = summary.jain >= 0.95 && summary.max <= expected * 1.1;
+    std::cout << name << ": per client min " << summary.min << ", mean " << summary.mean << ", max " << summary.max << " " << unit
+              << " (limit " << expected << "), Jain " << summary.jain;
+    if (hog >= 0) {
+        std::cout << ", greedy IP " << hog << " " << unit;
+        fair = fair && hog <= expected * 1.1;
+    }
+    std::cout << (fair ? "" : "  FAIL") << std::endl;
+    return fair;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t clients = argc > 1 ? std::stoul(argv[1]) : 1000;
+    double seconds = argc > 2 ? std::stod(argv[2]) : 5;
+    size_t hog_threads = argc > 3 ? std::stoul(argv[3]) : 50;
+
+    // Настройки читаются один раз, поэтому задаются до первого обращения к ним
+    ::setenv("HSECLOUD_RATE_LIMIT_IP", std::to_string(IP_RATE).c_str(), 1);
+    ::setenv("HSECLOUD_RATE_LIMIT_IP_BURST", std::to_string(IP_BURST).c_str(), 1);
+    ::setenv("HSECLOUD_BANDWIDTH_IP", std::to_string(IP_BANDWIDTH).c_str(), 1);
+    ::setenv("HSECLOUD_BANDWIDTH_TOKEN", std::to_string(TOKEN_BANDWIDTH).c_str(), 1);
+    setLogLevel(LogLevel::Warning);
+
+    std::string token = "benchrate" + generate_send_token(8);
+    getTokenIndex().add(TokenKind::Send, token);
+    std::cout << clients << " clients, " << seconds << " s, greedy IP with " << hog_threads << " threads" << std::endl;
+    bool ok = true;
+
+    // Обычный клиент повторяет запрос каждые 5 мс (200 в секунду), жадный — без пауз
+    double hog = 0;
+    auto admitted = run(clients, hog_threads, seconds, [](const std::string& ip, const std::atomic<bool>& stop) {
+        double count = 0;
+        while (!stop) {
+            count += request(ip, "/") ? 1 : 0;
+            if (ip != HOG_IP) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        return count;
+    }, hog);
+    ok = report("requests per IP", summarize(admitted), IP_RATE * seconds + IP_BURST, "requests", hog) && ok;
+
+    auto per_ip = run(clients, hog_threads, seconds, [](const std::string& ip, const std::atomic<bool>& stop) {
+        return download(ip, "/", stop) / (1024 * 1024);
+    }, hog);
+    ok = report("bandwidth per IP", summarize(per_ip), (IP_BANDWIDTH * seconds + BANDWIDTH_BURST) / (1024 * 1024), "MiB", hog) && ok;
+
+    auto per_token = run(clients, 0, seconds, [&token](const std::string& ip, const std::atomic<bool>& stop) {
+        return download(ip, "/sendfile/" + token + "/file.bin", stop) / (1024 * 1024);
+    }, hog);
+    Summary shared = summarize(per_token);
+    double total = shared.mean * per_token.size();
+    double token_limit = (TOKEN_BANDWIDTH * seconds + BANDWIDTH_BURST) / (1024 * 1024);
+    // Запас ведра в начале может целиком достаться первому клиенту
+    double share = (TOKEN_BANDWIDTH * seconds / clients + BANDWIDTH_BURST) / (1024 * 1024);
+    ok = report("bandwidth per token (shared)", shared, share, "MiB", -1) && ok;
+    bool capped = total <= token_limit * 1.1;
+    std::cout << "  shared token total " << total << " MiB (limit " << token_limit << ")" << (capped ? "" : "  FAIL") << std::endl;
+
+    getTokenIndex().remove(TokenKind::Send, token);
+    flushLog();
+    return ok && capped ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file bench_reaper.cpp
+ * @brief Тест сборщика анонимных ссылок: скорость удаления и задержки запросов во время его работы.
+ *
+ * Создаётся заданное число ссылок с уже истёкшим сроком (папка hidefiles/ с одним
+ * файлом и запись в shares). Сервер поднимается в этом же процессе через setupServer.
+ * Сначала измеряются задержки запросов без сборщика, затем сборщик запускается и
+ * задержки измеряются, пока он не удалит все ссылки.
+ *
+ * Запуск: bench_reaper [число ссылок] [допустимый рост p99, раз]
+ */
+
+#include "bench_common.h"
+
+namespace {
+
+/**
+ * @brief Задержки запросов листинга, пока выполняется условие
+ */
+template <typename Predicate>
+std::vector<double> measureLatency(int port, const std::string& token, Predicate keep_going) {
+    httplib::Client client("127.0.0.1", port);
+    client.set_keep_alive(true);
+    std::vector<double> latencies;
+    while (keep_going(latencies.size())) {
+        auto begin = bench::Clock::now();
+        auto res = client.Get("/files/" + token);
+        double ms = bench::seconds_since(begin) * 1e3;
+        if (res && res->status == 200) {
+            latencies.push_back(ms);
+        }
+    }
+    return latencies;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t shares = argc > 1 ? std::stoul(argv[1]) : 100000;
+    double maxSlowdown = argc > 2 ? std::stod(argv[2]) : 5.0;
+
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string prefix = "bench_reap_" + generate_send_token(6) + "_";
+    auto createStart = bench::Clock::now();
+    {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+        SQLite::Statement& insert = db->statement(
+            "INSERT OR REPLACE INTO shares (token, created, expires, max_downloads, downloads) VALUES (?, 0, 0, 0, 0)");
+        for (size_t i = 0; i < shares; ++i) {
+            std::string token = prefix + std::to_string(i);
+            std::string folder = token_folder(TokenKind::Send, token);
+            fs::create_directories(folder);
+            std::ofstream(folder + "/file.txt") << token;
+            insert.bind(1, token);
+            insert.exec();
+            insert.tryReset();
+            getTokenIndex().add(TokenKind::Send, token);
+            getShareReaper().schedule(token, 0);
+        }
+        transaction.commit();
+    }
+    double createSeconds = bench::seconds_since(createStart);
+    std::cout << "created " << shares << " expired shares in " << createSeconds << " s" << std::endl;
+
+    std::string token = "bench_reap_user_" + generate_send_token(8);
+    std::string folder = token_folder(TokenKind::User, token);
+    fs::create_directories(folder);
+    for (int i = 0; i < 50; ++i) {
+        std::ofstream(folder + "/file" + std::to_string(i) + ".txt") << i;
+    }
+    getTokenIndex().add(TokenKind::User, token);
+
+    httplib::Server svr;
+    setupServer(svr);
+    int port = svr.bind_to_any_port("127.0.0.1");
+    std::thread server([&svr] { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    std::vector<double> baseline = measureLatency(port, token, [](size_t done) { return done < 2000; });
+
+    ShareReaper& reaper = getShareReaper();
+    auto reapStart = bench::Clock::now();
+    reaper.start();
+    std::vector<double> during = measureLatency(port, token, [&](size_t) { return reaper.reaped() < shares; });
+    double reapSeconds = bench::seconds_since(reapStart);
+    reaper.stop();
+
+    bench::LatencySummary base = bench::summarize(baseline);
+    bench::LatencySummary reaping = bench::summarize(during);
+    std::cout << "reaped " << reaper.reaped() << " shares in " << reapSeconds << " s"
+              << " (" << reaper.reaped() / reapSeconds << " shares/s)" << std::endl;
+    std::cout << "baseline: " << bench::latency_line(base, "ms") << " (" << base.count << " requests)" << std::endl;
+    std::cout << "reaping:  " << bench::latency_line(reaping, "ms") << " (" << reaping.count << " requests)" << std::endl;
+
+    size_t leftovers = 0;
+    for (size_t i = 0; i < shares; ++i) {
+        std::error_code ec;
+        if (fs::exists(token_folder(TokenKind::Send, prefix + std::to_string(i)), ec)) {
+            ++leftovers;
+        }
+    }
+
+    svr.stop();
+    server.join();
+    getTokenIndex().remove(TokenKind::User, token);
+    fs::remove_all(folder);
+    flushLog();
+
+    // Задержки ниже миллисекунды сильно шумят, поэтому сравнение идёт с полом в 1 мс.
+    bool flat = reaping.p99 <= std::max(base.p99, 1.0) * maxSlowdown;
+    if (leftovers != 0) {
+        std::cout << "FAIL: " << leftovers << " share folders left on disk" << std::endl;
+    }
+    if (!flat) {
+        std::cout << "FAIL: p99 latency grew more than " << maxSlowdown << "x while reaping" << std::endl;
+    }
+    return leftovers == 0 && flat ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+/**
+ * @file bench_suite.cpp
+ * @brief Набор бенчмарков основных операций сервера с отчётом в JSON для сравнения версий.
+ *
+ * Сервер поднимается в этом же процессе через setupServer на свободном порту,
+ * HTTP сценарии выполняются клиентом httplib по keep-alive соединению (у каждого
+ * клиентского потока своё). Сценарии:
+ * - upload: загрузка файла POST /upload/<token> (содержимое каждого файла своё,
+ *   чтобы не срабатывала дедупликация);
+ * - download: скачивание файла GET /download/<token>/<file>;
+ * - listing: первая страница GET /api/files/<token> по очереди для каждой сортировки;
+ * - token_validation: запросы с неизвестным токеном (ответ 404);
+ * - token_lookup: validate_token для известных и неизвестных токенов без HTTP;
+ * - db_get_token / db_update_token: чтение и обновление токена пользователя через пул.
+ *
+ * Для воспроизводимости содержимое файлов и токены строятся из фиксированного
+ * зерна, первые итерации (прогрев) не учитываются, а в отчёт записываются версия
+ * сборки и все параметры прогона. Для каждого сценария выводятся операции в
+ * секунду, байты в секунду и задержки p50/p90/p99/p99.9/max в микросекундах.
+ * Запускать лучше в пустом каталоге: там создаются база и папки сервера.
+ *
+ * Запуск: bench_suite [файл отчёта] [итераций] [клиентов] [размер файла в байтах] [файлов в листинге]
+ */
+
+#include "bench_common.h"
+
+#include <random>
+
+#ifndef CLOUDHSE_VERSION
+#define CLOUDHSE_VERSION "unknown"
+#endif
+
+namespace {
+
+using bench::CaseResult;
+using bench::number;
+
+const uint64_t SEED = 20240601;
+const int64_t BENCH_USER_BASE = 9000000000LL;
+
+/**
+ * @brief Параметры прогона
+ */
+struct SuiteConfig {
+    size_t iterations = 2000;
+    size_t warmup = 200;
+    size_t clients = 1;
+    size_t file_size = 64 * 1024;
+    size_t listing_files = 5000;
+};
+
+/**
+ * @brief Детерминированное содержимое файла номер index
+ */
+std::string make_content(size_t size, uint64_t index) {
+    std::mt19937_64 random(SEED ^ (index * 0x9E3779B97F4A7C15ULL));
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t value = random();
+        std::memcpy(&content[i], &value, std::min<size_t>(8, size - i));
+    }
+    return content;
+}
+
+/**
+ * @brief Выполнение сценария несколькими клиентами
+ *
+ * Каждый клиент делает warmup + iterations операций, учитываются только
+ * последние iterations. Операция получает клиента, сквозной номер итерации
+ * и счётчик байтов и возвращает успех.
+ */
+template <typename Operation>
+CaseResult run_case(const std::string& name, const SuiteConfig& config, int port, Operation operation) {
+    CaseResult result;
+    result.name = name;
+    std::mutex mutex;
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> start{false};
+    bench::Clock::time_point begin;
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < config.clients; ++c) {
+        threads.emplace_back([&, c] {
+            httplib::Client client("127.0.0.1", port);
+            client.set_keep_alive(true);
+            size_t base = c * (config.warmup + config.iterations);
+            uint64_t ignored = 0;
+            for (size_t i = 0; i < config.warmup; ++i) {
+                operation(client, base + i, ignored);
+            }
+            ++ready;
+            while (!start) {
+                std::this_thread::yield();
+            }
+            std::vector<double> latencies;
+            latencies.reserve(config.iterations);
+            size_t errors = 0;
+            uint64_t bytes = 0;
+            for (size_t i = config.warmup; i < config.warmup + config.iterations; ++i) {
+                auto op_begin = bench::Clock::now();
+                bool ok = operation(client, base + i, bytes);
+                double us = bench::seconds_since(op_begin) * 1e6;
+                if (ok) {
+                    latencies.push_back(us);
+                }
+                else {
+                    ++errors;
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            result.latencies.insert(result.latencies.end(), latencies.begin(), latencies.end());
+            result.errors += errors;
+            result.bytes += bytes;
+        });
+    }
+    while (ready < config.clients) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    begin = bench::Clock::now();
+    start = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.seconds = bench::seconds_since(begin);
+    result.ops = result.latencies.size() + result.errors;
+    return result;
+}
+
+std::string to_json(const SuiteConfig& config, const std::vector<CaseResult>& results) {
+    const ServerConfig& server = getServerConfig();
+    std::string json = "{\n";
+    json += "  \"version\": \"" + json_escape(CLOUDHSE_VERSION) + "\",\n";
+    json += "  \"timestamp\": " + std::to_string(std::time(nullptr)) + ",\n";
+    json += "  \"config\": {\"iterations\": " + std::to_string(config.iterations) +
+            ", \"warmup\": " + std::to_string(config.warmup) +
+            ", \"clients\": " + std::to_string(config.clients) +
+            ", \"file_size\": " + std::to_string(config.file_size) +
+            ", \"listing_files\": " + std::to_string(config.listing_files) +
+            ", \"seed\": " + std::to_string(SEED) +
+            ", \"worker_threads\": " + std::to_string(server.worker_threads) +
+            ", \"io_backend\": \"" + json_escape(server.io_backend) + "\"" +
+            ", \"hardware_threads\": " + std::to_string(std::thread::hardware_concurrency()) + "},\n";
+    json += "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        json += i == 0 ? "\n" : ",\n";
+        json += "    " + bench::case_json(results[i]);
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string report_path = argc > 1 ? argv[1] : "bench_suite.json";
+    SuiteConfig config;
+    config.iterations = argc > 2 ? std::stoul(argv[2]) : config.iterations;
+    config.clients = argc > 3 ? std::max<size_t>(1, std::stoul(argv[3])) : config.clients;
+    config.file_size = argc > 4 ? std::stoul(argv[4]) : config.file_size;
+    config.listing_files = argc > 5 ? std::stoul(argv[5]) : config.listing_files;
+    config.warmup = std::max<size_t>(1, config.iterations / 10);
+
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    // Токены строятся из зерна, чтобы пути и порядок в листинге совпадали между прогонами
+    std::mt19937_64 random(SEED);
+    auto seeded_token = [&random] {
+        std::string token(USER_TOKEN_LENGTH, '0');
+        for (char& c : token) {
+            c = TOKEN_ALPHABET[random() % TOKEN_ALPHABET.size()];
+        }
+        return token;
+    };
+    std::string upload_token = seeded_token();
+    std::string download_token = seeded_token();
+    std::string listing_token = seeded_token();
+    std::vector<std::string> unknown_tokens(256);
+    for (auto& token : unknown_tokens) {
+        token = seeded_token();
+    }
+    for (const auto& token : { upload_token, download_token, listing_token }) {
+        fs::remove_all(token_folder(TokenKind::User, token));
+        fs::create_directories(token_folder(TokenKind::User, token));
+        getTokenIndex().add(TokenKind::User, token);
+    }
+    {
+        std::ofstream(token_folder(TokenKind::User, download_token) + "/bench.bin", std::ios::binary)
+            << make_content(config.file_size, 0);
+        std::string folder = token_folder(TokenKind::User, listing_token);
+        char name[32];
+        for (size_t i = 0; i < config.listing_files; ++i) {
+            std::snprintf(name, sizeof(name), "/file_%06zu.txt", i);
+            std::ofstream(folder + name) << std::string(i % 4096, 'x');
+        }
+    }
+    size_t users = config.clients * (config.warmup + config.iterations);
+    {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+        SQLite::Statement& insert = db->statement("INSERT OR REPLACE INTO users (id, token) VALUES (?, ?)");
+        for (size_t i = 0; i < users; ++i) {
+            insert.bind(1, BENCH_USER_BASE + static_cast<int64_t>(i));
+            insert.bind(2, upload_token);
+            insert.exec();
+            insert.tryReset();
+        }
+        transaction.commit();
+    }
+
+    httplib::Server svr;
+    setupServer(svr);
+    int port = svr.bind_to_any_port("127.0.0.1");
+    std::thread server([&svr] { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    std::cout << "version " << CLOUDHSE_VERSION << ", " << config.iterations << " iterations (+" << config.warmup
+              << " warmup), " << config.clients << " client(s), " << config.file_size << " byte files, "
+              << config.listing_files << " files in listing" << std::endl;
+
+    std::vector<CaseResult> results;
+    results.push_back(run_case("upload", config, port, [&](httplib::Client& client, size_t i, uint64_t& bytes) {
+        std::string content = make_content(config.file_size, i + 1);
+        httplib::MultipartFormDataItems items = { { "file", content, "upload_" + std::to_string(i) + ".bin", "application/octet-stream" } };
+        auto res = client.Post("/upload/" + upload_token, items);
+        bool ok = res && res->status == 200;
+        bytes += ok ? content.size() : 0;
+        return ok;
+    }));
+    results.push_back(run_case("download", config, port, [&](httplib::Client& client, size_t, uint64_t& bytes) {
+        auto res = client.Get("/download/" + download_token + "/bench.bin");
+        bool ok = res && res->status == 200 && res->body.size() == config.file_size;
+        bytes += ok ? res->body.size() : 0;
+        return ok;
+    }));
+    results.push_back(run_case("listing", config, port, [&](httplib::Client& client, size_t i, uint64_t& bytes) {
+        static const char* const SORTS[] = { "name", "size", "mtime" };
+        auto res = client.Get("/api/files/" + listing_token + "?limit=100&sort=" + SORTS[i % 3]);
+        bool ok = res && res->status == 200;
+        bytes += ok ? res->body.size() : 0;
+        return ok;
+    }));
+    results.push_back(run_case("token_validation", config, port, [&](httplib::Client& client, size_t i, uint64_t&) {
+        auto res = client.Get("/download/" + unknown_tokens[i % unknown_tokens.size()] + "/bench.bin");
+        return res && res->status == 404;
+    }));
+    results.push_back(run_case("token_lookup", config, port, [&](httplib::Client&, size_t i, uint64_t&) {
+        bool known = i % 2 == 0;
+        return validate_token(known ? download_token : unknown_tokens[i % unknown_tokens.size()]) == known;
+    }));
+    results.push_back(run_case("db_get_token", config, port, [&](httplib::Client&, size_t i, uint64_t&) {
+        return !getUserToken(BENCH_USER_BASE + static_cast<int64_t>(i)).empty();
+    }));
+    results.push_back(run_case("db_update_token", config, port, [&](httplib::Client&, size_t i, uint64_t&) {
+        updateUserToken(BENCH_USER_BASE + static_cast<int64_t>(i), i % 2 == 0 ? upload_token : download_token);
+        return true;
+    }));
+
+    size_t errors = 0;
+    for (const auto& result : results) {
+        std::cout << "  " << std::left << std::setw(18) << result.name << std::right
+                  << std::setw(12) << number(result.seconds > 0 ? result.ops / result.seconds : 0) << " ops/s"
+                  << ", " << bench::latency_line(bench::summarize(result.latencies), "us")
+                  << ", errors " << result.errors << std::endl;
+        errors += result.errors;
+    }
+    std::ofstream(report_path) << to_json(config, results);
+    std::cout << "report written to " << report_path << std::endl;
+
+    svr.stop();
+    server.join();
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& remove = db->statement("DELETE FROM users WHERE id >= ?");
+        remove.bind(1, BENCH_USER_BASE);
+        remove.exec();
+        remove.tryReset();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error removing benchmark users: " + std::string(e.what()));
+    }
+    for (const auto& token : { upload_token, download_token, listing_token }) {
+        getTokenIndex().remove(TokenKind::User, token);
+        fs::remove_all(token_folder(TokenKind::User, token));
+    }
+    flushLog();
+    return errors == 0 ? 0 : 1;
+}
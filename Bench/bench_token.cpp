@@ -0,0 +1,56 @@
+/**
+ * @file bench_token.cpp
+ * @brief Бенчмарк генерации токенов: прежняя реализация против random_token.
+ *
+ * Запуск: bench_token [количество токенов на поток] [количество потоков]
+ */
+
+#include "bench_common.h"
+
+#include <random>
+
+namespace {
+
+/**
+ * @brief Прежняя реализация generate_send_token: новый генератор на каждый вызов
+ */
+std::string legacyToken(size_t length) {
+    const char charset[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    std::default_random_engine rng(std::random_device{}());
+    std::uniform_int_distribution<> dist(0, sizeof(charset) - 2);
+
+    std::string token;
+    for (size_t i = 0; i < length; ++i) {
+        token += charset[dist(rng)];
+    }
+    return token;
+}
+
+template <typename Generate>
+double tokensPerSecond(size_t count, size_t threads, Generate generate) {
+    std::atomic<size_t> checksum{0};
+    double seconds = bench::run_threads(threads, [&](size_t) {
+        size_t local = 0;
+        for (size_t i = 0; i < count; ++i) {
+            local += static_cast<unsigned char>(generate()[0]);
+        }
+        checksum += local;
+    });
+    return checksum > 0 ? count * threads / seconds : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t threads = argc > 2 ? std::stoul(argv[2]) : 4;
+
+    for (size_t t : {size_t(1), threads}) {
+        std::cout << t << " thread(s):" << std::endl;
+        std::cout << "  legacy (random_device per call): "
+                  << tokensPerSecond(count, t, [] { return legacyToken(SEND_TOKEN_LENGTH); }) << " tokens/s" << std::endl;
+        std::cout << "  random_token (RAND_bytes pool):  "
+                  << tokensPerSecond(count, t, [] { return random_token(SEND_TOKEN_LENGTH); }) << " tokens/s" << std::endl;
+    }
+    return 0;
+}
@@ -1,9 +0,0 @@
-﻿#ifndef FUNCTIONS_H
-#define FUNCTIONS_H
-
-#include <string>
-
-std::string getCurrentDir();
-void logMessage(const std::string& message);
-
-#endif // FUNCTIONS_H
@@ -1,6 +1,6 @@
 #include <cassert>
 #include <iostream>
-#include "functions.h"
+#include "../cloudhse.h"
 
 void testGetCurrentDir() {
     std::string dir = getCurrentDir();
@@ -0,0 +1,97 @@
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../cloudhse.h"
+
+namespace {
+
+const size_t BLOCK = DELTA_MIN_BLOCK;
+
+// Применение дельты body к базовому файлу в новый файл размера size
+bool apply(const std::string& base_path, const std::string& dir, const std::string& body, uint64_t size, bool commit = false) {
+    auto base = getStorage().open(base_path, StorageMode::Read);
+    assert(base);
+    UploadFile out(dir, "patched.bin");
+    assert(out.is_open());
+    DeltaPatch patch(*base, BLOCK, out, size);
+    if (!patch.feed(body.data(), body.size()) || !patch.complete()) {
+        return false;
+    }
+    return !commit || out.commit();
+}
+
+} // namespace
+
+// Строгий разбор команд дельты: знаки, лишние поля и символы отвергаются
+void testDeltaMalformedCommands() {
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string dir = BASE_PATH + "/delta_test_" + generate_send_token(8);
+    fs::create_directories(dir);
+    std::string base_content(BLOCK * 2 + 100, '\0');
+    for (size_t i = 0; i < base_content.size(); ++i) {
+        base_content[i] = static_cast<char>(i * 13 + 5);
+    }
+    std::string base_path = dir + "/base.bin";
+    std::ofstream(base_path, std::ios::binary) << base_content;
+
+    // Размер подобран так, что команда, принятая как валидная, собрала бы файл целиком
+    const std::pair<const char*, uint64_t> malformed[] = {
+        { "D 5 garbage\nabcde", 5 },
+        { "D 5x\nabcde", 5 },
+        { "D -5\n", 5 },
+        { "D +5\nabcde", 5 },
+        { "D  5\nabcde", 5 },
+        { "D 5 \nabcde", 5 },
+        { "D 05 5\nabcde", 5 },
+        { "D\n", 0 },
+        { "D \n", 0 },
+        { "D 99999999999999999999999\n", 5 },
+        { "C 0\n", BLOCK },
+        { "C 0 1 2\n", BLOCK },
+        { "C -1 1\n", BLOCK },
+        { "C 0 -1\n", BLOCK },
+        { "C 0 +1\n", BLOCK },
+        { "C 0 1x\n", BLOCK },
+        { "C 0 1 garbage\n", BLOCK },
+        { "C 0 0\n", 0 },
+        { "C 0 1\r\n", BLOCK },
+        { "X 5\nabcde", 5 },
+    };
+    for (const auto& command : malformed) {
+        bool accepted = apply(base_path, dir, command.first, command.second);
+        if (accepted) {
+            std::cerr << "Accepted malformed command: " << command.first << std::endl;
+        }
+        assert(!accepted);
+    }
+
+    // Корректная дельта: блок 1 прежней версии, затем новые данные и хвост базы
+    std::string body = "C 1 1\nD 5\nabcdeC 2 1\n";
+    uint64_t size = BLOCK + 5 + 100;
+    assert(apply(base_path, dir, body, size, true));
+    std::ifstream patched(dir + "/patched.bin", std::ios::binary);
+    std::stringstream data;
+    data << patched.rdbuf();
+    assert(data.str() == base_content.substr(BLOCK, BLOCK) + "abcde" + base_content.substr(BLOCK * 2));
+
+    fs::remove_all(dir);
+    flushLog();
+    std::cout << "Delta Malformed Commands Test Passed" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string testName = argv[1];
+        if (testName == "testDeltaMalformedCommands") {
+            testDeltaMalformedCommands();
+        }
+    } else {
+        std::cerr << "No test specified." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,7 +1,11 @@
 #include <cassert>
+#include <chrono>
 #include <fstream>
 #include <iostream>
-#include "functions.h"
+#include <string>
+#include <thread>
+#include <vector>
+#include "../cloudhse.h"
 
 void testGetCurrentDir() {
     std::string dir = getCurrentDir();
@@ -12,6 +16,7 @@ void testGetCurrentDir() {
 void testLogMessage() {
     std::string testMessage = "Test log message";
     logMessage(testMessage);
+    flushLog();
 
     std::ifstream logFile(getCurrentDir() + "/bot.log");
     std::string lastLine;
@@ -28,6 +33,61 @@ void testLogMessage() {
     std::cout << "Log Message Test Passed" << std::endl;
 }
 
+void testLogMessageConcurrent() {
+    const int threadCount = 8;
+    const int messagesPerThread = 10000;
+    const std::string runId = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    const uint64_t droppedBefore = getDroppedLogMessages();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < messagesPerThread; ++i) {
+                logMessage(LogLevel::Info, "Concurrent log test", { {"run", runId}, {"thread", std::to_string(t)}, {"seq", std::to_string(i)} });
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    flushLog();
+
+    // Сообщения одного потока должны идти по возрастанию seq, в том числе через ротацию файла
+    std::vector<int> lastSeq(threadCount, -1);
+    uint64_t found = 0;
+    for (int rotated = 9; rotated >= 0; --rotated) {
+        std::string path = getCurrentDir() + "/bot.log" + (rotated > 0 ? "." + std::to_string(rotated) : "");
+        std::ifstream logFile(path);
+        std::string line;
+        while (std::getline(logFile, line)) {
+            if (line.find("run=" + runId + " ") == std::string::npos) {
+                continue;
+            }
+            size_t threadPos = line.find("thread=");
+            size_t seqPos = line.find("seq=");
+            assert(threadPos != std::string::npos && seqPos != std::string::npos);
+            int thread = std::stoi(line.substr(threadPos + 7));
+            int seq = std::stoi(line.substr(seqPos + 4));
+            assert(thread >= 0 && thread < threadCount);
+            assert(seq > lastSeq[thread]);
+            lastSeq[thread] = seq;
+            ++found;
+        }
+    }
+
+    const uint64_t total = static_cast<uint64_t>(threadCount) * messagesPerThread;
+    const uint64_t dropped = getDroppedLogMessages() - droppedBefore;
+    assert(found + dropped == total);
+    assert(found > 0);
+
+    std::cout << "Logged " << total << " messages from " << threadCount << " threads in "
+              << elapsed.count() << " s (" << static_cast<uint64_t>(total / elapsed.count())
+              << " msg/s, dropped " << dropped << ")" << std::endl;
+    std::cout << "Concurrent Log Message Test Passed" << std::endl;
+}
+
 int main(int argc, char **argv) {
     if (argc > 1) {
         std::string testName = argv[1];
@@ -35,6 +95,8 @@ int main(int argc, char **argv) {
             testGetCurrentDir();
         } else if (testName == "testLogMessage") {
             testLogMessage();
+        } else if (testName == "testLogMessageConcurrent") {
+            testLogMessageConcurrent();
         }
     } else {
         std::cerr << "No test specified." << std::endl;
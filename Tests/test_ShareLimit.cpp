@@ -0,0 +1,88 @@
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <string>
+#include "../cloudhse.h"
+
+namespace {
+
+// Запрос на скачивание файла ссылки с заданными заголовками и диапазонами
+httplib::Response download(const std::string& token, const std::string& filename, const httplib::Headers& headers,
+                           const httplib::Ranges& ranges = {}) {
+    httplib::Request req;
+    req.method = "GET";
+    req.path = "/" + token + "/" + filename;
+    req.headers = headers;
+    req.ranges = ranges;
+    std::regex route(R"(/([0-9A-Za-z]+)/(.+))");
+    std::regex_match(req.path, req.matches, route);
+    httplib::Response res;
+    handle_file_download(req, res);
+    return res;
+}
+
+} // namespace
+
+// Условные запросы и Range расходуют лимит ссылки по отданным байтам и не позволяют его превысить
+void testShareLimitConditional() {
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string token = generate_unique_token(TokenKind::Send, SEND_TOKEN_LENGTH);
+    std::string folder = token_folder(TokenKind::Send, token);
+    fs::create_directories(folder);
+    {
+        std::ofstream file(folder + "/limit.bin", std::ios::binary);
+        file << std::string(1000, 'x');
+    }
+    getTokenIndex().add(TokenKind::Send, token);
+    register_share(token, 3600, 2);
+
+    // Несовпавший If-None-Match отдаёт файл целиком и расходует одно скачивание
+    auto first = download(token, "limit.bin", { {"If-None-Match", "\"other\""} });
+    assert(first.status != 404 && first.has_header("ETag"));
+    std::string etag = first.get_header_value("ETag");
+
+    // Совпавший If-None-Match (304) лимит не расходует
+    for (int i = 0; i < 5; ++i) {
+        auto cached = download(token, "limit.bin", { {"If-None-Match", etag} });
+        assert(cached.status == 304);
+    }
+
+    // Range: bytes=1- — почти весь файл, расходует 999 байт из оставшихся 1000
+    auto tail = download(token, "limit.bin", {}, { {1, -1} });
+    assert(tail.status != 404);
+
+    // If-Modified-Since и Range: bytes=0- отдали бы файл целиком сверх лимита
+    auto since = download(token, "limit.bin", { {"If-Modified-Since", http_date(std::time(nullptr))} });
+    assert(since.status == 404);
+    auto whole = download(token, "limit.bin", {}, { {0, -1} });
+    assert(whole.status == 404);
+    auto again = download(token, "limit.bin", {}, { {1, -1} });
+    assert(again.status == 404);
+
+    // Последний байт помещается в остаток и исчерпывает лимит
+    auto last = download(token, "limit.bin", {}, { {999, 999} });
+    assert(last.status != 404);
+    auto after = download(token, "limit.bin", {}, { {999, 999} });
+    assert(after.status == 404);
+
+    getTokenIndex().remove(TokenKind::Send, token);
+    fs::remove_all(folder);
+    flushLog();
+    std::cout << "Share Limit Conditional Test Passed" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string testName = argv[1];
+        if (testName == "testShareLimitConditional") {
+            testShareLimitConditional();
+        }
+    } else {
+        std::cerr << "No test specified." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "../cloudhse.h"
+
+void testTokenAlphabet() {
+    const std::string alphabet = "abc";
+    std::string token = random_token(1000, alphabet);
+    assert(token.size() == 1000);
+    for (char c : token) {
+        assert(alphabet.find(c) != std::string::npos);
+    }
+
+    std::string defaultToken = random_token(18);
+    assert(defaultToken.size() == 18);
+    for (char c : defaultToken) {
+        assert(c != '\0');
+        assert(TOKEN_ALPHABET.find(c) != std::string::npos);
+    }
+    std::cout << "Token Alphabet Test Passed" << std::endl;
+}
+
+void testTokenUniformity() {
+    // Критерий хи-квадрат по частотам символов: 61 степень свободы, порог для p = 0.001 — 100.9
+    const size_t sampleSize = 2000000;
+    std::vector<size_t> counts(TOKEN_ALPHABET.size(), 0);
+    std::string sample = random_token(sampleSize);
+    for (char c : sample) {
+        ++counts[TOKEN_ALPHABET.find(c)];
+    }
+
+    const double expected = static_cast<double>(sampleSize) / TOKEN_ALPHABET.size();
+    double chiSquare = 0;
+    for (size_t count : counts) {
+        double diff = static_cast<double>(count) - expected;
+        chiSquare += diff * diff / expected;
+    }
+    std::cout << "Chi-square over " << TOKEN_ALPHABET.size() << " symbols: " << chiSquare << std::endl;
+    assert(chiSquare < 100.9);
+    std::cout << "Token Uniformity Test Passed" << std::endl;
+}
+
+void testTokenUniqueness() {
+    const size_t threadCount = 4;
+    const size_t tokensPerThread = 50000;
+    std::vector<std::vector<std::string>> tokens(threadCount);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&tokens, t] {
+            for (size_t i = 0; i < tokensPerThread; ++i) {
+                tokens[t].push_back(random_token(12));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::unordered_set<std::string> unique;
+    for (const auto& list : tokens) {
+        unique.insert(list.begin(), list.end());
+    }
+    assert(unique.size() == threadCount * tokensPerThread);
+    std::cout << "Token Uniqueness Test Passed" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string testName = argv[1];
+        if (testName == "testTokenAlphabet") {
+            testTokenAlphabet();
+        } else if (testName == "testTokenUniformity") {
+            testTokenUniformity();
+        } else if (testName == "testTokenUniqueness") {
+            testTokenUniqueness();
+        }
+    } else {
+        std::cerr << "No test specified." << std::endl;
+        return 1;
+    }
+    return 0;
+}
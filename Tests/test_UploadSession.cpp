@@ -0,0 +1,176 @@
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "../cloudhse.h"
+
+// Загрузка по частям через маршруты, настроенные setupServer: создание сессии,
+// фрагменты в обратном порядке и завершение
+void testUploadSession() {
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string token = random_token(USER_TOKEN_LENGTH);
+    std::string folder = token_folder(TokenKind::User, token);
+    fs::create_directories(folder);
+    getTokenIndex().add(TokenKind::User, token);
+
+    httplib::Server svr;
+    setupServer(svr);
+    int port = svr.bind_to_any_port("127.0.0.1");
+    assert(port > 0);
+    std::thread server([&svr] { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    std::string content(300000, '\0');
+    for (size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    const size_t split = 123457;
+
+    httplib::Client client("127.0.0.1", port);
+    auto created = client.Post("/api/upload/session?token=" + token + "&filename=session.bin&size=" + std::to_string(content.size()));
+    assert(created && created->status == 200);
+    size_t start = created->body.find("\"session\": \"");
+    assert(start != std::string::npos);
+    start += 12;
+    std::string session = created->body.substr(start, created->body.find('"', start) - start);
+    assert(!session.empty());
+
+    auto second = client.Put("/api/upload/session/" + session + "?offset=" + std::to_string(split),
+                             content.substr(split), "application/octet-stream");
+    assert(second && second->status == 200);
+    auto first = client.Put("/api/upload/session/" + session + "?offset=0",
+                            content.substr(0, split), "application/octet-stream");
+    assert(first && first->status == 200);
+
+    auto status = client.Get("/api/upload/session/" + session);
+    assert(status && status->status == 200);
+    assert(status->body.find("\"received\": [[0, " + std::to_string(content.size()) + "]]") != std::string::npos);
+
+    auto finalized = client.Post("/api/upload/session/" + session + "/finalize");
+    assert(finalized && finalized->status == 200);
+    assert(finalized->body.find("\"file\": \"session.bin\"") != std::string::npos);
+
+    std::ifstream stored(folder + "/session.bin", std::ios::binary);
+    std::stringstream data;
+    data << stored.rdbuf();
+    assert(data.str() == content);
+
+    // Сессия после завершения удалена
+    auto gone = client.Get("/api/upload/session/" + session);
+    assert(gone && gone->status == 404);
+
+    svr.stop();
+    server.join();
+    getTokenIndex().remove(TokenKind::User, token);
+    fs::remove_all(folder);
+    flushLog();
+    std::cout << "Upload Session Test Passed" << std::endl;
+}
+
+// Медленный фрагмент и завершение сессии: завершение ждёт, пока фрагмент допишется,
+// новые фрагменты во время ожидания отклоняются, а блоб совпадает со своим SHA-256
+void testFinalizeWaitsForChunk() {
+    setLogLevel(LogLevel::Warning);
+    initDatabase();
+
+    std::string token = random_token(USER_TOKEN_LENGTH);
+    std::string folder = token_folder(TokenKind::User, token);
+    fs::create_directories(folder);
+    getTokenIndex().add(TokenKind::User, token);
+
+    httplib::Server svr;
+    setupServer(svr);
+    int port = svr.bind_to_any_port("127.0.0.1");
+    assert(port > 0);
+    std::thread server([&svr] { svr.listen_after_bind(); });
+    svr.wait_until_ready();
+
+    const size_t size = 200000;
+    std::string content(size, 'a');
+    httplib::Client client("127.0.0.1", port);
+    auto created = client.Post("/api/upload/session?token=" + token + "&filename=race.bin&size=" + std::to_string(size));
+    assert(created && created->status == 200);
+    size_t start = created->body.find("\"session\": \"") + 12;
+    std::string session = created->body.substr(start, created->body.find('"', start) - start);
+    std::string rewrite(size / 2, 'b');
+    for (size_t offset = 0; offset < size; offset += rewrite.size()) {
+        auto put = client.Put("/api/upload/session/" + session + "?offset=" + std::to_string(offset),
+                              content.substr(offset, rewrite.size()), "application/octet-stream");
+        assert(put && put->status == 200);
+    }
+
+    // Повтор первого фрагмента другими байтами, который останавливается посередине
+    std::promise<void> started;
+    std::promise<void> resume;
+    std::shared_future<void> resumed = resume.get_future().share();
+    httplib::Request req;
+    req.path = "/api/upload/session/" + session;
+    std::regex route(R"(/api/upload/session/([0-9A-Za-z]+))");
+    std::regex_match(req.path, req.matches, route);
+    req.params.emplace("offset", "0");
+    req.headers.emplace("Content-Length", std::to_string(rewrite.size()));
+    httplib::Response chunk_res;
+    httplib::ContentReader reader([&](httplib::ContentReceiver receiver) {
+        if (!receiver(rewrite.data(), rewrite.size() / 2)) {
+            return false;
+        }
+        started.set_value();
+        resumed.wait();
+        return receiver(rewrite.data() + rewrite.size() / 2, rewrite.size() - rewrite.size() / 2);
+    }, nullptr);
+    std::thread writer([&] { handle_upload_chunk(req, chunk_res, reader); });
+    started.get_future().wait();
+
+    auto finalizing = std::async(std::launch::async, [&] {
+        return client.Post("/api/upload/session/" + session + "/finalize");
+    });
+    assert(finalizing.wait_for(std::chrono::milliseconds(300)) == std::future_status::timeout);
+
+    // Пока завершение ждёт, новые фрагменты не принимаются
+    auto late = client.Put("/api/upload/session/" + session + "?offset=0", std::string(10, 'c'), "application/octet-stream");
+    assert(late && late->status == 409);
+
+    resume.set_value();
+    writer.join();
+    assert(chunk_res.status != 500 && chunk_res.body.find("\"length\": 100000") != std::string::npos);
+    auto finalized = finalizing.get();
+    assert(finalized && finalized->status == 200);
+
+    std::ifstream stored(folder + "/race.bin", std::ios::binary);
+    std::stringstream data;
+    data << stored.rdbuf();
+    assert(data.str() == rewrite + content.substr(rewrite.size()));
+    Sha256 hash;
+    hash.update(data.str().data(), data.str().size());
+    std::string digest = hash.hex_digest();
+    assert(blob_hash_for(folder + "/race.bin") == digest);
+
+    svr.stop();
+    server.join();
+    getTokenIndex().remove(TokenKind::User, token);
+    fs::remove_all(folder);
+    flushLog();
+    std::cout << "Finalize Waits For Chunk Test Passed" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        std::string testName = argv[1];
+        if (testName == "testUploadSession") {
+            testUploadSession();
+        } else if (testName == "testFinalizeWaitsForChunk") {
+            testFinalizeWaitsForChunk();
+        }
+    } else {
+        std::cerr << "No test specified." << std::endl;
+        return 1;
+    }
+    return 0;
+}
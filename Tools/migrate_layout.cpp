@@ -0,0 +1,185 @@
+/**
+ * @file migrate_layout.cpp
+ * @brief Перенос папок files/ и hidefiles/ в другую глубину шардирования.
+ *
+ * Запускается при остановленном сервере. Папки токенов, найденные с текущей
+ * глубиной shard_depth, переименовываются в новое место несколькими потоками
+ * (блобы связаны жёсткими ссылками и не копируются). Затем в одной транзакции
+ * обновляются пути в file_refs и ключи folder_usage, удаляются опустевшие
+ * промежуточные папки, а в server.conf записывается новая глубина.
+ *
+ * Запуск: migrate_layout <новая глубина> [потоков]
+ */
+
+#include "../cloudhse.h"
+
+#include <set>
+
+namespace {
+
+/**
+ * @brief Перенос одной папки токена
+ */
+struct FolderMove {
+    std::string from;
+    std::string to;
+};
+
+/**
+ * @brief Удаление опустевших папок шардирования, из которых были перенесены токены
+ * 
+ * Удаляются только бывшие родители перенесённых папок (от глубоких к корню),
+ * поэтому пустые папки самих токенов не затрагиваются.
+ */
+void removeEmptyShards(const std::vector<FolderMove>& moves, const std::vector<char>& moved) {
+    std::set<std::string> parents;
+    for (size_t i = 0; i < moves.size(); ++i) {
+        if (!moved[i]) {
+            continue;
+        }
+        for (fs::path dir = fs::path(moves[i].from).parent_path();
+             dir != token_root(TokenKind::User) && dir != token_root(TokenKind::Send) && dir.has_relative_path();
+             dir = dir.parent_path()) {
+            parents.insert(dir.string());
+        }
+    }
+    std::vector<std::string> ordered(parents.begin(), parents.end());
+    std::sort(ordered.begin(), ordered.end(), [](const std::string& a, const std::string& b) { return a.size() > b.size(); });
+    for (const auto& dir : ordered) {
+        std::error_code ec;
+        if (fs::is_empty(dir, ec)) {
+            fs::remove(dir, ec);
+        }
+    }
+}
+
+/**
+ * @brief Запись новой глубины в server.conf с сохранением остальных строк
+ */
+void writeShardDepth(size_t depth) {
+    std::string path = BASE_PATH + "/server.conf";
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string key = line.substr(0, line.find('='));
+        key.erase(std::remove_if(key.begin(), key.end(), [](unsigned char c) { return std::isspace(c); }), key.end());
+        if (key != "shard_depth") {
+            lines.push_back(line);
+        }
+    }
+    in.close();
+    std::ofstream out(path, std::ios::trunc);
+    for (const auto& kept : lines) {
+        out << kept << "\n";
+    }
+    out << "shard_depth = " << depth << "\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: migrate_layout <depth 0-" << MAX_SHARD_DEPTH << "> [threads]" << std::endl;
+        return 2;
+    }
+    size_t target = std::stoul(argv[1]);
+    size_t threads = argc > 2 ? std::max<size_t>(1, std::stoul(argv[2])) : std::max<size_t>(4, std::thread::hardware_concurrency());
+    if (target > MAX_SHARD_DEPTH) {
+        std::cerr << "Depth must be at most " << MAX_SHARD_DEPTH << std::endl;
+        return 2;
+    }
+    if (std::getenv("HSECLOUD_SHARD_DEPTH")) {
+        std::cerr << "HSECLOUD_SHARD_DEPTH is set; unset it so server.conf decides the layout" << std::endl;
+        return 2;
+    }
+
+    initDatabase();
+    size_t current = getServerConfig().shard_depth;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<FolderMove> moves;
+    for (TokenKind kind : { TokenKind::User, TokenKind::Send }) {
+        for_each_token_folder(kind, current, [&](const std::string& token, const fs::path& folder) {
+            // После прерванного переноса рядом с папками токенов лежат папки новых
+            // уровней; их имена короче любого токена, и они уже на своём месте
+            if (current < target && token.size() <= SHARD_WIDTH) {
+                return;
+            }
+            std::string to = token_root(kind) + "/" + shard_prefix(token, target) + token;
+            if (folder.string() != to) {
+                moves.push_back({ folder.string(), to });
+            }
+        });
+    }
+    std::cout << "Moving " << moves.size() << " folders from depth " << current << " to " << target
+              << " using " << threads << " threads" << std::endl;
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    std::vector<char> moved(moves.size(), 0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (size_t i = next++; i < moves.size(); i = next++) {
+                std::error_code ec;
+                fs::create_directories(fs::path(moves[i].to).parent_path(), ec);
+                fs::rename(moves[i].from, moves[i].to, ec);
+                if (ec) {
+                    ++failed;
+                    logMessage(LogLevel::Error, "Error moving folder: " + ec.message(), { {"from", moves[i].from}, {"to", moves[i].to} });
+                    continue;
+                }
+                moved[i] = 1;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+        SQLite::Statement& refs = db->statement(
+            "UPDATE file_refs SET path = ?1 || substr(path, ?2) WHERE path >= ?3 AND path < ?4");
+        SQLite::Statement& usage = db->statement("UPDATE folder_usage SET folder = ? WHERE folder = ?");
+        for (size_t i = 0; i < moves.size(); ++i) {
+            if (!moved[i]) {
+                continue;
+            }
+            std::string from = relative_to_base(moves[i].from);
+            std::string to = relative_to_base(moves[i].to);
+            refs.bind(1, to + "/");
+            refs.bind(2, static_cast<int64_t>(from.size() + 2));
+            refs.bind(3, from + "/");
+            refs.bind(4, from + "0");
+            refs.exec();
+            refs.tryReset();
+            usage.bind(1, to);
+            usage.bind(2, from);
+            usage.exec();
+            usage.tryReset();
+        }
+        transaction.commit();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error updating database paths: " + std::string(e.what()));
+        std::cerr << "Folders were moved but the database was not updated: " << e.what() << std::endl;
+        flushLog();
+        return 1;
+    }
+
+    removeEmptyShards(moves, moved);
+    if (failed == 0) {
+        writeShardDepth(target);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Moved " << moves.size() - failed << " folders in " << seconds << " s, failed " << failed << std::endl;
+    if (failed != 0) {
+        std::cout << "server.conf was not changed; fix the errors above and run again" << std::endl;
+    }
+    flushLog();
+    return failed == 0 ? 0 : 1;
+}
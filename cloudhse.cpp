@@ -0,0 +1,4295 @@
+#include "cloudhse.h"
+
+/**
+ * @brief Получение текущего рабочего каталога
+ * 
+ * @return std::string Текущий рабочий каталог
+ */
+std::string getCurrentDir() {
+    return fs::current_path().string();
+}
+
+const std::string BASE_PATH = getCurrentDir();
+const std::string DB_PATH = BASE_PATH + "/cloud_storage.db";
+const std::string HTML_PATH = BASE_PATH + "/";
+const std::string LOG_PATH = BASE_PATH + "/bot.log";
+const std::string BLOB_PATH = BASE_PATH + "/blobs";
+const std::string UPLOADS_PATH = BASE_PATH + "/uploads";
+
+/**
+ * @brief Применение одного параметра настроек
+ * 
+ * @param config Настройки
+ * @param key Имя параметра в нижнем регистре
+ * @param value Значение
+ */
+void applyConfigValue(ServerConfig& config, const std::string& key, const std::string& value) {
+    try {
+        if (key == "host") config.host = value;
+        else if (key == "port") config.port = std::stoi(value);
+        else if (key == "worker_threads") config.worker_threads = std::max<size_t>(1, std::stoull(value));
+        else if (key == "max_queued_requests") config.max_queued_requests = std::stoull(value);
+        else if (key == "keep_alive_max_count") config.keep_alive_max_count = std::stoull(value);
+        else if (key == "keep_alive_timeout") config.keep_alive_timeout = std::stoll(value);
+        else if (key == "read_timeout") config.read_timeout = std::stoll(value);
+        else if (key == "write_timeout") config.write_timeout = std::stoll(value);
+        else if (key == "max_upload_size") config.max_upload_size = std::stoull(value);
+        else if (key == "cpu_threads") config.cpu_threads = std::max<size_t>(1, std::stoull(value));
+        else if (key == "cpu_queue") config.cpu_queue = std::stoull(value);
+        else if (key == "user_quota") config.user_quota = std::stoull(value);
+        else if (key == "usage_scan_interval") config.usage_scan_interval = std::max<size_t>(1, std::stoull(value));
+        else if (key == "shard_depth") config.shard_depth = std::min<size_t>(MAX_SHARD_DEPTH, std::stoull(value));
+        else if (key == "hot_cache_size") config.hot_cache_size = std::stoull(value);
+        else if (key == "hot_cache_max_file") config.hot_cache_max_file = std::stoull(value);
+        else if (key == "io_backend") {
+            if (value == "posix" || value == "uring") config.io_backend = value;
+            else config.warnings.push_back("Invalid value for config key " + key + ": " + value);
+        }
+        else if (key == "io_queue_depth") config.io_queue_depth = std::min<size_t>(64, std::max<size_t>(1, std::stoull(value)));
+        else if (key == "io_direct") config.io_direct = value == "1" || value == "true" || value == "yes";
+        else if (key == "share_ttl") config.share_ttl = std::max<uint64_t>(1, std::stoull(value));
+        else if (key == "share_max_ttl") config.share_max_ttl = std::max<uint64_t>(1, std::stoull(value));
+        else if (key == "rate_limit_ip") config.rate_limit_ip = std::max(0.0, std::stod(value));
+        else if (key == "rate_limit_ip_burst") config.rate_limit_ip_burst = std::max(1.0, std::stod(value));
+        else if (key == "rate_limit_token") config.rate_limit_token = std::max(0.0, std::stod(value));
+        else if (key == "rate_limit_token_burst") config.rate_limit_token_burst = std::max(1.0, std::stod(value));
+        else if (key == "bandwidth_ip") config.bandwidth_ip = std::stoull(value);
+        else if (key == "bandwidth_token") config.bandwidth_token = std::stoull(value);
+        else if (key == "replication_role") {
+            if (value.empty() || value == "leader" || value == "follower") config.replication_role = value;
+            else config.warnings.push_back("Invalid value for config key " + key + ": " + value);
+        }
+        else if (key == "replication_peer") config.replication_peer = value;
+        else if (key == "replication_secret") config.replication_secret = value;
+        else if (key == "template_reload") config.template_reload = value == "1" || value == "true" || value == "yes";
+        else config.warnings.push_back("Unknown config key: " + key);
+    }
+    catch (const std::exception&) {
+        config.warnings.push_back("Invalid value for config key " + key + ": " + value);
+    }
+}
+
+/**
+ * @brief Загрузка настроек сервера
+ * 
+ * @return ServerConfig Настройки с учётом server.conf и переменных окружения
+ */
+ServerConfig loadServerConfig() {
+    static const char* const KEYS[] = {
+        "host", "port", "worker_threads", "max_queued_requests", "keep_alive_max_count", "keep_alive_timeout",
+        "read_timeout", "write_timeout", "max_upload_size", "cpu_threads", "cpu_queue", "template_reload", "user_quota", "usage_scan_interval",
+        "share_ttl", "share_max_ttl", "shard_depth", "io_backend", "io_queue_depth", "io_direct",
+        "hot_cache_size", "hot_cache_max_file", "rate_limit_ip", "rate_limit_ip_burst", "rate_limit_token",
+        "rate_limit_token_burst", "bandwidth_ip", "bandwidth_token", "replication_role", "replication_peer",
+        "replication_secret"
+    };
+
+    ServerConfig config;
+    std::ifstream file(BASE_PATH + "/server.conf");
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        auto trim = [](std::string value) {
+            size_t begin = value.find_first_not_of(" \t\r");
+            size_t end = value.find_last_not_of(" \t\r");
+            return begin == std::string::npos ? std::string() : value.substr(begin, end - begin + 1);
+        };
+        applyConfigValue(config, trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+
+    for (const char* key : KEYS) {
+        std::string name = "HSECLOUD_" + std::string(key);
+        std::transform(name.begin(), name.end(), name.begin(),
+            [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+        if (const char* value = std::getenv(name.c_str())) {
+            applyConfigValue(config, key, value);
+        }
+    }
+    return config;
+}
+
+/**
+ * @brief Получение настроек сервера
+ * 
+ * Настройки читаются один раз при первом обращении.
+ * 
+ * @return const ServerConfig& Настройки процесса
+ */
+const ServerConfig& getServerConfig() {
+    static const ServerConfig config = loadServerConfig();
+    return config;
+}
+
+thread_local bool t_server_overloaded = false;
+
+/**
+ * @brief Получение общего пула вычислительных задач
+ * 
+ * @return CpuPool& Пул с cpu_threads потоками
+ */
+CpuPool& getCpuPool() {
+    static CpuPool pool(getServerConfig().cpu_threads, getServerConfig().cpu_queue);
+    return pool;
+}
+
+/**
+ * @brief Форматирование строки журнала
+ * 
+ * Значения полей, содержащие пробелы, кавычки или '=', заключаются в кавычки.
+ * 
+ * @param level Уровень важности
+ * @param message Сообщение
+ * @param fields Дополнительные поля ключ=значение
+ * @return std::string Строка вида "2024-05-01 12:00:00.123 [INFO] message key=value\n"
+ */
+std::string formatLogLine(LogLevel level, const std::string& message, std::initializer_list<LogField> fields) {
+    static const char* const LEVEL_NAMES[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    std::tm tm{};
+#ifndef _WIN32
+    localtime_r(&seconds, &tm);
+#else
+    localtime_s(&tm, &seconds);
+#endif
+    char timestamp[32];
+    size_t length = std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+    std::snprintf(timestamp + length, sizeof(timestamp) - length, ".%03d", static_cast<int>(millis));
+
+    std::string line;
+    line.reserve(48 + message.size());
+    line += timestamp;
+    line += " [";
+    line += LEVEL_NAMES[static_cast<int>(level)];
+    line += "] ";
+    line += message;
+    for (const auto& field : fields) {
+        line += ' ';
+        line += field.first;
+        line += '=';
+        if (field.second.empty() || field.second.find_first_of(" \"=") != std::string::npos) {
+            line += '"';
+            line += field.second;
+            line += '"';
+        }
+        else {
+            line += field.second;
+        }
+    }
+    line += '\n';
+    return line;
+}
+
+/**
+ * @brief Получение общего журнала
+ * 
+ * @return AsyncLogger& Журнал, пишущий в LOG_PATH
+ */
+AsyncLogger& getLogger() {
+    static AsyncLogger logger(LOG_PATH);
+    return logger;
+}
+
+/**
+ * @brief Логирование сообщений
+ * 
+ * Сообщение ставится в очередь и записывается на диск фоновым потоком.
+ * 
+ * @param level Уровень важности
+ * @param message Сообщение для логирования
+ * @param fields Дополнительные поля ключ=значение
+ */
+void logMessage(LogLevel level, const std::string& message, std::initializer_list<LogField> fields) {
+    AsyncLogger& logger = getLogger();
+    if (level < logger.level()) {
+        return;
+    }
+    logger.push(formatLogLine(level, message, fields), level >= LogLevel::Error);
+}
+
+/**
+ * @brief Логирование сообщений
+ * 
+ * @param message Сообщение для логирования
+ */
+void logMessage(const std::string& message) {
+    logMessage(LogLevel::Info, message);
+}
+
+/**
+ * @brief Ожидание записи в файл всех поставленных сообщений
+ */
+void flushLog() {
+    getLogger().flush();
+}
+
+/**
+ * @brief Установка минимального уровня записываемых сообщений
+ * 
+ * @param level Минимальный уровень
+ */
+void setLogLevel(LogLevel level) {
+    getLogger().set_level(level);
+}
+
+/**
+ * @brief Количество сообщений, отброшенных из-за переполнения очереди
+ * 
+ * @return uint64_t Число отброшенных сообщений
+ */
+uint64_t getDroppedLogMessages() {
+    return getLogger().dropped();
+}
+
+/**
+ * @brief Номер полосы метрик для текущего потока
+ */
+size_t metric_stripe() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % METRIC_STRIPES;
+    return stripe;
+}
+
+/**
+ * @brief Получение общего реестра метрик
+ * 
+ * @return MetricsRegistry& Реестр процесса
+ */
+MetricsRegistry& getMetrics() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+/**
+ * @brief Гистограмма длительности запроса к базе данных
+ * 
+ * @param query Имя функции, выполняющей запрос
+ * @return LatencyHistogram& Гистограмма hsecloud_db_query_duration_seconds
+ */
+LatencyHistogram& db_query_histogram(const std::string& query) {
+    return getMetrics().histogram("hsecloud_db_query_duration_seconds", "SQLite helper latency.", "query=\"" + query + "\"");
+}
+
+/**
+ * @brief Счётчик принятых байтов загружаемых файлов
+ */
+MetricCounter& upload_bytes_counter() {
+    static MetricCounter& counter = getMetrics().counter("hsecloud_upload_bytes_total", "Bytes received in file uploads.");
+    return counter;
+}
+
+/**
+ * @brief Счётчик отданных байтов файлов (после сжатия)
+ */
+MetricCounter& download_bytes_counter() {
+    static MetricCounter& counter = getMetrics().counter("hsecloud_download_bytes_total", "Bytes sent in file downloads.");
+    return counter;
+}
+
+/**
+ * @brief Получение общего пула соединений с базой данных
+ * 
+ * Пул открывается при первом обращении.
+ * 
+ * @return DbPool& Пул соединений для DB_PATH
+ */
+DbPool& getDbPool() {
+    static DbPool pool(DB_PATH, DB_READER_COUNT);
+    return pool;
+}
+
+/**
+ * @brief Проверка, что узел отправляет свои изменения ведомому (роль leader)
+ */
+bool is_replication_leader() {
+    return getServerConfig().replication_role == "leader";
+}
+
+/**
+ * @brief Проверка, что узел — ведомый только для чтения (роль follower)
+ */
+bool is_replication_follower() {
+    return getServerConfig().replication_role == "follower";
+}
+
+/**
+ * @brief Запись изменения в очередь репликации
+ * 
+ * Запись делается на переданном соединении, поэтому внутри транзакции
+ * изменения она фиксируется вместе с ним. Поля разделяются табуляцией, а
+ * '%', табуляция и переводы строк в значениях кодируются как %XX. Без роли
+ * leader ничего не делает.
+ * 
+ * @param db Соединение для записи
+ * @param fields Операция и её аргументы
+ */
+void replicate(DbConnection& db, const std::vector<std::string>& fields) {
+    if (!is_replication_leader()) {
+        return;
+    }
+    static const char HEX[] = "0123456789ABCDEF";
+    std::string entry;
+    for (const auto& field : fields) {
+        if (!entry.empty()) {
+            entry += '\t';
+        }
+        for (char c : field) {
+            if (c == '%' || c == '\t' || c == '\n' || c == '\r') {
+                entry += '%';
+                entry += HEX[static_cast<unsigned char>(c) >> 4];
+                entry += HEX[static_cast<unsigned char>(c) & 0x0F];
+            }
+            else {
+                entry += c;
+            }
+        }
+    }
+    SQLite::Statement& insert = db.statement("INSERT INTO replication_log (entry) VALUES (?)");
+    insert.bind(1, entry);
+    insert.exec();
+    insert.tryReset();
+}
+
+/**
+ * @brief Запись изменения в очередь репликации на отдельном соединении
+ * 
+ * Для изменений вне транзакции; нельзя вызывать, пока поток держит соединение для записи.
+ * 
+ * @param fields Операция и её аргументы
+ */
+void replicate(const std::vector<std::string>& fields) {
+    if (!is_replication_leader()) {
+        return;
+    }
+    try {
+        auto db = getDbPool().writer();
+        replicate(*db, fields);
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error queueing replication entry: " + std::string(e.what()));
+    }
+}
+
+/**
+ * @brief Получение общего индекса токенов
+ * 
+ * @return TokenIndex& Индекс токенов процесса
+ */
+TokenIndex& getTokenIndex() {
+    static TokenIndex index;
+    return index;
+}
+
+/**
+ * @brief Добавление столбца в существующую таблицу
+ * 
+ * Нужно для баз, созданных до появления столбца: CREATE TABLE IF NOT EXISTS их не меняет.
+ * 
+ * @param database База данных
+ * @param table Таблица
+ * @param column Имя столбца
+ * @param definition Тип и ограничения столбца
+ */
+void ensure_column(SQLite::Database& database, const std::string& table, const std::string& column, const std::string& definition) {
+    SQLite::Statement info(database, "PRAGMA table_info(" + table + ")");
+    while (info.executeStep()) {
+        if (info.getColumn(1).getText() == column) {
+            return;
+        }
+    }
+    database.exec("ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition + ";");
+}
+
+/**
+ * @brief Инициализация базы данных
+ */
+void initDatabase() {
+    try {
+        auto db = getDbPool().writer();
+        db->database().exec("CREATE TABLE IF NOT EXISTS users (id INTEGER PRIMARY KEY, token TEXT);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS blobs (hash TEXT PRIMARY KEY, size INTEGER NOT NULL, refcount INTEGER NOT NULL DEFAULT 0);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS file_refs (path TEXT PRIMARY KEY, hash TEXT NOT NULL);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS upload_sessions (id TEXT PRIMARY KEY, token TEXT NOT NULL, filename TEXT NOT NULL, size INTEGER NOT NULL, created INTEGER NOT NULL, finalizing INTEGER NOT NULL DEFAULT 0);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS folder_usage (folder TEXT PRIMARY KEY, bytes INTEGER NOT NULL DEFAULT 0, quota INTEGER, reserved INTEGER NOT NULL DEFAULT 0, writes INTEGER NOT NULL DEFAULT 0);");
+        ensure_column(db->database(), "folder_usage", "reserved", "INTEGER NOT NULL DEFAULT 0");
+        ensure_column(db->database(), "folder_usage", "writes", "INTEGER NOT NULL DEFAULT 0");
+        // Резервы загрузок, прерванных остановкой сервера, больше не действуют
+        db->database().exec("UPDATE folder_usage SET reserved = 0 WHERE reserved != 0;");
+        db->database().exec("CREATE TABLE IF NOT EXISTS shares (token TEXT PRIMARY KEY, created INTEGER NOT NULL, expires INTEGER NOT NULL, max_downloads INTEGER NOT NULL DEFAULT 0, downloads INTEGER NOT NULL DEFAULT 0);");
+        ensure_column(db->database(), "shares", "served_bytes", "INTEGER NOT NULL DEFAULT 0");
+        db->database().exec("CREATE INDEX IF NOT EXISTS shares_expires ON shares (expires);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS upload_chunks (session_id TEXT NOT NULL, offset INTEGER NOT NULL, length INTEGER NOT NULL, PRIMARY KEY (session_id, offset));");
+        db->database().exec("CREATE TABLE IF NOT EXISTS replication_log (seq INTEGER PRIMARY KEY AUTOINCREMENT, entry TEXT NOT NULL);");
+        db->database().exec("CREATE TABLE IF NOT EXISTS replication_state (key TEXT PRIMARY KEY, value INTEGER NOT NULL);");
+        logMessage("Database initialized successfully.");
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error initializing database: " + std::string(e.what()));
+    }
+}
+
+/**
+ * @brief Добавление пользователя в базу данных
+ * 
+ * @param userId Идентификатор пользователя
+ */
+void addUserToDatabase(int64_t userId) {
+    static LatencyHistogram& latency = db_query_histogram("addUserToDatabase");
+    ScopedTimer timer(latency);
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& query = db->statement("INSERT OR IGNORE INTO users (id, token) VALUES (?, ?)");
+        query.bind(1, userId);
+        query.bind(2, nullptr);
+        query.exec();
+        logMessage("User added to database successfully. UserID: " + std::to_string(userId));
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error adding user to database: " + std::string(e.what()));
+    }
+}
+
+const std::string TOKEN_ALPHABET = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+/**
+ * @brief Заполнение буфера случайными символами алфавита
+ * 
+ * Случайные байты берутся из CSPRNG OpenSSL (RAND_bytes, засевается из
+ * getrandom) блоками в буфер потока, поэтому один вызов RAND_bytes обслуживает
+ * много токенов. Символы выбираются отбрасыванием байтов выше кратного
+ * размеру алфавита порога, так что распределение равномерное.
+ * 
+ * @param out Буфер для токена
+ * @param length Длина токена
+ * @param alphabet Алфавит (от 1 до 256 символов)
+ */
+void fill_random_token(char* out, size_t length, const std::string& alphabet) {
+    struct RandomPool {
+        std::array<unsigned char, 4096> bytes;
+        size_t position = 4096;
+    };
+    thread_local RandomPool pool;
+
+    const size_t alphabet_size = alphabet.size();
+    const size_t limit = 256 - 256 % alphabet_size;
+    size_t filled = 0;
+    while (filled < length) {
+        if (pool.position == pool.bytes.size()) {
+            if (RAND_bytes(pool.bytes.data(), static_cast<int>(pool.bytes.size())) != 1) {
+                throw std::runtime_error("RAND_bytes failed");
+            }
+            pool.position = 0;
+        }
+        unsigned char byte = pool.bytes[pool.position++];
+        if (byte < limit) {
+            out[filled++] = alphabet[byte % alphabet_size];
+        }
+    }
+}
+
+/**
+ * @brief Генерация случайного токена заданной длины
+ * 
+ * @param length Длина токена
+ * @param alphabet Алфавит
+ * @return std::string Токен
+ */
+std::string random_token(size_t length, const std::string& alphabet) {
+    std::string token(length, '\0');
+    fill_random_token(&token[0], length, alphabet);
+    return token;
+}
+
+/**
+ * @brief Генерация токена, которого ещё нет в индексе токенов
+ * 
+ * @param kind Вид токена
+ * @param length Длина токена
+ * @return std::string Уникальный токен
+ */
+std::string generate_unique_token(TokenKind kind, size_t length) {
+    std::string token = random_token(length);
+    while (getTokenIndex().contains(kind, token)) {
+        token = random_token(length);
+    }
+    return token;
+}
+
+/**
+ * @brief Генерация токена
+ * 
+ * @return std::string Сгенерированный токен
+ */
+std::string generateToken() {
+    std::string token = generate_unique_token(TokenKind::User, USER_TOKEN_LENGTH);
+    logMessage("Generated token: " + token);
+    return token;
+}
+
+/**
+ * @brief Обновление токена пользователя
+ * 
+ * @param userId Идентификатор пользователя
+ * @param token Новый токен пользователя
+ */
+void updateUserToken(int64_t userId, const std::string& token) {
+    static LatencyHistogram& latency = db_query_histogram("updateUserToken");
+    ScopedTimer timer(latency);
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& query = db->statement("UPDATE users SET token = ? WHERE id = ?");
+        query.bind(1, token);
+        query.bind(2, userId);
+        query.exec();
+        replicate(*db, { "user", std::to_string(userId), token });
+        getTokenIndex().add(TokenKind::User, token);
+        logMessage("User token updated successfully. UserID: " + std::to_string(userId));
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error updating user token: " + std::string(e.what()));
+    }
+}
+
+/**
+ * @brief Получение токена пользователя
+ * 
+ * @param userId Идентификатор пользователя
+ * @return std::string Токен пользователя
+ */
+std::string getUserToken(int64_t userId) {
+    static LatencyHistogram& latency = db_query_histogram("getUserToken");
+    ScopedTimer timer(latency);
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT token FROM users WHERE id = ?");
+        query.bind(1, userId);
+
+        if (query.executeStep()) {
+            std::string token = query.getColumn(0).getText();
+            logMessage("Token retrieved for user. UserID: " + std::to_string(userId) + ", Token: " + token);
+            return token;
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error getting user token: " + std::string(e.what()));
+    }
+    return "";
+}
+
+/**
+ * @brief Корневая папка токенов заданного вида
+ * 
+ * @param kind Вид токена
+ * @return std::string BASE_PATH/files или BASE_PATH/hidefiles
+ */
+std::string token_root(TokenKind kind) {
+    return BASE_PATH + (kind == TokenKind::User ? "/files" : "/hidefiles");
+}
+
+/**
+ * @brief Промежуточные папки шардирования для токена
+ * 
+ * При глубине 2 токен "abcdef" даёт "ab/cd/". Короткие токены дополняются
+ * символом '_', чтобы у каждого токена было ровно depth уровней.
+ * 
+ * @param token Токен
+ * @param depth Глубина шардирования
+ * @return std::string Префикс пути с завершающим '/', пустой при depth == 0
+ */
+std::string shard_prefix(const std::string& token, size_t depth) {
+    std::string prefix;
+    for (size_t level = 0; level < depth; ++level) {
+        for (size_t i = 0; i < SHARD_WIDTH; ++i) {
+            size_t pos = level * SHARD_WIDTH + i;
+            prefix += pos < token.size() ? token[pos] : '_';
+        }
+        prefix += '/';
+    }
+    return prefix;
+}
+
+/**
+ * @brief Папка токена на диске
+ * 
+ * Единственное место, где токен превращается в путь: все маршруты, учёт места
+ * и сборщик ссылок получают папку отсюда. Глубина берётся из shard_depth.
+ * 
+ * @param kind Вид токена
+ * @param token Токен
+ * @return std::string Полный путь к папке токена
+ */
+std::string token_folder(TokenKind kind, const std::string& token) {
+    return token_root(kind) + "/" + shard_prefix(token, getServerConfig().shard_depth) + token;
+}
+
+/**
+ * @brief Обход папок токенов с учётом шардирования
+ * 
+ * @param kind Вид токена
+ * @param depth Глубина шардирования, с которой записано дерево
+ * @param visit Вызывается для каждой папки токена: visit(token, path)
+ */
+void for_each_token_folder(TokenKind kind, size_t depth,
+                           const std::function<void(const std::string&, const fs::path&)>& visit) {
+    std::function<void(const fs::path&, size_t)> walk = [&](const fs::path& dir, size_t level) {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            if (!entry.is_directory(ec)) {
+                continue;
+            }
+            if (level < depth) {
+                walk(entry.path(), level + 1);
+            }
+            else {
+                visit(entry.path().filename().string(), entry.path());
+            }
+        }
+    };
+    walk(token_root(kind), 0);
+}
+
+/**
+ * @brief Заполнение индекса токенов
+ * 
+ * Токены пользователей берутся из таблицы users и папок files/, токены отправки —
+ * из папок hidefiles/. Вызывается один раз при запуске до старта сервера.
+ */
+void loadTokenIndex() {
+    TokenIndex& index = getTokenIndex();
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT token FROM users WHERE token IS NOT NULL");
+        while (query.executeStep()) {
+            index.add(TokenKind::User, query.getColumn(0).getText());
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error loading tokens from database: " + std::string(e.what()));
+    }
+
+    for (TokenKind kind : { TokenKind::User, TokenKind::Send }) {
+        for_each_token_folder(kind, getServerConfig().shard_depth, [&](const std::string& token, const fs::path&) {
+            index.add(kind, token);
+        });
+    }
+
+    logMessage(LogLevel::Info, "Token index loaded", {
+        {"user_tokens", std::to_string(index.size(TokenKind::User))},
+        {"send_tokens", std::to_string(index.size(TokenKind::Send))}
+    });
+}
+
+/**
+ * @brief Создание папки для пользователя
+ * 
+ * @param token Токен пользователя
+ */
+void createFolderForUser(const std::string& token) {
+    try {
+        std::string path = token_folder(TokenKind::User, token);
+        fs::create_directories(path);
+        getTokenIndex().add(TokenKind::User, token);
+        replicate({ "folder", token });
+        logMessage("Folder created for user with token: " + token);
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error creating folder for user: " + std::string(e.what()));
+    }
+}
+
+/**
+ * @brief Перевод времени изменения файла в std::time_t
+ * 
+ * @param time Время из std::filesystem
+ * @return std::time_t Время в секундах с начала эпохи
+ */
+std::time_t to_time_t(fs::file_time_type time) {
+    return std::chrono::system_clock::to_time_t(
+        std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+            time - fs::file_time_type::clock::now() + std::chrono::system_clock::now()));
+}
+
+/**
+ * @brief Определение MIME-типа по расширению файла
+ * 
+ * @param filename Имя файла
+ * @return std::string MIME-тип, по умолчанию application/octet-stream
+ */
+std::string content_type_for(const std::string& filename) {
+    static const std::unordered_map<std::string, std::string> TYPES = {
+        { "txt", "text/plain" }, { "html", "text/html" }, { "htm", "text/html" },
+        { "css", "text/css" }, { "csv", "text/csv" }, { "md", "text/markdown" },
+        { "js", "application/javascript" }, { "json", "application/json" }, { "xml", "application/xml" },
+        { "pdf", "application/pdf" }, { "zip", "application/zip" }, { "gz", "application/gzip" },
+        { "png", "image/png" }, { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" },
+        { "gif", "image/gif" }, { "svg", "image/svg+xml" }, { "webp", "image/webp" },
+        { "mp3", "audio/mpeg" }, { "mp4", "video/mp4" }
+    };
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos) {
+        return "application/octet-stream";
+    }
+    std::string extension = filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    auto it = TYPES.find(extension);
+    return it != TYPES.end() ? it->second : "application/octet-stream";
+}
+
+/**
+ * @brief Получение общего кэша папок
+ * 
+ * @return FolderCache& Кэш папок процесса
+ */
+FolderCache& getFolderCache() {
+    static FolderCache cache;
+    return cache;
+}
+
+/**
+ * @brief Получение списка файлов в папке
+ * 
+ * Список отдаётся из FolderCache. Отсутствующая папка (токен выдан, но ещё
+ * ничего не загружено) даёт пустой список.
+ * 
+ * @param folder_path Путь к папке
+ * @return FileList Список файлов
+ */
+FileList get_files(const std::string& folder_path) {
+    FileList file_list = getFolderCache().list(folder_path);
+    logMessage(LogLevel::Debug, "Files retrieved from folder", { {"folder", folder_path} });
+    return file_list;
+}
+
+/**
+ * @brief Проверка валидности токена
+ * 
+ * Проверка выполняется по индексу токенов в памяти, без обращения к диску.
+ * 
+ * @param token Токен пользователя
+ * @return true Токен валиден
+ * @return false Токен не валиден
+ */
+bool validate_token(const std::string& token) {
+    bool isValid = getTokenIndex().contains(TokenKind::User, token);
+    logMessage(LogLevel::Debug, "Token validation", { {"token", token}, {"valid", isValid ? "true" : "false"} });
+    return isValid;
+}
+
+/**
+ * @brief Дописывание строки с экранированием спецсимволов HTML
+ * 
+ * @param out Буфер
+ * @param value Исходная строка
+ */
+void append_html_escaped(std::string& out, const std::string& value) {
+    for (char c : value) {
+        switch (c) {
+        case '&': out += "&amp;"; break;
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '"': out += "&quot;"; break;
+        case '\'': out += "&#39;"; break;
+        default: out += c;
+        }
+    }
+}
+
+/**
+ * @brief Дописывание строки в виде сегмента URL (percent-encoding)
+ * 
+ * @param out Буфер
+ * @param value Исходная строка
+ */
+void append_url_encoded(std::string& out, const std::string& value) {
+    static const char HEX[] = "0123456789ABCDEF";
+    for (unsigned char c : value) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += static_cast<char>(c);
+        }
+        else {
+            out += '%';
+            out += HEX[c >> 4];
+            out += HEX[c & 0x0F];
+        }
+    }
+}
+
+/**
+ * @brief Генерация HTML списка файлов
+ * 
+ * @param files Список файлов
+ * @param link_prefix Начало ссылки на файл, например "/download/<токен>/"
+ * @param out Буфер, в который дописываются элементы списка
+ */
+void generate_file_list_html(const std::vector<FileEntry>& files, const std::string& link_prefix, std::string& out) {
+    for (const auto& file : files) {
+        out += "<li><a href=\"";
+        out += link_prefix;
+        append_url_encoded(out, file.name);
+        out += "\">";
+        append_html_escaped(out, file.name);
+        out += "</a></li>\n";
+    }
+}
+
+/**
+ * @brief Генерация токена для отправки файла
+ * 
+ * @param length Длина токена
+ * @return std::string Сгенерированный токен
+ */
+std::string generate_send_token(size_t length) {
+    return random_token(length);
+}
+
+/**
+ * @brief Экранирование строки для вставки в JSON
+ * 
+ * @param value Исходная строка
+ * @return std::string Строка без кавычек по краям
+ */
+std::string json_escape(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+        case '"': escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                escaped += buffer;
+            }
+            else {
+                escaped += c;
+            }
+        }
+    }
+    return escaped;
+}
+
+/**
+ * @brief Очистка имени загружаемого файла
+ * 
+ * Отбрасывает компоненты пути, чтобы файл нельзя было записать за пределы папки токена.
+ * 
+ * @param filename Имя файла из multipart-запроса
+ * @return std::string Безопасное имя файла или пустая строка
+ */
+std::string sanitize_filename(const std::string& filename) {
+    std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+    if (name == "." || name == "..") {
+        return "";
+    }
+    return name;
+}
+
+/**
+ * @brief Путь к блобу в хранилище по его хешу
+ * 
+ * @param hash SHA-256 содержимого
+ * @return std::string Путь вида blobs/ab/abcdef...
+ */
+std::string blob_path_for(const std::string& hash) {
+    return BLOB_PATH + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+/**
+ * @brief Путь файла относительно BASE_PATH для таблицы file_refs
+ */
+std::string relative_to_base(const std::string& path) {
+    return path.compare(0, BASE_PATH.size() + 1, BASE_PATH + "/") == 0 ? path.substr(BASE_PATH.size() + 1) : path;
+}
+
+/**
+ * @brief Кодирования, которые поддерживает сборка, в порядке предпочтения
+ */
+std::vector<ContentEncoding> supported_encodings() {
+#ifdef HAVE_ZSTD
+    return { ContentEncoding::Zstd, ContentEncoding::Gzip };
+#else
+    return { ContentEncoding::Gzip };
+#endif
+}
+
+/**
+ * @brief Имя кодирования для заголовка Content-Encoding
+ */
+const char* encoding_name(ContentEncoding encoding) {
+    switch (encoding) {
+    case ContentEncoding::Gzip: return "gzip";
+    case ContentEncoding::Zstd: return "zstd";
+    default: return "identity";
+    }
+}
+
+/**
+ * @brief Расширение файла предварительно сжатой копии
+ */
+const char* encoding_suffix(ContentEncoding encoding) {
+    switch (encoding) {
+    case ContentEncoding::Gzip: return ".gz";
+    case ContentEncoding::Zstd: return ".zst";
+    default: return "";
+    }
+}
+
+/**
+ * @brief Выбор кодирования по заголовку Accept-Encoding
+ * 
+ * Учитываются q-значения; из допустимых клиентом кодирований выбирается
+ * первое по порядку supported_encodings().
+ * 
+ * @param req HTTP запрос
+ * @return ContentEncoding Выбранное кодирование или Identity
+ */
+ContentEncoding negotiate_encoding(const httplib::Request& req) {
+    std::string header = req.get_header_value("Accept-Encoding");
+    std::unordered_map<std::string, double> accepted;
+    std::stringstream ss(header);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::string name = item.substr(0, item.find(';'));
+        name.erase(std::remove_if(name.begin(), name.end(), [](unsigned char c) { return std::isspace(c); }), name.end());
+        std::transform(name.begin(), name.end(), name.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        double q = 1;
+        size_t q_pos = item.find("q=");
+        if (q_pos != std::string::npos) {
+            try {
+                q = std::stod(item.substr(q_pos + 2));
+            }
+            catch (const std::exception&) {
+                q = 0;
+            }
+        }
+        if (!name.empty()) {
+            accepted[name] = q;
+        }
+    }
+
+    for (ContentEncoding encoding : supported_encodings()) {
+        auto it = accepted.find(encoding_name(encoding));
+        if (it == accepted.end()) {
+            it = accepted.find("*");
+        }
+        if (it != accepted.end() && it->second > 0) {
+            return encoding;
+        }
+    }
+    return ContentEncoding::Identity;
+}
+
+/**
+ * @brief Проверка, имеет ли смысл сжимать содержимое данного типа
+ * 
+ * @param content_type MIME-тип
+ * @return true Текстовые форматы, JSON, JavaScript, XML и SVG
+ */
+bool is_compressible(const std::string& content_type) {
+    return content_type.compare(0, 5, "text/") == 0 ||
+           content_type == "application/json" ||
+           content_type == "application/javascript" ||
+           content_type == "application/xml" ||
+           content_type == "image/svg+xml";
+}
+
+/**
+ * @brief Установка тела ответа со сжатием по Accept-Encoding
+ * 
+ * Небольшие ответы и несжимаемые типы отдаются как есть.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param body Тело ответа
+ * @param content_type MIME-тип
+ */
+void set_compressed_content(const httplib::Request& req, httplib::Response& res, const std::string& body, const std::string& content_type) {
+    res.set_header("Vary", "Accept-Encoding");
+    ContentEncoding encoding = negotiate_encoding(req);
+    if (encoding != ContentEncoding::Identity && body.size() >= COMPRESS_MIN_SIZE && is_compressible(content_type)) {
+        StreamCompressor compressor(encoding, COMPRESS_STREAM_LEVEL);
+        std::string compressed;
+        if (compressor.is_valid() && compressor.compress(body.data(), body.size(), true, compressed)) {
+            res.set_header("Content-Encoding", encoding_name(encoding));
+            res.set_content(compressed, content_type);
+            return;
+        }
+    }
+    res.set_content(body, content_type);
+}
+
+/**
+ * @brief Путь к предварительно сжатой копии блоба
+ * 
+ * @param hash SHA-256 содержимого
+ * @param encoding Кодирование
+ * @return std::string Путь вида blobs/ab/abcdef....gz
+ */
+std::string sidecar_path_for(const std::string& hash, ContentEncoding encoding) {
+    return blob_path_for(hash) + encoding_suffix(encoding);
+}
+
+/**
+ * @brief Фоновое создание сжатых копий блоба
+ * 
+ * Копии создаются в CpuPool один раз на блоб (общие для всех ссылок на него)
+ * и сохраняются, только если сжатие экономит не меньше 10%.
+ * 
+ * @param hash SHA-256 содержимого
+ * @param content_type MIME-тип файла
+ * @param size Размер содержимого
+ */
+void schedule_precompression(const std::string& hash, const std::string& content_type, uint64_t size) {
+    if (size < COMPRESS_MIN_SIZE || !is_compressible(content_type)) {
+        return;
+    }
+    getCpuPool().submit([hash, size] {
+        for (ContentEncoding encoding : supported_encodings()) {
+            std::string sidecar = sidecar_path_for(hash, encoding);
+            std::error_code ec;
+            if (fs::exists(sidecar, ec)) {
+                continue;
+            }
+            std::string temp_path = sidecar + "." + generate_send_token(8) + ".tmp";
+            bool worthwhile = false;
+            {
+                std::ifstream ifs(blob_path_for(hash), std::ios::binary);
+                std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+                StreamCompressor compressor(encoding, COMPRESS_SIDECAR_LEVEL);
+                std::vector<char> buffer(COMPRESS_READ_SIZE);
+                std::string out;
+                uint64_t written = 0;
+                bool ok = ifs && ofs && compressor.is_valid();
+                while (ok) {
+                    ifs.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                    bool finish = ifs.eof();
+                    ok = (ifs || finish) && compressor.compress(buffer.data(), static_cast<size_t>(ifs.gcount()), finish, out);
+                    ofs.write(out.data(), static_cast<std::streamsize>(out.size()));
+                    written += out.size();
+                    out.clear();
+                    if (finish) {
+                        break;
+                    }
+                }
+                worthwhile = ok && ofs.good() && written * 10 <= size * 9;
+            }
+            if (worthwhile) {
+                fs::rename(temp_path, sidecar, ec);
+            }
+            else {
+                fs::remove(temp_path, ec);
+            }
+            logMessage(LogLevel::Debug, "Blob precompressed", {
+                {"hash", hash}, {"encoding", encoding_name(encoding)}, {"kept", worthwhile ? "true" : "false"}
+            });
+        }
+    });
+}
+
+/**
+ * @brief Поиск хеша блоба, на который ссылается файл
+ * 
+ * @param file_path Путь к файлу в папке токена
+ * @return std::string SHA-256 или пустая строка, если файл не в хранилище блобов
+ */
+std::string blob_hash_for(const std::string& file_path) {
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT hash FROM file_refs WHERE path = ?");
+        query.bind(1, relative_to_base(file_path));
+        std::string hash;
+        if (query.executeStep()) {
+            hash = query.getColumn(0).getText();
+        }
+        query.tryReset();
+        return hash;
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error looking up blob: " + std::string(e.what()));
+        return "";
+    }
+}
+
+/**
+ * @brief Удаление блобов без ссылок
+ */
+void collectGarbageBlobs() {
+    try {
+        auto db = getDbPool().writer();
+        std::vector<std::string> hashes;
+        SQLite::Statement& select = db->statement("SELECT hash FROM blobs WHERE refcount <= 0");
+        while (select.executeStep()) {
+            hashes.push_back(select.getColumn(0).getText());
+        }
+        select.tryReset();
+
+        SQLite::Statement& remove = db->statement("DELETE FROM blobs WHERE hash = ? AND refcount <= 0");
+        for (const auto& hash : hashes) {
+            std::error_code ec;
+            fs::remove(blob_path_for(hash), ec);
+            for (ContentEncoding encoding : { ContentEncoding::Gzip, ContentEncoding::Zstd }) {
+                fs::remove(sidecar_path_for(hash, encoding), ec);
+            }
+            fs::remove(signature_path_for(hash), ec);
+            remove.bind(1, hash);
+            remove.exec();
+            remove.tryReset();
+        }
+        if (!hashes.empty()) {
+            logMessage(LogLevel::Info, "Unreferenced blobs removed", { {"count", std::to_string(hashes.size())} });
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error collecting blobs: " + std::string(e.what()));
+    }
+}
+
+/**
+ * @brief Сохранение загруженного файла в хранилище блобов с дедупликацией
+ * 
+ * Если блоб с таким хешем уже есть, временный файл удаляется и содержимое
+ * больше не пишется на диск. Иначе временный файл переименовывается в блоб
+ * и для сжимаемых типов в фоне создаются его сжатые копии. В папку токена помещается жёсткая ссылка на блоб, а ссылка и счётчик ссылок
+ * фиксируются в таблицах file_refs и blobs. Блоб, на который больше нет ссылок
+ * (файл перезаписан), удаляется сборщиком мусора.
+ * 
+ * Итоговый файл подменяется последним шагом перед фиксацией транзакции. При
+ * ошибке транзакция откатывается, а файловая система возвращается в исходное
+ * состояние: блоб переносится обратно во временный файл, прежний итоговый файл
+ * восстанавливается из жёсткой ссылки-копии.
+ * 
+ * @param temp_path Временный файл с полным содержимым
+ * @param final_path Итоговый путь в папке токена
+ * @param hash SHA-256 содержимого
+ * @param size Размер содержимого
+ * @return true Файл сохранён
+ * @return false Ошибка, временный и итоговый файлы не тронуты
+ */
+bool store_blob_reference(const std::string& temp_path, const std::string& final_path, const std::string& hash, uint64_t size) {
+    std::string blob_path = blob_path_for(hash);
+    std::string ref_path = relative_to_base(final_path);
+    std::string link_path = temp_path + ".link";
+    std::string backup_path = temp_path + ".prev";
+    bool released = false;
+    bool deduplicated = false;
+    bool moved = false;
+    bool backed_up = false;
+    bool published = false;
+
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+
+        SQLite::Statement& find = db->statement("SELECT 1 FROM blobs WHERE hash = ?");
+        find.bind(1, hash);
+        deduplicated = find.executeStep() && fs::exists(blob_path);
+        find.tryReset();
+
+        if (!deduplicated) {
+            SQLite::Statement& insert = db->statement("INSERT OR REPLACE INTO blobs (hash, size, refcount) VALUES (?, ?, COALESCE((SELECT refcount FROM blobs WHERE hash = ?), 0))");
+            insert.bind(1, hash);
+            insert.bind(2, static_cast<int64_t>(size));
+            insert.bind(3, hash);
+            insert.exec();
+        }
+
+        SQLite::Statement& previous = db->statement("SELECT hash FROM file_refs WHERE path = ?");
+        previous.bind(1, ref_path);
+        if (previous.executeStep()) {
+            std::string previous_hash = previous.getColumn(0).getText();
+            previous.tryReset();
+            SQLite::Statement& release = db->statement("UPDATE blobs SET refcount = refcount - 1 WHERE hash = ?");
+            release.bind(1, previous_hash);
+            release.exec();
+            released = true;
+        }
+        previous.tryReset();
+
+        SQLite::Statement& reference = db->statement("INSERT OR REPLACE INTO file_refs (path, hash) VALUES (?, ?)");
+        reference.bind(1, ref_path);
+        reference.bind(2, hash);
+        reference.exec();
+
+        SQLite::Statement& acquire = db->statement("UPDATE blobs SET refcount = refcount + 1 WHERE hash = ?");
+        acquire.bind(1, hash);
+        acquire.exec();
+
+        // Ведомому передаётся токен и имя, а не путь: глубина шардирования у узлов может различаться
+        fs::path ref(ref_path);
+        std::string root = ref.begin() != ref.end() ? ref.begin()->string() : std::string();
+        if (root == "files" || root == "hidefiles") {
+            replicate(*db, { "file", root == "files" ? "user" : "send", ref.parent_path().filename().string(),
+                             ref.filename().string(), hash, std::to_string(size) });
+        }
+
+        // Файловые операции идут после всех запросов, каждая с возможностью отката
+        if (!deduplicated) {
+            fs::create_directories(fs::path(blob_path).parent_path());
+            fs::rename(temp_path, blob_path);
+            moved = true;
+        }
+        fs::create_hard_link(blob_path, link_path);
+        if (fs::exists(final_path)) {
+            fs::create_hard_link(final_path, backup_path);
+            backed_up = true;
+        }
+        fs::rename(link_path, final_path);
+        published = true;
+
+        transaction.commit();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error storing blob: " + std::string(e.what()), { {"hash", hash} });
+        std::error_code ec;
+        fs::remove(link_path, ec);
+        if (published) {
+            if (backed_up) {
+                fs::rename(backup_path, final_path, ec);
+            }
+            else {
+                fs::remove(final_path, ec);
+            }
+        }
+        else if (backed_up) {
+            fs::remove(backup_path, ec);
+        }
+        if (moved) {
+            fs::rename(blob_path, temp_path, ec);
+        }
+        return false;
+    }
+
+    std::error_code ec;
+    if (backed_up) {
+        fs::remove(backup_path, ec);
+    }
+    if (deduplicated) {
+        fs::remove(temp_path, ec);
+    }
+    logMessage(LogLevel::Debug, "Blob stored", { {"hash", hash}, {"path", ref_path}, {"deduplicated", deduplicated ? "true" : "false"} });
+    schedule_precompression(hash, content_type_for(final_path), size);
+    if (released) {
+        collectGarbageBlobs();
+    }
+    return true;
+}
+
+/**
+ * @brief Сохранение файла в обход хранилища блобов
+ * 
+ * Запасной путь, если store_blob_reference не удалось: временный файл просто
+ * переименовывается в итоговый, а прежняя запись file_refs для этого пути
+ * удаляется, чтобы blob_hash_for не вернул хеш старого содержимого.
+ * 
+ * @param temp_path Временный файл с полным содержимым
+ * @param final_path Итоговый путь в папке токена
+ * @return true Файл сохранён
+ * @return false Переименование не удалось
+ */
+bool store_plain_file(const std::string& temp_path, const std::string& final_path) {
+    std::error_code ec;
+    fs::rename(temp_path, final_path, ec);
+    if (ec) {
+        logMessage(LogLevel::Error, "Error storing file: " + ec.message(), { {"path", final_path} });
+        return false;
+    }
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+        SQLite::Statement& previous = db->statement("SELECT hash FROM file_refs WHERE path = ?");
+        previous.bind(1, relative_to_base(final_path));
+        if (previous.executeStep()) {
+            std::string previous_hash = previous.getColumn(0).getText();
+            previous.tryReset();
+            SQLite::Statement& release = db->statement("UPDATE blobs SET refcount = refcount - 1 WHERE hash = ?");
+            release.bind(1, previous_hash);
+            release.exec();
+            SQLite::Statement& drop = db->statement("DELETE FROM file_refs WHERE path = ?");
+            drop.bind(1, relative_to_base(final_path));
+            drop.exec();
+        }
+        previous.tryReset();
+        transaction.commit();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error releasing blob reference: " + std::string(e.what()), { {"path", final_path} });
+    }
+    return true;
+}
+
+/**
+ * @brief Ключ учёта занятого места для папки
+ * 
+ * @param dir_path Папка токена
+ * @return std::string Путь относительно BASE_PATH, например files/<токен>
+ */
+std::string usage_key_for(const std::string& dir_path) {
+    return relative_to_base(dir_path);
+}
+
+/**
+ * @brief Изменение учтённого размера папки
+ * 
+ * Счётчик writes увеличивается при каждом изменении, по нему reconcileUsage
+ * узнаёт папки, в которые писали во время пересчёта.
+ * 
+ * @param folder Ключ папки (usage_key_for)
+ * @param delta Изменение в байтах, может быть отрицательным
+ */
+void add_folder_usage(const std::string& folder, int64_t delta) {
+    if (delta == 0) {
+        return;
+    }
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& query = db->statement(
+            "INSERT INTO folder_usage (folder, bytes, writes) VALUES (?1, MAX(?2, 0), 1) "
+            "ON CONFLICT(folder) DO UPDATE SET bytes = MAX(bytes + ?2, 0), writes = writes + 1");
+        query.bind(1, folder);
+        query.bind(2, delta);
+        query.exec();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error updating folder usage: " + std::string(e.what()), { {"folder", folder} });
+    }
+}
+
+/**
+ * @brief Учёт замены файла в папке токена
+ * 
+ * @param file_path Путь к файлу
+ * @param previous_size Размер файла до замены (0, если файла не было)
+ * @param size Новый размер
+ */
+void record_file_usage(const std::string& file_path, uint64_t previous_size, uint64_t size) {
+    add_folder_usage(usage_key_for(fs::path(file_path).parent_path().string()),
+                     static_cast<int64_t>(size) - static_cast<int64_t>(previous_size));
+}
+
+/**
+ * @brief Размер существующего файла
+ * 
+ * @param path Путь
+ * @return uint64_t Размер или 0, если файла нет
+ */
+uint64_t existing_file_size(const std::string& path) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+/**
+ * @brief Свободное место в пределах квоты папки
+ * 
+ * Квота берётся из folder_usage.quota, а если она не задана — из настройки
+ * user_quota для папок files/ (папки hidefiles/ ограничены только
+ * max_upload_size). Места, зарезервированные идущими загрузками, и сессии
+ * загрузки по частям в этот токен (до удаления после завершения) считаются
+ * уже занятыми.
+ * 
+ * @param db Соединение; чтобы проверка и резервирование были атомарны, нужно соединение записи
+ * @param dir_path Папка токена
+ * @return uint64_t Доступно байт, UINT64_MAX — без ограничения
+ */
+uint64_t quota_remaining(DbConnection& db, const std::string& dir_path) {
+    std::string folder = usage_key_for(dir_path);
+    bool user_folder = folder.compare(0, 6, "files/") == 0;
+    uint64_t quota = user_folder ? getServerConfig().user_quota : 0;
+    uint64_t used = 0;
+    try {
+        SQLite::Statement& usage = db.statement("SELECT bytes, quota, reserved FROM folder_usage WHERE folder = ?");
+        usage.bind(1, folder);
+        if (usage.executeStep()) {
+            used = static_cast<uint64_t>(usage.getColumn(0).getInt64()) + static_cast<uint64_t>(usage.getColumn(2).getInt64());
+            if (!usage.getColumn(1).isNull()) {
+                quota = static_cast<uint64_t>(usage.getColumn(1).getInt64());
+            }
+        }
+        usage.tryReset();
+
+        if (quota != 0 && user_folder) {
+            SQLite::Statement& sessions = db.statement("SELECT COALESCE(SUM(size), 0) FROM upload_sessions WHERE token = ?");
+            sessions.bind(1, fs::path(folder).filename().string());
+            if (sessions.executeStep()) {
+                used += static_cast<uint64_t>(sessions.getColumn(0).getInt64());
+            }
+            sessions.tryReset();
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error reading folder usage: " + std::string(e.what()), { {"folder", folder} });
+    }
+    if (quota == 0) {
+        return UINT64_MAX;
+    }
+    return used >= quota ? 0 : quota - used;
+}
+
+/**
+ * @brief Свободное место в пределах квоты папки (чтение без резервирования)
+ * 
+ * @param dir_path Папка токена
+ * @return uint64_t Доступно байт, UINT64_MAX — без ограничения
+ */
+uint64_t quota_remaining(const std::string& dir_path) {
+    try {
+        auto db = getDbPool().reader();
+        return quota_remaining(*db, dir_path);
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error reading folder usage: " + std::string(e.what()), { {"folder", dir_path} });
+        return 0;
+    }
+}
+
+/**
+ * @brief Резервирование места в квоте папки под идущую загрузку
+ * 
+ * Проверка остатка и резервирование выполняются на соединении записи, поэтому
+ * одновременные загрузки в один токен не могут вместе превысить квоту.
+ * 
+ * @param dir_path Папка токена
+ * @param bytes Сколько зарезервировать
+ * @return true Место зарезервировано
+ * @return false Не хватает квоты или ошибка базы данных
+ */
+bool reserve_folder_quota(const std::string& dir_path, uint64_t bytes) {
+    std::string folder = usage_key_for(dir_path);
+    try {
+        auto db = getDbPool().writer();
+        if (bytes > quota_remaining(*db, dir_path)) {
+            return false;
+        }
+        SQLite::Statement& reserve = db->statement(
+            "INSERT INTO folder_usage (folder, reserved, writes) VALUES (?1, ?2, 1) "
+            "ON CONFLICT(folder) DO UPDATE SET reserved = reserved + ?2, writes = writes + 1");
+        reserve.bind(1, folder);
+        reserve.bind(2, static_cast<int64_t>(bytes));
+        reserve.exec();
+        return true;
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error reserving folder quota: " + std::string(e.what()), { {"folder", folder} });
+        return false;
+    }
+}
+
+/**
+ * @brief Снятие резерва, сделанного reserve_folder_quota
+ * 
+ * @param dir_path Папка токена
+ * @param bytes Сколько освободить
+ */
+void release_folder_quota(const std::string& dir_path, uint64_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    std::string folder = usage_key_for(dir_path);
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& release = db->statement(
+            "UPDATE folder_usage SET reserved = MAX(reserved - ?2, 0), writes = writes + 1 WHERE folder = ?1");
+        release.bind(1, folder);
+        release.bind(2, static_cast<int64_t>(bytes));
+        release.exec();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error releasing folder quota: " + std::string(e.what()), { {"folder", folder} });
+    }
+}
+
+/**
+ * @brief Пересчёт занятого места по содержимому папок
+ * 
+ * Исправляет расхождения учёта (файлы, изменённые в обход сервера, сбои).
+ * Временные и скрытые файлы не учитываются. Папки, в которые писали во время
+ * обхода (изменился счётчик writes), в которых идёт загрузка (есть резерв) или
+ * завершается сессия загрузки по частям, не исправляются: результат обхода для
+ * них мог устареть, они будут проверены при следующем пересчёте.
+ */
+void reconcileUsage() {
+    struct Recorded {
+        uint64_t bytes;
+        int64_t writes;
+    };
+    std::unordered_map<std::string, Recorded> recorded;
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& select = db->statement("SELECT folder, bytes, writes FROM folder_usage");
+        while (select.executeStep()) {
+            recorded[select.getColumn(0).getText()] = {
+                static_cast<uint64_t>(select.getColumn(1).getInt64()), select.getColumn(2).getInt64()
+            };
+        }
+        select.tryReset();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error reconciling folder usage: " + std::string(e.what()));
+        return;
+    }
+
+    std::unordered_map<std::string, uint64_t> scanned;
+    for (TokenKind kind : { TokenKind::User, TokenKind::Send }) {
+        for_each_token_folder(kind, getServerConfig().shard_depth, [&](const std::string&, const fs::path& folder) {
+            std::error_code ec;
+            uint64_t total = 0;
+            for (const auto& entry : fs::recursive_directory_iterator(folder, ec)) {
+                if (entry.path().filename().string()[0] != '.' && entry.is_regular_file(ec)) {
+                    total += entry.file_size(ec);
+                }
+            }
+            scanned[usage_key_for(folder.string())] = total;
+        });
+    }
+    for (const auto& entry : recorded) {
+        scanned.emplace(entry.first, 0);
+    }
+
+    size_t corrected = 0;
+    size_t skipped = 0;
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+
+        std::unordered_set<std::string> finalizing;
+        SQLite::Statement& sessions = db->statement("SELECT DISTINCT token FROM upload_sessions WHERE finalizing = 1 AND token != ''");
+        while (sessions.executeStep()) {
+            finalizing.insert(usage_key_for(token_folder(TokenKind::User, sessions.getColumn(0).getText())));
+        }
+        sessions.tryReset();
+
+        SQLite::Statement& update = db->statement(
+            "UPDATE folder_usage SET bytes = ? WHERE folder = ? AND writes = ? AND reserved = 0");
+        SQLite::Statement& insert = db->statement(
+            "INSERT INTO folder_usage (folder, bytes) VALUES (?, ?) ON CONFLICT(folder) DO NOTHING");
+        for (const auto& entry : scanned) {
+            auto it = recorded.find(entry.first);
+            if (it != recorded.end() && it->second.bytes == entry.second) {
+                continue;
+            }
+            if (finalizing.count(entry.first)) {
+                ++skipped;
+                continue;
+            }
+            int changes;
+            if (it != recorded.end()) {
+                update.bind(1, static_cast<int64_t>(entry.second));
+                update.bind(2, entry.first);
+                update.bind(3, it->second.writes);
+                changes = update.exec();
+                update.tryReset();
+            }
+            else {
+                insert.bind(1, entry.first);
+                insert.bind(2, static_cast<int64_t>(entry.second));
+                changes = insert.exec();
+                insert.tryReset();
+            }
+            if (changes > 0) {
+                ++corrected;
+            }
+            else {
+                ++skipped;
+            }
+        }
+        transaction.commit();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error reconciling folder usage: " + std::string(e.what()));
+        return;
+    }
+    logMessage(corrected ? LogLevel::Info : LogLevel::Debug, "Folder usage reconciled", {
+        {"folders", std::to_string(scanned.size())}, {"corrected", std::to_string(corrected)}, {"skipped", std::to_string(skipped)}
+    });
+}
+
+/**
+ * @brief Запуск фонового пересчёта занятого места
+ * 
+ * Первый пересчёт выполняется сразу, затем раз в usage_scan_interval секунд.
+ */
+void startUsageReconciler() {
+    std::thread([] {
+        while (true) {
+            reconcileUsage();
+            std::this_thread::sleep_for(std::chrono::seconds(getServerConfig().usage_scan_interval));
+        }
+    }).detach();
+}
+
+/**
+ * @brief Ответ о превышении квоты
+ * 
+ * @param res HTTP ответ
+ */
+void reject_over_quota(httplib::Response& res) {
+    res.status = 413;
+    res.set_header("Connection", "close");
+    res.set_content("Storage quota exceeded.", "text/plain");
+}
+
+/**
+ * @brief Понижение приоритета текущего потока (CPU и ввод-вывод)
+ * 
+ * На Linux поток получает nice 19 и класс ввода-вывода idle, так что фоновая
+ * очистка диска не мешает обработке запросов. На других системах ничего не делает.
+ */
+void lower_thread_priority() {
+#ifdef __linux__
+    pid_t tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(tid), 19);
+    const int IOPRIO_WHO_PROCESS = 1;
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+/**
+ * @brief Получение общего сборщика ссылок
+ * 
+ * @return ShareReaper& Сборщик процесса
+ */
+ShareReaper& getShareReaper() {
+    static ShareReaper reaper;
+    return reaper;
+}
+
+/**
+ * @brief Регистрация анонимной ссылки со сроком жизни и лимитом скачиваний
+ * 
+ * @param token Токен ссылки
+ * @param ttl Срок жизни в секундах (0 — share_ttl из настроек, не больше share_max_ttl)
+ * @param max_downloads Лимит скачиваний (0 — без ограничения)
+ * @return std::time_t Время истечения
+ */
+std::time_t register_share(const std::string& token, uint64_t ttl, uint64_t max_downloads) {
+    const ServerConfig& config = getServerConfig();
+    if (ttl == 0) {
+        ttl = config.share_ttl;
+    }
+    ttl = std::min<uint64_t>(ttl, config.share_max_ttl);
+    std::time_t now = std::time(nullptr);
+    std::time_t expires = now + static_cast<std::time_t>(ttl);
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& query = db->statement(
+            "INSERT OR REPLACE INTO shares (token, created, expires, max_downloads, downloads) VALUES (?, ?, ?, ?, 0)");
+        query.bind(1, token);
+        query.bind(2, static_cast<int64_t>(now));
+        query.bind(3, static_cast<int64_t>(expires));
+        query.bind(4, static_cast<int64_t>(max_downloads));
+        query.exec();
+        replicate(*db, { "share", token, std::to_string(now), std::to_string(expires), std::to_string(max_downloads) });
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error registering share: " + std::string(e.what()), { {"token", token} });
+    }
+    getShareReaper().schedule(token, expires);
+    return expires;
+}
+
+/**
+ * @brief Параметры ссылки из запроса (?ttl=секунды&max_downloads=N)
+ * 
+ * @param req HTTP запрос
+ * @param ttl Срок жизни (0, если не указан или некорректен)
+ * @param max_downloads Лимит скачиваний (0, если не указан или некорректен)
+ */
+void share_params_from(const httplib::Request& req, uint64_t& ttl, uint64_t& max_downloads) {
+    ttl = 0;
+    max_downloads = 0;
+    try {
+        if (req.has_param("ttl")) {
+            ttl = std::stoull(req.get_param_value("ttl"));
+        }
+        if (req.has_param("max_downloads")) {
+            max_downloads = std::stoull(req.get_param_value("max_downloads"));
+        }
+    }
+    catch (const std::exception&) {
+    }
+}
+
+/**
+ * @brief Объём файлов ссылки в байтах — столько стоит одно полное скачивание
+ * 
+ * @param token Токен ссылки
+ * @return uint64_t Суммарный размер файлов, но не меньше 1 байта
+ */
+uint64_t share_content_size(const std::string& token) {
+    uint64_t total = 0;
+    FileList files = getFolderCache().list(token_folder(TokenKind::Send, token));
+    if (files) {
+        for (const auto& file : *files) {
+            total += file.size;
+        }
+    }
+    return std::max<uint64_t>(total, 1);
+}
+
+/**
+ * @brief Учёт отданных по ссылке байт
+ * 
+ * Лимит скачиваний ссылки — это max_downloads полных объёмов её файлов, поэтому
+ * любые запросы (условные, с Range, по одному файлу) расходуют его по числу
+ * отданных байт, и дробление скачивания на части лимит не обходит. Запрос,
+ * который не помещается в остаток, отклоняется; запрос, исчерпавший лимит,
+ * разрешается, после чего ссылка истекает.
+ * 
+ * @param token Токен ссылки
+ * @param bytes Размер тела ответа
+ * @return true Отдача разрешена
+ * @return false Остатка лимита не хватает
+ */
+bool record_share_transfer(const std::string& token, uint64_t bytes) {
+    uint64_t share_size = share_content_size(token);
+    bool exhausted = false;
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& select = db->statement("SELECT max_downloads, served_bytes FROM shares WHERE token = ?");
+        select.bind(1, token);
+        if (!select.executeStep()) {
+            select.tryReset();
+            return true;
+        }
+        uint64_t max_downloads = static_cast<uint64_t>(select.getColumn(0).getInt64());
+        uint64_t served = static_cast<uint64_t>(select.getColumn(1).getInt64());
+        select.tryReset();
+
+        uint64_t budget = max_downloads * share_size;
+        if (max_downloads > 0 && (served >= budget || bytes > budget - served)) {
+            return false;
+        }
+        served += bytes;
+        SQLite::Statement& update = db->statement("UPDATE shares SET served_bytes = ?, downloads = ? WHERE token = ?");
+        update.bind(1, static_cast<int64_t>(served));
+        update.bind(2, static_cast<int64_t>((served + share_size - 1) / share_size));
+        update.bind(3, token);
+        update.exec();
+        exhausted = max_downloads > 0 && served == budget;
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error counting share download: " + std::string(e.what()), { {"token", token} });
+        return true;
+    }
+    if (exhausted) {
+        getShareReaper().expire_now(token);
+        replicate({ "expire", token });
+    }
+    return true;
+}
+
+/**
+ * @brief Учёт скачивания всей ссылки (архивом)
+ * 
+ * @param token Токен ссылки
+ * @return true Скачивание разрешено
+ * @return false Лимит скачиваний исчерпан
+ */
+bool record_share_download(const std::string& token) {
+    return record_share_transfer(token, share_content_size(token));
+}
+
+/**
+ * @brief Загрузка расписания ссылок при запуске
+ * 
+ * Ссылки из таблицы shares ставятся в расписание сборщика. Папкам hidefiles/
+ * без записи (созданным до появления сроков) назначается share_ttl от момента
+ * запуска, чтобы обновление сервера не удаляло их сразу. После этого поток
+ * сборщика запускается.
+ */
+void loadShares() {
+    ShareReaper& reaper = getShareReaper();
+    std::unordered_set<std::string> known;
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT token, expires FROM shares");
+        while (query.executeStep()) {
+            std::string token = query.getColumn(0).getText();
+            reaper.schedule(token, static_cast<std::time_t>(query.getColumn(1).getInt64()));
+            known.insert(token);
+        }
+        query.tryReset();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error loading shares: " + std::string(e.what()));
+    }
+
+    size_t adopted = 0;
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Transaction transaction(db->database());
+        SQLite::Statement& insert = db->statement(
+            "INSERT OR IGNORE INTO shares (token, created, expires, max_downloads, downloads) VALUES (?, ?, ?, 0, 0)");
+        for_each_token_folder(TokenKind::Send, getServerConfig().shard_depth, [&](const std::string& token, const fs::path& folder) {
+            if (known.count(token)) {
+                return;
+            }
+            std::error_code ec;
+            std::time_t created = to_time_t(fs::last_write_time(folder, ec));
+            std::time_t expires = std::time(nullptr) + static_cast<std::time_t>(getServerConfig().share_ttl);
+            insert.bind(1, token);
+            insert.bind(2, static_cast<int64_t>(created));
+            insert.bind(3, static_cast<int64_t>(expires));
+            insert.exec();
+            insert.tryReset();
+            reaper.schedule(token, expires);
+            ++adopted;
+        });
+        transaction.commit();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error adopting existing shares: " + std::string(e.what()));
+    }
+
+    reaper.start();
+    logMessage(LogLevel::Info, "Share reaper started", {
+        {"scheduled", std::to_string(reaper.pending())}, {"adopted", std::to_string(adopted)}
+    });
+}
+/**
+ * @brief Получение реализации ввода-вывода хранилища
+ * 
+ * Выбирается один раз по настройке io_backend. Если io_uring запрошен, но
+ * недоступен (сборка без него или ядро его не разрешает), используется POSIX.
+ * 
+ * @return StorageBackend& Реализация процесса
+ */
+StorageBackend& getStorage() {
+    static std::unique_ptr<StorageBackend> storage = []() -> std::unique_ptr<StorageBackend> {
+        const ServerConfig& config = getServerConfig();
+        if (config.io_backend == "uring") {
+#ifdef HAVE_IO_URING
+            if (IoRing(2).is_valid()) {
+                return std::make_unique<UringStorage>(static_cast<unsigned>(config.io_queue_depth), config.io_direct,
+                                                      static_cast<unsigned>(config.worker_threads));
+            }
+            logMessage(LogLevel::Warning, "io_uring is not available, falling back to POSIX storage I/O");
+#else
+            logMessage(LogLevel::Warning, "Built without io_uring support, falling back to POSIX storage I/O");
+#endif
+        }
+        return std::make_unique<PosixStorage>();
+    }();
+    return *storage;
+}
+
+/**
+ * @brief Потоковый приём файлов из multipart-запроса
+ * 
+ * Каждая часть с именем файла записывается на диск по мере поступления данных,
+ * поэтому память на загрузку ограничена буфером приёма httplib независимо от размера файла.
+ * Место в квоте папки резервируется до учёта сохранённых файлов: сразу на
+ * expected_size, если размер тела известен, иначе по мере приёма данных.
+ * 
+ * @param content_reader Читатель тела запроса
+ * @param dir_path Папка назначения
+ * @param filenames Имена успешно сохранённых файлов
+ * @param expected_size Размер тела запроса из Content-Length (0 — неизвестен)
+ * @return UploadResult::Ok Все файлы приняты и сохранены
+ * @return UploadResult::QuotaExceeded Превышена квота папки
+ * @return UploadResult::Failed Ошибка записи или превышен max_upload_size
+ */
+UploadResult receive_multipart_files(const httplib::ContentReader& content_reader, const std::string& dir_path, std::vector<std::string>& filenames, uint64_t expected_size) {
+    std::unique_ptr<UploadFile> current;
+    std::string current_name;
+    size_t received = 0;
+    QuotaReservation reservation(dir_path);
+    if (expected_size > 0 && !reservation.reserve(expected_size)) {
+        logMessage(LogLevel::Warning, "Upload rejected by quota", { {"folder", dir_path}, {"size", std::to_string(expected_size)} });
+        return UploadResult::QuotaExceeded;
+    }
+    bool over_quota = false;
+
+    bool ok = content_reader(
+        [&](const httplib::MultipartFormData& file) {
+            if (current) {
+                if (!current->commit()) {
+                    return false;
+                }
+                filenames.push_back(current_name);
+                current.reset();
+            }
+            current_name = sanitize_filename(file.filename);
+            if (current_name.empty()) {
+                return true;
+            }
+            current = std::make_unique<UploadFile>(dir_path, current_name);
+            return current->is_open();
+        },
+        [&](const char* data, size_t length) {
+            received += length;
+            upload_bytes_counter().add(length);
+            if (received > getServerConfig().max_upload_size) {
+                return false;
+            }
+            if (!reservation.ensure(received)) {
+                over_quota = true;
+                return false;
+            }
+            return !current || current->write(data, length);
+        });
+
+    if (ok && current) {
+        ok = current->commit();
+        if (ok) {
+            filenames.push_back(current_name);
+        }
+    }
+    getFolderCache().invalidate(dir_path);
+    if (!ok) {
+        logMessage(LogLevel::Warning, "Upload aborted", {
+            {"folder", dir_path}, {"received", std::to_string(received)}, {"over_quota", over_quota ? "true" : "false"}
+        });
+        return over_quota ? UploadResult::QuotaExceeded : UploadResult::Failed;
+    }
+    return UploadResult::Ok;
+}
+
+/**
+ * @brief Проверка заголовков запроса на загрузку файлов
+ * 
+ * Размер из Content-Length сверяется с max_upload_size и, если указана папка,
+ * с остатком её квоты, так что запрос отклоняется до приёма тела.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ, заполняется при ошибке
+ * @param dir_path Папка назначения (необязательно)
+ * @return true Запрос можно принимать
+ * @return false Запрос отклонён
+ */
+bool check_upload_request(const httplib::Request& req, httplib::Response& res, const std::string& dir_path) {
+    if (!req.is_multipart_form_data()) {
+        res.status = 400;
+        res.set_content("Expected multipart/form-data.", "text/plain");
+        return false;
+    }
+    if (req.has_header("Content-Length") && req.get_header_value_u64("Content-Length") > getServerConfig().max_upload_size) {
+        res.status = 413;
+        res.set_header("Connection", "close");
+        res.set_content("File is too large.", "text/plain");
+        return false;
+    }
+    if (!dir_path.empty() && req.has_header("Content-Length") &&
+        req.get_header_value_u64("Content-Length") > quota_remaining(dir_path)) {
+        reject_over_quota(res);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Обработка загрузки файла
+ * 
+ * Параметры запроса ttl (секунды) и max_downloads задают срок жизни ссылки
+ * и лимит скачиваний; без них действует share_ttl из настроек.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param content_reader Читатель тела запроса
+ */
+void handle_file_upload(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+    if (!check_upload_request(req, res)) {
+        return;
+    }
+
+    std::string token = generate_unique_token(TokenKind::Send, SEND_TOKEN_LENGTH);
+    std::string dir_path = token_folder(TokenKind::Send, token);
+    fs::create_directories(dir_path);
+
+    std::vector<std::string> filenames;
+
+    if (receive_multipart_files(content_reader, dir_path, filenames) != UploadResult::Ok) {
+        std::error_code ec;
+        fs::remove_all(dir_path, ec);
+        res.status = 500;
+        res.set_content("{\"error\": \"Upload failed\"}", "application/json");
+        return;
+    }
+    getTokenIndex().add(TokenKind::Send, token);
+    uint64_t ttl, max_downloads;
+    share_params_from(req, ttl, max_downloads);
+    std::time_t expires = register_share(token, ttl, max_downloads);
+
+    std::string link = "http://localhost:8080/sendfile/" + token;
+    std::string response = "{\"link\": \"" + link + "\", \"expires\": " + std::to_string(expires) + ", \"files\": [";
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        response += "\"" + json_escape(filenames[i]) + "\"";
+        if (i < filenames.size() - 1) response += ", ";
+    }
+    response += "]}";
+
+    res.set_content(response, "application/json");
+}
+
+/**
+ * @brief Получение учёта записей фрагментов в сессии загрузки
+ * 
+ * @return UploadWriters& Учёт процесса
+ */
+UploadWriters& getUploadWriters() {
+    static UploadWriters writers;
+    return writers;
+}
+
+/**
+ * @brief Путь к разреженному файлу сессии загрузки
+ */
+std::string upload_session_path(const std::string& id) {
+    return UPLOADS_PATH + "/" + id + ".part";
+}
+
+/**
+ * @brief Загрузка сессии из базы данных
+ * 
+ * @param id Идентификатор сессии
+ * @param session Заполняемая сессия
+ * @return true Сессия найдена
+ * @return false Сессии нет
+ */
+bool load_upload_session(const std::string& id, UploadSession& session) {
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT token, filename, size, finalizing FROM upload_sessions WHERE id = ?");
+        query.bind(1, id);
+        if (query.executeStep()) {
+            session.id = id;
+            session.token = query.getColumn(0).getText();
+            session.filename = query.getColumn(1).getText();
+            session.size = static_cast<uint64_t>(query.getColumn(2).getInt64());
+            session.finalizing = query.getColumn(3).getInt() != 0;
+            return true;
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error loading upload session: " + std::string(e.what()), { {"session", id} });
+    }
+    return false;
+}
+
+/**
+ * @brief Принятые диапазоны сессии, объединённые и отсортированные
+ * 
+ * @param id Идентификатор сессии
+ * @return std::vector<std::pair<uint64_t, uint64_t>> Диапазоны [начало, конец)
+ */
+std::vector<std::pair<uint64_t, uint64_t>> received_ranges(const std::string& id) {
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    try {
+        auto db = getDbPool().reader();
+        SQLite::Statement& query = db->statement("SELECT offset, length FROM upload_chunks WHERE session_id = ? ORDER BY offset");
+        query.bind(1, id);
+        while (query.executeStep()) {
+            uint64_t start = static_cast<uint64_t>(query.getColumn(0).getInt64());
+            uint64_t end = start + static_cast<uint64_t>(query.getColumn(1).getInt64());
+            if (!ranges.empty() && start <= ranges.back().second) {
+                ranges.back().second = std::max(ranges.back().second, end);
+            }
+            else {
+                ranges.emplace_back(start, end);
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error loading upload chunks: " + std::string(e.what()), { {"session", id} });
+    }
+    return ranges;
+}
+
+/**
+ * @brief Удаление сессии загрузки вместе с её файлом
+ * 
+ * @param id Идентификатор сессии
+ */
+void delete_upload_session(const std::string& id) {
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& chunks = db->statement("DELETE FROM upload_chunks WHERE session_id = ?");
+        chunks.bind(1, id);
+        chunks.exec();
+        SQLite::Statement& session = db->statement("DELETE FROM upload_sessions WHERE id = ?");
+        session.bind(1, id);
+        session.exec();
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error deleting upload session: " + std::string(e.what()), { {"session", id} });
+    }
+    std::error_code ec;
+    fs::remove(upload_session_path(id), ec);
+}
+
+/**
+ * @brief Очистка просроченных сессий загрузки
+ * 
+ * Удаляет сессии старше UPLOAD_SESSION_TTL и снимает признак завершения с сессий,
+ * завершение которых прервал перезапуск сервера.
+ */
+void cleanupUploadSessions() {
+    std::vector<std::string> expired;
+    try {
+        auto db = getDbPool().writer();
+        db->database().exec("UPDATE upload_sessions SET finalizing = 0");
+        SQLite::Statement& query = db->statement("SELECT id FROM upload_sessions WHERE created < ?");
+        query.bind(1, static_cast<int64_t>(std::time(nullptr) - UPLOAD_SESSION_TTL));
+        while (query.executeStep()) {
+            expired.push_back(query.getColumn(0).getText());
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error cleaning up upload sessions: " + std::string(e.what()));
+    }
+    for (const auto& id : expired) {
+        delete_upload_session(id);
+    }
+    if (!expired.empty()) {
+        logMessage(LogLevel::Info, "Expired upload sessions removed", { {"count", std::to_string(expired.size())} });
+    }
+}
+
+/**
+ * @brief Создание сессии загрузки по частям
+ * 
+ * POST /api/upload/session?filename=...&size=...[&token=...]. Без токена файл после
+ * завершения попадает в новую анонимную папку hidefiles/.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_upload_session_create(const httplib::Request& req, httplib::Response& res) {
+    std::string token = req.get_param_value("token");
+    std::string filename = sanitize_filename(req.get_param_value("filename"));
+    uint64_t size = 0;
+    try {
+        size = std::stoull(req.get_param_value("size"));
+    }
+    catch (const std::exception&) {
+        filename.clear();
+    }
+
+    if (filename.empty() || filename[0] == '.') {
+        res.status = 400;
+        res.set_content("{\"error\": \"filename and size are required\"}", "application/json");
+        return;
+    }
+    if (!token.empty() && !validate_token(token)) {
+        res.status = 403;
+        res.set_content("{\"error\": \"Invalid token\"}", "application/json");
+        return;
+    }
+    if (size > getServerConfig().max_upload_size) {
+        res.status = 413;
+        res.set_content("{\"error\": \"File is too large\"}", "application/json");
+        return;
+    }
+
+    // Проверка квоты и запись сессии под одним соединением записи: размер сессии
+    // сразу занимает место, и параллельные сессии не превысят квоту вместе
+    std::string id = generate_send_token(24);
+    try {
+        auto db = getDbPool().writer();
+        if (!token.empty() && size > quota_remaining(*db, token_folder(TokenKind::User, token))) {
+            res.status = 413;
+            res.set_content("{\"error\": \"Storage quota exceeded\"}", "application/json");
+            return;
+        }
+
+        fs::create_directories(UPLOADS_PATH);
+        { std::ofstream create(upload_session_path(id), std::ios::binary); }
+        fs::resize_file(upload_session_path(id), size);
+
+        SQLite::Statement& query = db->statement("INSERT INTO upload_sessions (id, token, filename, size, created, finalizing) VALUES (?, ?, ?, ?, ?, 0)");
+        query.bind(1, id);
+        query.bind(2, token);
+        query.bind(3, filename);
+        query.bind(4, static_cast<int64_t>(size));
+        query.bind(5, static_cast<int64_t>(std::time(nullptr)));
+        query.exec();
+    }
+    catch (const std::exception& e) {
+        std::error_code ec;
+        fs::remove(upload_session_path(id), ec);
+        logMessage(LogLevel::Error, "Error creating upload session: " + std::string(e.what()));
+        res.status = 500;
+        res.set_content("{\"error\": \"Cannot create upload session\"}", "application/json");
+        return;
+    }
+
+    logMessage(LogLevel::Info, "Upload session created", { {"session", id}, {"file", filename}, {"size", std::to_string(size)} });
+    res.set_content("{\"session\": \"" + id + "\", \"chunk_size\": " + std::to_string(UPLOAD_CHUNK_SIZE) + "}", "application/json");
+}
+
+/**
+ * @brief Приём фрагмента файла
+ * 
+ * PUT /api/upload/session/<id>?offset=N, тело — данные фрагмента. Фрагменты можно
+ * отправлять параллельно и повторно: каждый пишется по своему смещению. Запись
+ * учитывается в UploadWriters, и завершение сессии дожидается её окончания.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param content_reader Читатель тела запроса
+ */
+void handle_upload_chunk(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+    std::string id = req.matches[1].str();
+    if (!getUploadWriters().enter(id)) {
+        res.status = 409;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Upload is being finalized\"}", "application/json");
+        return;
+    }
+    struct WriterGuard {
+        std::string id;
+        ~WriterGuard() { getUploadWriters().leave(id); }
+    } guard{ id };
+
+    UploadSession session;
+    if (!load_upload_session(id, session) || session.finalizing) {
+        res.status = 404;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Upload session not found\"}", "application/json");
+        return;
+    }
+
+    uint64_t offset = 0;
+    try {
+        offset = std::stoull(req.get_param_value("offset"));
+    }
+    catch (const std::exception&) {
+        res.status = 400;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"offset is required\"}", "application/json");
+        return;
+    }
+    if (!req.has_header("Content-Length")) {
+        res.status = 411;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Content-Length is required\"}", "application/json");
+        return;
+    }
+    uint64_t length = req.get_header_value_u64("Content-Length");
+    if (length > MAX_CHUNK_SIZE || offset > session.size || length > session.size - offset) {
+        res.status = 416;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Chunk is out of range\"}", "application/json");
+        return;
+    }
+
+    auto file = getStorage().open(upload_session_path(session.id), StorageMode::Update);
+    uint64_t written = 0;
+    bool ok = file && content_reader([&](const char* data, size_t data_length) {
+        if (written + data_length > length || !file->write_at(offset + written, data, data_length)) {
+            return false;
+        }
+        written += data_length;
+        upload_bytes_counter().add(data_length);
+        return true;
+    });
+    ok = ok && file->flush();
+    file.reset();
+
+    if (!ok || written != length) {
+        res.status = 500;
+        res.set_content("{\"error\": \"Chunk write failed\"}", "application/json");
+        return;
+    }
+
+    try {
+        // Фрагмент записывается, только пока сессию не начали завершать
+        auto db = getDbPool().writer();
+        SQLite::Statement& query = db->statement("INSERT OR REPLACE INTO upload_chunks (session_id, offset, length) "
+                                                 "SELECT ?, ?, ? WHERE EXISTS (SELECT 1 FROM upload_sessions WHERE id = ? AND finalizing = 0)");
+        query.bind(1, session.id);
+        query.bind(2, static_cast<int64_t>(offset));
+        query.bind(3, static_cast<int64_t>(length));
+        query.bind(4, session.id);
+        if (query.exec() == 0) {
+            res.status = 409;
+            res.set_content("{\"error\": \"Upload is being finalized\"}", "application/json");
+            return;
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error recording upload chunk: " + std::string(e.what()), { {"session", session.id} });
+        res.status = 500;
+        res.set_content("{\"error\": \"Chunk write failed\"}", "application/json");
+        return;
+    }
+
+    res.set_content("{\"offset\": " + std::to_string(offset) + ", \"length\": " + std::to_string(length) + "}", "application/json");
+}
+
+/**
+ * @brief Состояние сессии загрузки
+ * 
+ * GET /api/upload/session/<id> возвращает размер файла и уже принятые диапазоны,
+ * чтобы клиент мог дослать только недостающие фрагменты.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_upload_session_status(const httplib::Request& req, httplib::Response& res) {
+    UploadSession session;
+    if (!load_upload_session(req.matches[1].str(), session)) {
+        res.status = 404;
+        res.set_content("{\"error\": \"Upload session not found\"}", "application/json");
+        return;
+    }
+
+    std::string response = "{\"session\": \"" + session.id + "\", \"filename\": \"" + json_escape(session.filename) +
+        "\", \"size\": " + std::to_string(session.size) + ", \"chunk_size\": " + std::to_string(UPLOAD_CHUNK_SIZE) + ", \"received\": [";
+    auto ranges = received_ranges(session.id);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        response += "[" + std::to_string(ranges[i].first) + ", " + std::to_string(ranges[i].second) + "]";
+        if (i < ranges.size() - 1) response += ", ";
+    }
+    response += "]}";
+    res.set_content(response, "application/json");
+}
+
+/**
+ * @brief Завершение сессии загрузки
+ * 
+ * POST /api/upload/session/<id>/finalize захватывает сессию в UploadWriters (новые
+ * фрагменты отклоняются, начатые дописываются), проверяет, что приняты все байты,
+ * считает SHA-256 и переносит файл в папку токена через хранилище блобов.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_upload_session_finalize(const httplib::Request& req, httplib::Response& res) {
+    UploadSession session;
+    if (!load_upload_session(req.matches[1].str(), session)) {
+        res.status = 404;
+        res.set_content("{\"error\": \"Upload session not found\"}", "application/json");
+        return;
+    }
+    if (!getUploadWriters().claim(session.id, std::chrono::seconds(UPLOAD_FINALIZE_WAIT))) {
+        res.status = 409;
+        res.set_content("{\"error\": \"Upload is still receiving chunks or is being finalized\"}", "application/json");
+        return;
+    }
+
+    auto ranges = received_ranges(session.id);
+    bool complete = session.size == 0 || (ranges.size() == 1 && ranges[0].first == 0 && ranges[0].second == session.size);
+    if (!complete) {
+        getUploadWriters().unclaim(session.id);
+        res.status = 409;
+        res.set_content("{\"error\": \"Upload is incomplete\"}", "application/json");
+        return;
+    }
+
+    try {
+        auto db = getDbPool().writer();
+        SQLite::Statement& claim = db->statement("UPDATE upload_sessions SET finalizing = 1 WHERE id = ? AND finalizing = 0");
+        claim.bind(1, session.id);
+        if (claim.exec() == 0) {
+            getUploadWriters().unclaim(session.id);
+            res.status = 409;
+            res.set_content("{\"error\": \"Upload is already being finalized\"}", "application/json");
+            return;
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error finalizing upload session: " + std::string(e.what()), { {"session", session.id} });
+        getUploadWriters().unclaim(session.id);
+        res.status = 500;
+        res.set_content("{\"error\": \"Finalize failed\"}", "application/json");
+        return;
+    }
+
+    std::string part_path = upload_session_path(session.id);
+    std::string digest = getCpuPool().submit([&part_path] {
+        Sha256 hash;
+        auto file = getStorage().open(part_path, StorageMode::Read);
+        const char* data;
+        size_t read;
+        for (uint64_t offset = 0; file && offset < file->size() && file->read_chunk(offset, IO_BUFFER_SIZE, data, read) && read > 0; offset += read) {
+            hash.update(data, read);
+        }
+        return hash.hex_digest();
+    }).get();
+
+    bool anonymous = session.token.empty();
+    std::string share_token = anonymous ? generate_unique_token(TokenKind::Send, SEND_TOKEN_LENGTH) : session.token;
+    std::string dir_path = token_folder(anonymous ? TokenKind::Send : TokenKind::User, share_token);
+    std::string final_path = dir_path + "/" + session.filename;
+
+    std::error_code ec;
+    fs::create_directories(dir_path, ec);
+    uint64_t previous_size = existing_file_size(final_path);
+    if (!store_blob_reference(part_path, final_path, digest, session.size) && !store_plain_file(part_path, final_path)) {
+        ec = std::make_error_code(std::errc::io_error);
+    }
+    if (!ec) {
+        record_file_usage(final_path, previous_size, session.size);
+    }
+    if (ec) {
+        try {
+            auto db = getDbPool().writer();
+            SQLite::Statement& release = db->statement("UPDATE upload_sessions SET finalizing = 0 WHERE id = ?");
+            release.bind(1, session.id);
+            release.exec();
+        }
+        catch (const std::exception&) {
+        }
+        getUploadWriters().unclaim(session.id);
+        res.status = 500;
+        res.set_content("{\"error\": \"Finalize failed\"}", "application/json");
+        return;
+    }
+
+    delete_upload_session(session.id);
+    getUploadWriters().unclaim(session.id);
+    getFolderCache().invalidate(dir_path);
+    std::time_t expires = 0;
+    if (anonymous) {
+        getTokenIndex().add(TokenKind::Send, share_token);
+        uint64_t ttl, max_downloads;
+        share_params_from(req, ttl, max_downloads);
+        expires = register_share(share_token, ttl, max_downloads);
+    }
+    logMessage(LogLevel::Info, "Upload session finalized", { {"session", session.id}, {"file", session.filename} });
+
+    std::string response = "{\"file\": \"" + json_escape(session.filename) + "\"";
+    if (anonymous) {
+        response += ", \"link\": \"http://localhost:8080/sendfile/" + share_token + "\"";
+        response += ", \"expires\": " + std::to_string(expires);
+    }
+    response += "}";
+    res.set_content(response, "application/json");
+}
+
+/**
+ * @brief Размер блока подписи для файла
+ * 
+ * Как в rsync, около квадратного корня из размера: так длина подписи и объём
+ * данных, пересылаемых при небольшой правке, растут одинаково медленно.
+ * Округляется вверх до 1 КиБ и ограничивается DELTA_MIN_BLOCK..DELTA_MAX_BLOCK.
+ * 
+ * @param size Размер файла
+ * @return size_t Размер блока в байтах
+ */
+size_t delta_block_size(uint64_t size) {
+    uint64_t block = static_cast<uint64_t>(std::sqrt(static_cast<double>(size)));
+    block = (block + 1023) / 1024 * 1024;
+    return static_cast<size_t>(std::min<uint64_t>(DELTA_MAX_BLOCK, std::max<uint64_t>(DELTA_MIN_BLOCK, block)));
+}
+
+/**
+ * @brief Слабая контрольная сумма блока (как в rsync)
+ * 
+ * a — сумма байтов, b — сумма a по каждому префиксу, обе по модулю 2^16;
+ * результат b << 16 | a. Клиент пересчитывает её при сдвиге окна на байт
+ * за O(1) и только при совпадении сверяет сильный хеш.
+ * 
+ * @param data Данные блока
+ * @param length Длина блока
+ * @return uint32_t Контрольная сумма
+ */
+uint32_t rolling_checksum(const char* data, size_t length) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < length; ++i) {
+        a += static_cast<unsigned char>(data[i]);
+        b += a;
+    }
+    return (b & 0xFFFF) << 16 | (a & 0xFFFF);
+}
+
+/**
+ * @brief Путь к сохранённой подписи блоба
+ * 
+ * Подпись зависит только от содержимого, поэтому хранится рядом с блобом, как
+ * сжатые копии, и удаляется вместе с ним.
+ * 
+ * @param hash SHA-256 содержимого
+ * @return std::string Путь к файлу подписи
+ */
+std::string signature_path_for(const std::string& hash) {
+    return blob_path_for(hash) + ".sig";
+}
+
+/**
+ * @brief Вычисление подписи блоба
+ * 
+ * Для каждого блока записываются 8 hex-символов слабой суммы и 32 hex-символа
+ * начала SHA-256 (SHA-256 есть в WebCrypto, поэтому браузер сверяет блоки без
+ * сторонних библиотек).
+ * 
+ * @param hash SHA-256 содержимого
+ * @return std::string JSON {"size", "block", "hash", "blocks"} или пустая строка при ошибке
+ */
+std::string compute_file_signature(const std::string& hash) {
+    auto file = getStorage().open(blob_path_for(hash), StorageMode::Read);
+    if (!file) {
+        return "";
+    }
+    static const char HEX[] = "0123456789abcdef";
+    uint64_t size = file->size();
+    size_t block = delta_block_size(size);
+    std::string blocks;
+    blocks.reserve(static_cast<size_t>((size / block + 1) * 40));
+    std::string buffer;
+    buffer.reserve(block);
+    auto append_block = [&] {
+        uint32_t weak = rolling_checksum(buffer.data(), buffer.size());
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            blocks += HEX[weak >> shift & 0x0F];
+        }
+        Sha256 strong;
+        strong.update(buffer.data(), buffer.size());
+        blocks += strong.hex_digest().substr(0, 32);
+        buffer.clear();
+    };
+    const char* data;
+    size_t read;
+    for (uint64_t offset = 0; offset < size; offset += read) {
+        if (!file->read_chunk(offset, IO_BUFFER_SIZE, data, read) || read == 0) {
+            return "";
+        }
+        for (size_t used = 0; used < read;) {
+            size_t take = std::min(read - used, block - buffer.size());
+            buffer.append(data + used, take);
+            used += take;
+            if (buffer.size() == block) {
+                append_block();
+            }
+        }
+    }
+    if (!buffer.empty()) {
+        append_block();
+    }
+    return "{\"size\": " + std::to_string(size) + ", \"block\": " + std::to_string(block) +
+           ", \"hash\": \"" + hash + "\", \"blocks\": \"" + blocks + "\"}";
+}
+
+/**
+ * @brief Выдача подписи файла для дельта-загрузки
+ * 
+ * GET /api/signature/<token>/<file>. Подпись вычисляется в CpuPool при первом
+ * запросе и сохраняется рядом с блобом. Поле hash нужно вернуть в дельте:
+ * по нему сервер проверяет, что файл не изменился с момента выдачи подписи.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_file_signature(const httplib::Request& req, httplib::Response& res) {
+    std::string token = req.matches[1].str();
+    std::string file_name = req.matches[2].str();
+    std::string hash;
+    if (validate_token(token) && sanitize_filename(file_name) == file_name) {
+        hash = blob_hash_for(token_folder(TokenKind::User, token) + "/" + file_name);
+    }
+    if (hash.empty()) {
+        res.status = 404;
+        res.set_content("{\"error\": \"File not found\"}", "application/json");
+        return;
+    }
+
+    std::string path = signature_path_for(hash);
+    std::string body;
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (!ec) {
+        auto cached = read_whole_file(path, size);
+        body = cached ? *cached : std::string();
+    }
+    if (body.empty()) {
+        body = getCpuPool().submit([&hash] { return compute_file_signature(hash); }).get();
+        if (body.empty()) {
+            res.status = 500;
+            res.set_content("{\"error\": \"Cannot read file\"}", "application/json");
+            return;
+        }
+        std::string temp_path = path + "." + generate_send_token(8) + ".part";
+        std::ofstream(temp_path, std::ios::binary) << body;
+        fs::rename(temp_path, path, ec);
+        if (ec) {
+            fs::remove(temp_path, ec);
+        }
+    }
+    set_compressed_content(req, res, body, "application/json");
+}
+
+/**
+ * @brief Приём дельты изменённого файла
+ * 
+ * POST /api/delta/<token>/<file>?base=<hash>&block=<размер блока>&size=<новый размер>,
+ * тело — команды DeltaPatch. base и block берутся из подписи. Если файл с тех
+ * пор заменён, возвращается 409, и клиент загружает его целиком. Новая версия
+ * собирается во временный файл и подменяет прежнюю атомарно (UploadFile),
+ * поэтому при обрыве или ошибке в дельте прежняя версия остаётся нетронутой.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param content_reader Читатель тела запроса
+ */
+void handle_delta_upload(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+    std::string token = req.matches[1].str();
+    std::string file_name = req.matches[2].str();
+    if (!validate_token(token)) {
+        res.status = 403;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Invalid token\"}", "application/json");
+        return;
+    }
+    uint64_t size = 0, block = 0;
+    try {
+        size = std::stoull(req.get_param_value("size"));
+        block = std::stoull(req.get_param_value("block"));
+    }
+    catch (const std::exception&) {
+        file_name.clear();
+    }
+    if (file_name.empty() || sanitize_filename(file_name) != file_name || file_name[0] == '.') {
+        res.status = 400;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"base, block and size are required\"}", "application/json");
+        return;
+    }
+
+    std::string dir_path = token_folder(TokenKind::User, token);
+    std::string file_path = dir_path + "/" + file_name;
+    std::string base = blob_hash_for(file_path);
+    auto base_file = base.empty() ? nullptr : getStorage().open(blob_path_for(base), StorageMode::Read);
+    if (!base_file || base != req.get_param_value("base") || block != delta_block_size(base_file->size())) {
+        res.status = 409;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"File has changed, upload it again\"}", "application/json");
+        return;
+    }
+    uint64_t previous_size = base_file->size();
+    if (size > getServerConfig().max_upload_size) {
+        res.status = 413;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"File is too large\"}", "application/json");
+        return;
+    }
+    QuotaReservation reservation(dir_path);
+    if (size > previous_size && !reservation.reserve(size - previous_size)) {
+        res.set_header("Connection", "close");
+        reject_over_quota(res);
+        return;
+    }
+
+    UploadFile out(dir_path, file_name);
+    if (!out.is_open()) {
+        res.status = 500;
+        res.set_content("{\"error\": \"Cannot create file\"}", "application/json");
+        return;
+    }
+    DeltaPatch patch(*base_file, static_cast<size_t>(block), out, size);
+    bool applied = content_reader([&patch](const char* data, size_t length) {
+        return patch.feed(data, length);
+    });
+    if (!applied || !patch.complete()) {
+        res.status = 400;
+        res.set_header("Connection", "close");
+        res.set_content("{\"error\": \"Invalid delta\"}", "application/json");
+        return;
+    }
+    if (!out.commit()) {
+        res.status = 500;
+        res.set_content("{\"error\": \"Cannot save file\"}", "application/json");
+        return;
+    }
+    getFolderCache().invalidate(dir_path);
+    logMessage(LogLevel::Info, "Delta upload applied", {
+        {"token", token}, {"file", file_name}, {"size", std::to_string(size)},
+        {"copied", std::to_string(patch.copied())}, {"literal", std::to_string(patch.literal())}
+    });
+    res.set_content("{\"file\": \"" + json_escape(file_name) + "\", \"size\": " + std::to_string(size) +
+                    ", \"copied\": " + std::to_string(patch.copied()) + ", \"literal\": " + std::to_string(patch.literal()) + "}",
+                    "application/json");
+}
+
+/**
+ * @brief Разбор шаблона на статические фрагменты и слоты {{имя}}
+ * 
+ * @param body Текст шаблона
+ * @return std::vector<TemplateSegment> Фрагменты по порядку
+ */
+std::vector<TemplateSegment> split_template(const std::string& body) {
+    std::vector<TemplateSegment> segments;
+    size_t position = 0;
+    while (true) {
+        size_t open = body.find("{{", position);
+        size_t close = open == std::string::npos ? std::string::npos : body.find("}}", open + 2);
+        if (close == std::string::npos) {
+            segments.push_back({ body.substr(position), "" });
+            return segments;
+        }
+        segments.push_back({ body.substr(position, open - position), body.substr(open + 2, close - open - 2) });
+        position = close + 2;
+    }
+}
+
+/**
+ * @brief Получение общего хранилища страниц
+ * 
+ * @return TemplateStore& Хранилище процесса
+ */
+TemplateStore& getTemplateStore() {
+    static TemplateStore store;
+    return store;
+}
+
+/**
+ * @brief Отдача статической страницы из TemplateStore
+ * 
+ * Ответ содержит ETag и Cache-Control: no-cache, совпавший If-None-Match даёт 304.
+ * Тело (или его готовый сжатый вариант) передаётся из памяти без копирования.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param name Имя файла в HTML_PATH
+ */
+void serve_static_page(const httplib::Request& req, httplib::Response& res, const std::string& name) {
+    auto page = getTemplateStore().get(name);
+    if (!page) {
+        res.status = 404;
+        res.set_content("Page not found.", "text/plain");
+        return;
+    }
+
+    res.set_header("ETag", page->etag);
+    res.set_header("Cache-Control", "no-cache");
+    res.set_header("Vary", "Accept-Encoding");
+    if (req.has_header("If-None-Match") && req.get_header_value("If-None-Match") == page->etag) {
+        res.status = 304;
+        return;
+    }
+
+    const std::string* body = &page->body;
+    auto encoded = page->encoded.find(static_cast<int>(negotiate_encoding(req)));
+    if (encoded != page->encoded.end()) {
+        res.set_header("Content-Encoding", encoding_name(static_cast<ContentEncoding>(encoded->first)));
+        body = &encoded->second;
+    }
+    res.set_content_provider(body->size(), "text/html",
+        [page, body](size_t offset, size_t length, httplib::DataSink& sink) {
+            return sink.write(body->data() + offset, length);
+        });
+}
+
+/**
+ * @brief Обработка страницы загрузки файлов
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_file_download_page(const httplib::Request& req, httplib::Response& res) {
+    std::string token = req.matches[1].str();
+    std::string dir_path = token_folder(TokenKind::Send, token);
+
+    if (!getTokenIndex().contains(TokenKind::Send, token)) {
+        res.set_content("Files not found", "text/plain");
+        res.status = 404;
+        return;
+    }
+
+    auto page = getTemplateStore().get("download.html");
+    if (!page) {
+        res.status = 500;
+        res.set_content("Download page template is missing.", "text/plain");
+        return;
+    }
+
+    auto files = get_files(dir_path);
+    thread_local std::string html;
+    html.clear();
+    page->render(html, [&](const std::string& slot, std::string& out) {
+        if (slot == "files") {
+            generate_file_list_html(*files, "/sendfile/" + token + "/", out);
+        }
+        else if (slot == "archive") {
+            out += "/sendfile/" + token + ".zip";
+        }
+    });
+
+    set_compressed_content(req, res, html, "text/html");
+}
+
+/**
+ * @brief Буква порядка сортировки в курсоре
+ */
+char listing_sort_letter(ListingSort sort) {
+    switch (sort) {
+    case ListingSort::Size: return 's';
+    case ListingSort::Mtime: return 'm';
+    default: return 'n';
+    }
+}
+
+/**
+ * @brief Значение шестнадцатеричной цифры
+ * 
+ * @return int Значение 0-15 или -1 для другого символа
+ */
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief Кодирование курсора листинга
+ * 
+ * Курсор хранит позицию, а не номер страницы, поэтому следующая страница
+ * продолжается после того же файла, даже если папка изменилась между запросами.
+ * 
+ * @param sort Порядок сортировки
+ * @param key Ключ сортировки последнего файла страницы
+ * @param name Имя последнего файла страницы
+ * @return std::string Курсор в шестнадцатеричном виде
+ */
+std::string encode_listing_cursor(ListingSort sort, int64_t key, const std::string& name) {
+    std::string raw = listing_sort_letter(sort) + std::to_string(key) + "/" + name;
+    static const char HEX[] = "0123456789abcdef";
+    std::string hex(raw.size() * 2, '0');
+    for (size_t i = 0; i < raw.size(); ++i) {
+        hex[2 * i] = HEX[static_cast<unsigned char>(raw[i]) >> 4];
+        hex[2 * i + 1] = HEX[static_cast<unsigned char>(raw[i]) & 0x0f];
+    }
+    return hex;
+}
+
+/**
+ * @brief Разбор курсора листинга
+ * 
+ * @param value Курсор из запроса
+ * @param sort Порядок сортировки запроса
+ * @param cursor Результат
+ * @return true Курсор корректен и выдан для этого порядка сортировки
+ * @return false Курсор повреждён или выдан для другой сортировки
+ */
+bool decode_listing_cursor(const std::string& value, ListingSort sort, ListingCursor& cursor) {
+    if (value.size() % 2 != 0) {
+        return false;
+    }
+    std::string raw;
+    raw.reserve(value.size() / 2);
+    for (size_t i = 0; i < value.size(); i += 2) {
+        int high = hex_value(value[i]);
+        int low = hex_value(value[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        raw += static_cast<char>(high << 4 | low);
+    }
+    size_t slash = raw.find('/');
+    if (raw.empty() || raw[0] != listing_sort_letter(sort) || slash == std::string::npos || slash < 2) {
+        return false;
+    }
+    try {
+        size_t used = 0;
+        cursor.key = std::stoll(raw.substr(1, slash - 1), &used);
+        if (used != slash - 1) {
+            return false;
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    cursor.name = raw.substr(slash + 1);
+    return true;
+}
+
+/**
+ * @brief JSON листинг папки с постраничной выдачей
+ * 
+ * GET /api/files/<токен> и /api/sendfile/<токен> с параметрами sort=name|size|mtime,
+ * order=asc|desc, prefix=..., limit=N и cursor=... (значение next предыдущей
+ * страницы). Страница выбирается двоичным поиском по готовым порядкам из
+ * FolderCache::index, поэтому её стоимость зависит от размера страницы, а не
+ * папки. Фильтр по префиксу при сортировке по имени — это диапазон индекса; при
+ * сортировке по размеру или времени совпавшие файлы упорядочиваются на запрос.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param kind Тип токена
+ */
+void handle_file_listing(const httplib::Request& req, httplib::Response& res, TokenKind kind) {
+    std::string token = req.matches[1].str();
+    if (!getTokenIndex().contains(kind, token)) {
+        res.status = 404;
+        res.set_content("{\"error\": \"Invalid token\"}", "application/json");
+        return;
+    }
+
+    ListingSort sort = ListingSort::Name;
+    std::string sort_name = req.has_param("sort") ? req.get_param_value("sort") : "name";
+    if (sort_name == "size") {
+        sort = ListingSort::Size;
+    }
+    else if (sort_name == "mtime") {
+        sort = ListingSort::Mtime;
+    }
+    else if (sort_name != "name") {
+        res.status = 400;
+        res.set_content("{\"error\": \"sort must be name, size or mtime\"}", "application/json");
+        return;
+    }
+    std::string order_name = req.has_param("order") ? req.get_param_value("order") : "asc";
+    if (order_name != "asc" && order_name != "desc") {
+        res.status = 400;
+        res.set_content("{\"error\": \"order must be asc or desc\"}", "application/json");
+        return;
+    }
+    bool descending = order_name == "desc";
+
+    size_t limit = LISTING_PAGE_SIZE;
+    try {
+        if (req.has_param("limit")) {
+            limit = std::min<size_t>(std::max<size_t>(1, std::stoul(req.get_param_value("limit"))), LISTING_MAX_PAGE_SIZE);
+        }
+    }
+    catch (const std::exception&) {
+        res.status = 400;
+        res.set_content("{\"error\": \"limit must be a number\"}", "application/json");
+        return;
+    }
+    bool has_cursor = req.has_param("cursor") && !req.get_param_value("cursor").empty();
+    ListingCursor cursor;
+    if (has_cursor && !decode_listing_cursor(req.get_param_value("cursor"), sort, cursor)) {
+        res.status = 400;
+        res.set_content("{\"error\": \"Invalid cursor\"}", "application/json");
+        return;
+    }
+    std::string prefix = req.get_param_value("prefix");
+
+    ListingIndex listing = getFolderCache().index(token_folder(kind, token));
+    const std::vector<FileEntry>& files = *listing->files;
+
+    // Имена с общим префиксом образуют непрерывный диапазон в порядке по имени
+    size_t first = std::lower_bound(files.begin(), files.end(), prefix,
+        [](const FileEntry& file, const std::string& value) { return file.name < value; }) - files.begin();
+    size_t last = std::partition_point(files.begin() + first, files.end(),
+        [&](const FileEntry& file) { return file.name.compare(0, prefix.size(), prefix) == 0; }) - files.begin();
+
+    std::vector<uint32_t> matched;
+    const std::vector<uint32_t>* order = nullptr;
+    if (sort != ListingSort::Name) {
+        order = sort == ListingSort::Size ? &listing->by_size : &listing->by_mtime;
+        if (!prefix.empty()) {
+            for (size_t i = first; i < last; ++i) {
+                matched.push_back(static_cast<uint32_t>(i));
+            }
+            std::stable_sort(matched.begin(), matched.end(),
+                [&](uint32_t a, uint32_t b) { return listing->key(sort, a) < listing->key(sort, b); });
+            order = &matched;
+        }
+    }
+    size_t total = order ? order->size() : last - first;
+    auto at = [&](size_t position) {
+        return order ? (*order)[position] : static_cast<uint32_t>(first + position);
+    };
+    auto compare = [&](uint32_t index) {
+        int64_t key = listing->key(sort, index);
+        if (key != cursor.key) {
+            return key < cursor.key ? -1 : 1;
+        }
+        return files[index].name.compare(cursor.name);
+    };
+    // Число элементов порядка, для которых выполняется условие (условие монотонно)
+    auto count_while = [&](auto&& condition) {
+        size_t low = 0, high = total;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (condition(at(middle))) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low;
+    };
+
+    // Для прямого порядка страница начинается после курсора, для обратного — перед ним
+    size_t start = 0, end = total;
+    if (has_cursor) {
+        if (descending) {
+            end = count_while([&](uint32_t index) { return compare(index) < 0; });
+        }
+        else {
+            start = count_while([&](uint32_t index) { return compare(index) <= 0; });
+        }
+    }
+    size_t count = std::min(limit, end - start);
+
+    thread_local std::string body;
+    body.clear();
+    body += "{\"files\": [";
+    uint32_t last_index = 0;
+    for (size_t i = 0; i < count; ++i) {
+        last_index = at(descending ? end - 1 - i : start + i);
+        const FileEntry& file = files[last_index];
+        if (i != 0) {
+            body += ", ";
+        }
+        body += "{\"name\": \"" + json_escape(file.name) + "\", \"size\": " + std::to_string(file.size) +
+            ", \"mtime\": " + std::to_string(static_cast<int64_t>(file.mtime)) +
+            ", \"type\": \"" + json_escape(file.content_type) + "\"}";
+    }
+    body += "], \"total\": " + std::to_string(total) + ", \"next\": ";
+    if (count != 0 && count < end - start) {
+        body += "\"" + encode_listing_cursor(sort, listing->key(sort, last_index), files[last_index].name) + "\"";
+    }
+    else {
+        body += "null";
+    }
+    body += "}";
+
+    set_compressed_content(req, res, body, "application/json");
+}
+
+/**
+ * @brief Получение ограничений скорости из настроек
+ * 
+ * @return RateLimits& Ограничения процесса
+ */
+RateLimits& getRateLimits() {
+    const ServerConfig& config = getServerConfig();
+    static RateLimits limits{
+        { config.rate_limit_ip, config.rate_limit_ip_burst },
+        { config.rate_limit_token, config.rate_limit_token_burst },
+        { static_cast<double>(config.bandwidth_ip), BANDWIDTH_BURST },
+        { static_cast<double>(config.bandwidth_token), BANDWIDTH_BURST }
+    };
+    return limits;
+}
+
+thread_local DownloadShaper t_download_shaper;
+
+/**
+ * @brief Учёт отданных байтов с ограничением скорости отдачи
+ * 
+ * Если для IP или токена текущего запроса задана скорость отдачи, поток
+ * ждёт, пока объём не уложится в неё. Ожидание занимает поток обработки
+ * соединения, как и медленный клиент.
+ * 
+ * @param bytes Число байтов, которое сейчас будет передано
+ */
+void account_download(size_t bytes) {
+    download_bytes_counter().add(bytes);
+    if (!t_download_shaper.ip && !t_download_shaper.token) {
+        return;
+    }
+    RateLimits& limits = getRateLimits();
+    std::chrono::nanoseconds delay(0);
+    if (t_download_shaper.ip) {
+        delay = std::max(delay, limits.ip_bytes.take(*t_download_shaper.ip, static_cast<double>(bytes)));
+    }
+    if (t_download_shaper.token) {
+        delay = std::max(delay, limits.token_bytes.take(*t_download_shaper.token, static_cast<double>(bytes)));
+    }
+    if (delay.count() > 0) {
+        std::this_thread::sleep_for(delay);
+    }
+}
+
+/**
+ * @brief Токен из пути запроса
+ * 
+ * @param path Путь запроса
+ * @return std::string Активный токен пользователя или ссылки, либо пустая строка
+ */
+std::string request_token(const std::string& path) {
+    static const std::string PREFIXES[] = {
+        "/files/", "/upload/", "/download/", "/sendfile/", "/api/files/", "/api/sendfile/",
+        "/api/signature/", "/api/delta/"
+    };
+    for (const auto& prefix : PREFIXES) {
+        if (path.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        size_t end = path.find_first_not_of(TOKEN_ALPHABET, prefix.size());
+        std::string token = path.substr(prefix.size(), end == std::string::npos ? std::string::npos : end - prefix.size());
+        if (getTokenIndex().contains(TokenKind::User, token) || getTokenIndex().contains(TokenKind::Send, token)) {
+            return token;
+        }
+        return "";
+    }
+    return "";
+}
+
+/**
+ * @brief Допуск запроса по ограничениям скорости
+ * 
+ * Вызывается из pre-routing обработчика. Запрос сверх скорости для IP клиента
+ * или для токена из пути получает 429 с Retry-After. Допущенному запросу
+ * назначаются вёдра скорости отдачи (t_download_shaper).
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @return true Запрос допущен
+ * @return false Ответ 429 уже заполнен
+ */
+bool admit_request(const httplib::Request& req, httplib::Response& res) {
+    static MetricCounter& rejected_ip = getMetrics().counter("hsecloud_http_rate_limited_total",
+        "Requests rejected with 429 by the rate limiter.", "scope=\"ip\"");
+    static MetricCounter& rejected_token = getMetrics().counter("hsecloud_http_rate_limited_total",
+        "Requests rejected with 429 by the rate limiter.", "scope=\"token\"");
+
+    RateLimits& limits = getRateLimits();
+    t_download_shaper = {};
+    bool by_token = limits.token_requests.enabled() || limits.token_bytes.enabled();
+    std::string token = by_token ? request_token(req.path) : std::string();
+
+    double retry_after = 0;
+    bool limited = false;
+    if (limits.ip_requests.enabled() && !limits.ip_requests.admit(req.remote_addr, retry_after)) {
+        rejected_ip.add();
+        limited = true;
+    }
+    else if (!token.empty() && limits.token_requests.enabled() && !limits.token_requests.admit(token, retry_after)) {
+        rejected_token.add();
+        limited = true;
+    }
+    if (limited) {
+        res.status = 429;
+        res.set_header("Retry-After", std::to_string(std::max<int64_t>(1, static_cast<int64_t>(std::ceil(retry_after)))));
+        res.set_content("Too many requests.", "text/plain");
+        return false;
+    }
+
+    if (limits.ip_bytes.enabled()) {
+        t_download_shaper.ip = &limits.ip_bytes.bucket(req.remote_addr);
+    }
+    if (!token.empty() && limits.token_bytes.enabled()) {
+        t_download_shaper.token = &limits.token_bytes.bucket(token);
+    }
+    return true;
+}
+
+/**
+ * @brief Форматирование даты для HTTP заголовков (RFC 7231)
+ * 
+ * @param time Время в секундах с начала эпохи
+ * @return std::string Дата вида "Sun, 06 Nov 1994 08:49:37 GMT"
+ */
+std::string http_date(std::time_t time) {
+    std::tm tm{};
+#ifndef _WIN32
+    gmtime_r(&time, &tm);
+#else
+    gmtime_s(&tm, &time);
+#endif
+    char buffer[64];
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+/**
+ * @brief Получение общего кэша популярных файлов
+ * 
+ * @return HotFileCache& Кэш процесса (объём hot_cache_size, 0 — выключен)
+ */
+HotFileCache& getHotFileCache() {
+    static HotFileCache cache(getServerConfig().hot_cache_size, getServerConfig().hot_cache_max_file);
+    return cache;
+}
+
+/**
+ * @brief Размер, время изменения и идентификатор файла без его открытия
+ * 
+ * @param path Путь к файлу
+ * @param info Результат
+ * @return true Это обычный файл
+ */
+bool stat_file(const std::string& path, FileStat& info) {
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    info.size = static_cast<uint64_t>(st.st_size);
+    info.mtime = st.st_mtime;
+    info.identity = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+    return true;
+#else
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+        return false;
+    }
+    info.size = fs::file_size(path, ec);
+    info.mtime = to_time_t(fs::last_write_time(path, ec));
+    info.identity = path;
+    return !ec;
+#endif
+}
+
+/**
+ * @brief Чтение файла целиком через хранилище
+ * 
+ * @return std::shared_ptr<const std::string> Содержимое или nullptr, если размер изменился или чтение не удалось
+ */
+std::shared_ptr<const std::string> read_whole_file(const std::string& path, uint64_t size) {
+    auto file = getStorage().open(path, StorageMode::Read);
+    if (!file || file->size() != size) {
+        return nullptr;
+    }
+    auto body = std::make_shared<std::string>();
+    body->reserve(static_cast<size_t>(size));
+    const char* data;
+    size_t read;
+    while (body->size() < size) {
+        if (!file->read_chunk(body->size(), IO_BUFFER_SIZE, data, read) || read == 0) {
+            return nullptr;
+        }
+        body->append(data, read);
+    }
+    return body;
+}
+
+/**
+ * @brief Содержимое файла в нужном кодировании из кэша популярных файлов
+ * 
+ * Ключ кэша — inode, а не путь: одна и та же загрузка, разошедшаяся по многим
+ * ссылкам как жёсткие ссылки на блоб, занимает в кэше одно место. При промахе
+ * файл загружается в кэш, только если его допускает политика кэша: исходные
+ * байты читаются целиком, сжатый вариант берётся из готовой сжатой копии блоба
+ * или сжимается один раз.
+ * 
+ * @param file_path Путь к файлу
+ * @param encoding Кодирование ответа
+ * @param info Сведения о файле из stat_file
+ * @return std::shared_ptr<const std::string> Содержимое или nullptr, если файл отдаётся с диска
+ */
+std::shared_ptr<const std::string> cached_file_body(const std::string& file_path, ContentEncoding encoding, const FileStat& info) {
+    HotFileCache& cache = getHotFileCache();
+    uint64_t size = info.size;
+    std::time_t mtime = info.mtime;
+    if (!cache.enabled() || size == 0) {
+        return nullptr;
+    }
+    std::string key = info.identity + '\n' + encoding_name(encoding);
+    if (auto body = cache.get(key, size, mtime)) {
+        return body;
+    }
+    if (!cache.admit(key, size)) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const std::string> body;
+    if (encoding == ContentEncoding::Identity) {
+        body = read_whole_file(file_path, size);
+    }
+    else {
+        std::string hash = blob_hash_for(file_path);
+        std::string sidecar = hash.empty() ? std::string() : sidecar_path_for(hash, encoding);
+        FileStat sidecar_info;
+        if (!sidecar.empty() && stat_file(sidecar, sidecar_info) && sidecar_info.size > 0) {
+            body = read_whole_file(sidecar, sidecar_info.size);
+        }
+        else if (auto identity = read_whole_file(file_path, size)) {
+            StreamCompressor compressor(encoding, COMPRESS_SIDECAR_LEVEL);
+            auto compressed = std::make_shared<std::string>();
+            if (compressor.is_valid() && compressor.compress(identity->data(), identity->size(), true, *compressed)) {
+                body = std::move(compressed);
+            }
+        }
+    }
+    if (body) {
+        cache.put(key, size, mtime, body);
+    }
+    return body;
+}
+
+/**
+ * @brief Число байт, которые httplib отдаст по диапазонам Range
+ * 
+ * @param ranges Диапазоны запроса (-1 — граница не указана)
+ * @param size Размер файла
+ * @return uint64_t Сумма длин диапазонов в пределах файла
+ */
+uint64_t ranges_length(const httplib::Ranges& ranges, uint64_t size) {
+    uint64_t total = 0;
+    for (const auto& range : ranges) {
+        if (range.first < 0) {
+            total += std::min<uint64_t>(static_cast<uint64_t>(std::max<ssize_t>(range.second, 0)), size);
+        }
+        else if (static_cast<uint64_t>(range.first) < size) {
+            uint64_t last = range.second < 0 ? size - 1 : std::min<uint64_t>(static_cast<uint64_t>(range.second), size - 1);
+            total += last >= static_cast<uint64_t>(range.first) ? last - static_cast<uint64_t>(range.first) + 1 : 0;
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Отдача файла с поддержкой Range, ETag, Last-Modified и сжатия
+ * 
+ * Нарезку диапазонов (206, multipart/byteranges) выполняет httplib по запросу
+ * провайдера с известной длиной. If-Range с устаревшим валидатором отключает
+ * нарезку и возвращает файл целиком, совпавший If-None-Match даёт 304.
+ * Сжимаемые файлы без Range отдаются в кодировании из Accept-Encoding: готовой
+ * сжатой копией блоба, если она есть, иначе со сжатием «на лету». Популярные
+ * файлы отдаются из HotFileCache без обращения к диску.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param file_path Путь к файлу
+ * @param filename Имя файла для Content-Disposition
+ * @param admit Проверка перед отдачей тела (не вызывается для 304): получает число
+ *              байт файла в ответе и может отказать
+ * @return true Файл найден
+ * @return false Файл не найден, не открывается или admit отказал
+ */
+bool serve_file(const httplib::Request& req, httplib::Response& res, const std::string& file_path, const std::string& filename,
+                const std::function<bool(uint64_t)>& admit) {
+    FileStat info;
+    if (!stat_file(file_path, info)) {
+        return false;
+    }
+    uint64_t size = info.size;
+    std::time_t mtime = info.mtime;
+
+    std::string content_type = content_type_for(filename);
+    bool compressible = size >= COMPRESS_MIN_SIZE && is_compressible(content_type);
+    ContentEncoding encoding = compressible && req.ranges.empty() ? negotiate_encoding(req) : ContentEncoding::Identity;
+
+    // Сжатые варианты побайтно не совпадают между копией и сжатием «на лету», поэтому ETag слабый
+    std::stringstream etag;
+    if (encoding != ContentEncoding::Identity) {
+        etag << "W/";
+    }
+    etag << "\"" << std::hex << size << "-" << mtime;
+    if (encoding != ContentEncoding::Identity) {
+        etag << "-" << encoding_name(encoding);
+    }
+    etag << "\"";
+    std::string last_modified = http_date(mtime);
+    if (compressible) {
+        res.set_header("Vary", "Accept-Encoding");
+    }
+
+    res.set_header("ETag", etag.str());
+    res.set_header("Last-Modified", last_modified);
+    res.set_header("Accept-Ranges", "bytes");
+
+    if (req.has_header("If-None-Match") && req.get_header_value("If-None-Match") == etag.str()) {
+        res.status = 304;
+        return true;
+    }
+
+    if (!req.ranges.empty() && req.has_header("If-Range")) {
+        std::string if_range = req.get_header_value("If-Range");
+        if (if_range != etag.str() && if_range != last_modified) {
+            res.status = 200;
+        }
+    }
+
+    if (admit && req.method != "HEAD" && !admit(req.ranges.empty() || res.status == 200 ? size : ranges_length(req.ranges, size))) {
+        return false;
+    }
+
+    res.set_header("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+    if (size == 0) {
+        res.set_content("", content_type);
+        return true;
+    }
+
+    if (auto body = cached_file_body(file_path, encoding, info)) {
+        if (encoding != ContentEncoding::Identity) {
+            res.set_header("Content-Encoding", encoding_name(encoding));
+        }
+        res.set_content_provider(body->size(), content_type,
+            [body](size_t offset, size_t length, httplib::DataSink& sink) {
+                length = std::min(length, DOWNLOAD_CHUNK_SIZE);
+                account_download(length);
+                return sink.write(body->data() + offset, length);
+            });
+        return true;
+    }
+
+    auto file = std::make_shared<MappedFile>(file_path);
+    if (!file->is_valid()) {
+        return false;
+    }
+
+    if (encoding != ContentEncoding::Identity) {
+        std::string hash = blob_hash_for(file_path);
+        auto sidecar = std::make_shared<MappedFile>(hash.empty() ? std::string() : sidecar_path_for(hash, encoding));
+        if (sidecar->is_valid() && sidecar->size() > 0) {
+            res.set_header("Content-Encoding", encoding_name(encoding));
+            res.set_content_provider(sidecar->size(), content_type,
+                [sidecar](size_t offset, size_t length, httplib::DataSink& sink) {
+                    account_download(std::min(length, DOWNLOAD_CHUNK_SIZE));
+                    return sidecar->write_to(offset, length, sink);
+                });
+            return true;
+        }
+
+        auto compressor = std::make_shared<StreamCompressor>(encoding, COMPRESS_STREAM_LEVEL);
+        if (compressor->is_valid()) {
+            res.set_header("Content-Encoding", encoding_name(encoding));
+            auto position = std::make_shared<size_t>(0);
+            res.set_chunked_content_provider(content_type,
+                [file, compressor, position](size_t, httplib::DataSink& sink) {
+                    std::string out;
+                    bool finish = false;
+                    bool ok = file->with_chunk(*position, file->size() - *position, [&](const char* data, size_t length) {
+                        *position += length;
+                        finish = *position >= file->size();
+                        if (!compressor->compress(data, length, finish, out)) {
+                            return false;
+                        }
+                        account_download(out.size());
+                        return out.empty() || sink.write(out.data(), out.size());
+                    });
+                    if (ok && finish) {
+                        sink.done();
+                    }
+                    return ok;
+                });
+            return true;
+        }
+    }
+
+    res.set_content_provider(file->size(), content_type,
+        [file](size_t offset, size_t length, httplib::DataSink& sink) {
+            account_download(std::min(length, DOWNLOAD_CHUNK_SIZE));
+            return file->write_to(offset, length, sink);
+        });
+    return true;
+}
+
+/**
+ * @brief Отдача всей папки токена одним ZIP архивом
+ * 
+ * Архив передаётся chunked-ответом по мере сборки (см. ZipStream), поэтому
+ * Content-Length и Range не поддерживаются.
+ * 
+ * @param res HTTP ответ
+ * @param dir_path Папка токена
+ * @param archive_name Имя архива для Content-Disposition
+ * @param releaser Вызывается, когда отдача архива закончена (успешно или нет)
+ */
+void serve_folder_zip(httplib::Response& res, const std::string& dir_path, const std::string& archive_name,
+                      httplib::ContentProviderResourceReleaser releaser) {
+    auto zip = std::make_shared<ZipStream>(dir_path, get_files(dir_path));
+    res.set_header("Content-Disposition", "attachment; filename=\"" + archive_name + "\"");
+    res.set_chunked_content_provider("application/zip",
+        [zip](size_t, httplib::DataSink& sink) {
+            thread_local std::string out;
+            out.clear();
+            if (!zip->next(out)) {
+                return false;
+            }
+            account_download(out.size());
+            if (!out.empty() && !sink.write(out.data(), out.size())) {
+                return false;
+            }
+            if (zip->done()) {
+                sink.done();
+            }
+            return true;
+        },
+        std::move(releaser));
+}
+
+/**
+ * @brief Скачивание всех файлов анонимной ссылки ZIP архивом
+ * 
+ * Как и скачивание отдельного файла, расходует один раз лимит скачиваний ссылки.
+ * Файлы архива открываются по мере сборки, поэтому папка удерживается от
+ * сборщика до конца отдачи: последнее разрешённое скачивание сразу истекает ссылку.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_share_zip(const httplib::Request& req, httplib::Response& res) {
+    std::string token = req.matches[1].str();
+    ShareReaper& reaper = getShareReaper();
+    if (!getTokenIndex().contains(TokenKind::Send, token) || !reaper.hold(token)) {
+        res.set_content("Files not found", "text/plain");
+        res.status = 404;
+        return;
+    }
+    if (!record_share_download(token)) {
+        reaper.release(token);
+        res.set_content("Files not found", "text/plain");
+        res.status = 404;
+        return;
+    }
+    serve_folder_zip(res, token_folder(TokenKind::Send, token), token + ".zip",
+        [token](bool) { getShareReaper().release(token); });
+}
+
+/**
+ * @brief Обработка загрузки файла
+ * 
+ * Каждый ответ с телом расходует лимит скачиваний ссылки на число отданных байт
+ * (record_share_transfer); бесплатны только 304 и HEAD.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ */
+void handle_file_download(const httplib::Request& req, httplib::Response& res) {
+    std::string token = req.matches[1].str();
+    std::string filename = req.matches[2].str();
+    std::string file_path = token_folder(TokenKind::Send, token) + "/" + filename;
+
+    std::error_code ec;
+    if (!getTokenIndex().contains(TokenKind::Send, token) || sanitize_filename(filename) != filename ||
+        !fs::is_regular_file(file_path, ec) ||
+        !serve_file(req, res, file_path, filename, [&token](uint64_t bytes) { return record_share_transfer(token, bytes); })) {
+        res.set_content("File not found", "text/plain");
+        res.status = 404;
+    }
+}
+
+const std::string REPLICATION_PATH = BASE_PATH + "/replication";
+
+/**
+ * @brief Значение из таблицы replication_state
+ * 
+ * @param db Соединение
+ * @param key Ключ (acked, applied, seeded)
+ * @return int64_t Значение или 0, если его ещё нет
+ */
+int64_t replication_state(DbConnection& db, const std::string& key) {
+    SQLite::Statement& query = db.statement("SELECT value FROM replication_state WHERE key = ?");
+    query.bind(1, key);
+    int64_t value = query.executeStep() ? query.getColumn(0).getInt64() : 0;
+    query.tryReset();
+    return value;
+}
+
+/**
+ * @brief Запись значения в таблицу replication_state
+ */
+void set_replication_state(DbConnection& db, const std::string& key, int64_t value) {
+    SQLite::Statement& query = db.statement("INSERT OR REPLACE INTO replication_state (key, value) VALUES (?, ?)");
+    query.bind(1, key);
+    query.bind(2, value);
+    query.exec();
+    query.tryReset();
+}
+
+/**
+ * @brief Разбор записи очереди репликации на поля (обратно к replicate)
+ * 
+ * @param entry Запись
+ * @return std::vector<std::string> Операция и её аргументы
+ */
+std::vector<std::string> split_replication_entry(const std::string& entry) {
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < entry.size(); ++i) {
+        if (entry[i] == '\t') {
+            fields.emplace_back();
+        }
+        else if (entry[i] == '%' && i + 2 < entry.size() && hex_value(entry[i + 1]) >= 0 && hex_value(entry[i + 2]) >= 0) {
+            fields.back() += static_cast<char>(hex_value(entry[i + 1]) << 4 | hex_value(entry[i + 2]));
+            i += 2;
+        }
+        else {
+            fields.back() += entry[i];
+        }
+    }
+    return fields;
+}
+
+/**
+ * @brief Проверка, что строка — SHA-256 в шестнадцатеричном виде
+ */
+bool is_blob_hash(const std::string& value) {
+    return value.size() == 64 && std::all_of(value.begin(), value.end(),
+        [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+/**
+ * @brief Наличие блоба в хранилище узла
+ */
+bool has_blob(DbConnection& db, const std::string& hash) {
+    SQLite::Statement& find = db.statement("SELECT 1 FROM blobs WHERE hash = ?");
+    find.bind(1, hash);
+    bool found = find.executeStep();
+    find.tryReset();
+    std::error_code ec;
+    return found && fs::exists(blob_path_for(hash), ec);
+}
+
+/**
+ * @brief Получение общего отправителя изменений
+ * 
+ * @return Replicator& Отправитель процесса
+ */
+Replicator& getReplicator() {
+    static Replicator replicator;
+    return replicator;
+}
+
+/**
+ * @brief Список блобов, которых нет на ведомом узле
+ * 
+ * @param hashes Хеши, по одному в строке
+ * @return std::string Недостающие хеши, по одному в строке
+ */
+std::string replication_missing_blobs(const std::string& hashes) {
+    std::string missing;
+    std::istringstream lines(hashes);
+    std::string hash;
+    auto db = getDbPool().reader();
+    while (std::getline(lines, hash)) {
+        std::error_code ec;
+        if (is_blob_hash(hash) && !has_blob(*db, hash) && !fs::exists(REPLICATION_PATH + "/" + hash, ec)) {
+            missing += hash + "\n";
+        }
+    }
+    return missing;
+}
+
+/**
+ * @brief Применение одной записи на ведомом узле
+ * 
+ * Записи применяются повторно без вреда: файл с тем же блобом по тому же
+ * пути не переписывается, остальные операции — вставка или замена.
+ * 
+ * @param fields Операция и её аргументы
+ * @return true Запись применена (или неизвестна и пропущена)
+ * @return false Запись нельзя применить сейчас (например, нет блоба)
+ */
+bool apply_replication_entry(const std::vector<std::string>& fields) {
+    const std::string& op = fields[0];
+    try {
+        if (op == "user" && fields.size() == 3) {
+            {
+                auto db = getDbPool().writer();
+                SQLite::Statement& query = db->statement(
+                    "INSERT INTO users (id, token) VALUES (?, ?) ON CONFLICT(id) DO UPDATE SET token = excluded.token");
+                query.bind(1, static_cast<int64_t>(std::stoll(fields[1])));
+                query.bind(2, fields[2]);
+                query.exec();
+                query.tryReset();
+            }
+            getTokenIndex().add(TokenKind::User, fields[2]);
+            return true;
+        }
+        if (op == "folder" && fields.size() == 2) {
+            createFolderForUser(fields[1]);
+            return true;
+        }
+        if (op == "share" && fields.size() == 5) {
+            std::time_t expires = static_cast<std::time_t>(std::stoll(fields[3]));
+            {
+                auto db = getDbPool().writer();
+                SQLite::Statement& query = db->statement(
+                    "INSERT OR REPLACE INTO shares (token, created, expires, max_downloads, downloads, served_bytes) "
+                    "VALUES (?, ?, ?, ?, COALESCE((SELECT downloads FROM shares WHERE token = ?), 0), "
+                    "COALESCE((SELECT served_bytes FROM shares WHERE token = ?), 0))");
+                query.bind(1, fields[1]);
+                query.bind(2, static_cast<int64_t>(std::stoll(fields[2])));
+                query.bind(3, static_cast<int64_t>(expires));
+                query.bind(4, static_cast<int64_t>(std::stoll(fields[4])));
+                query.bind(5, fields[1]);
+                query.bind(6, fields[1]);
+                query.exec();
+                query.tryReset();
+            }
+            getTokenIndex().add(TokenKind::Send, fields[1]);
+            getShareReaper().schedule(fields[1], expires);
+            return true;
+        }
+        if (op == "expire" && fields.size() == 2) {
+            getShareReaper().expire_now(fields[1]);
+            return true;
+        }
+        if (op == "file" && fields.size() == 6) {
+            TokenKind kind = fields[1] == "user" ? TokenKind::User : TokenKind::Send;
+            const std::string& token = fields[2];
+            const std::string& name = fields[3];
+            const std::string& hash = fields[4];
+            uint64_t size = std::stoull(fields[5]);
+            if (sanitize_filename(name) != name || name.empty() || name[0] == '.' || !is_blob_hash(hash) ||
+                token.find_first_not_of(TOKEN_ALPHABET) != std::string::npos) {
+                logMessage(LogLevel::Warning, "Skipping malformed replicated file", { {"token", token}, {"name", name} });
+                return true;
+            }
+            std::string dir_path = token_folder(kind, token);
+            std::string final_path = dir_path + "/" + name;
+            {
+                auto db = getDbPool().reader();
+                SQLite::Statement& current = db->statement("SELECT hash FROM file_refs WHERE path = ?");
+                current.bind(1, relative_to_base(final_path));
+                bool same = current.executeStep() && current.getColumn(0).getText() == hash;
+                current.tryReset();
+                if (same) {
+                    return true;
+                }
+            }
+            fs::create_directories(dir_path);
+            uint64_t previous_size = existing_file_size(final_path);
+            // Принятый блоб передаётся как временный файл: он переносится в хранилище
+            // или удаляется, если такой блоб уже есть
+            if (!store_blob_reference(REPLICATION_PATH + "/" + hash, final_path, hash, size)) {
+                return false;
+            }
+            record_file_usage(final_path, previous_size, size);
+            getTokenIndex().add(kind, token);
+            getFolderCache().invalidate(dir_path);
+            return true;
+        }
+    }
+    catch (const std::exception& e) {
+        logMessage(LogLevel::Error, "Error applying replication entry: " + std::string(e.what()), { {"op", op} });
+        return false;
+    }
+    logMessage(LogLevel::Warning, "Unknown replication entry skipped", { {"op", op} });
+    return true;
+}
+
+/**
+ * @brief Применение пачки записей на ведомом узле
+ * 
+ * Записи с seq не больше уже применённого пропускаются, поэтому повтор пачки
+ * после потерянного ответа безопасен. Применение останавливается на первой
+ * записи, которую нельзя применить.
+ * 
+ * @param entries Записи "<seq>\t<запись>\n"
+ * @return int64_t Наибольший применённый seq
+ */
+int64_t apply_replication_log(const std::string& entries) {
+    int64_t applied = 0;
+    {
+        auto db = getDbPool().reader();
+        applied = replication_state(*db, "applied");
+    }
+    int64_t start = applied;
+    std::istringstream lines(entries);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            continue;
+        }
+        int64_t seq = 0;
+        try {
+            seq = std::stoll(line.substr(0, tab));
+        }
+        catch (const std::exception&) {
+            break;
+        }
+        if (seq <= applied) {
+            continue;
+        }
+        if (!apply_replication_entry(split_replication_entry(line.substr(tab + 1)))) {
+            break;
+        }
+        applied = seq;
+    }
+    if (applied != start) {
+        try {
+            auto db = getDbPool().writer();
+            set_replication_state(*db, "applied", applied);
+        }
+        catch (const std::exception& e) {
+            logMessage(LogLevel::Error, "Error saving replication position: " + std::string(e.what()));
+        }
+    }
+    return applied;
+}
+
+/**
+ * @brief Проверка общего секрета в запросе к маршрутам /replication/
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ, заполняется при отказе
+ * @return true Запрос от ведущего узла
+ */
+bool check_replication_secret(const httplib::Request& req, httplib::Response& res) {
+    const std::string& secret = getServerConfig().replication_secret;
+    std::string given = req.get_header_value("X-Replication-Secret");
+    if (secret.empty() || given.size() != secret.size() || CRYPTO_memcmp(given.data(), secret.data(), secret.size()) != 0) {
+        res.status = 403;
+        res.set_content("Forbidden.", "text/plain");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Приём блоба от ведущего узла
+ * 
+ * Блоб пишется во временный файл в REPLICATION_PATH и сохраняется под своим
+ * хешем только после проверки SHA-256.
+ * 
+ * @param req HTTP запрос
+ * @param res HTTP ответ
+ * @param content_reader Читатель тела запроса
+ */
+void handle_replication_blob(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+    if (!check_replication_secret(req, res)) {
+        return;
+    }
+    std::string hash = req.matches[1].str();
+    if (!is_blob_hash(hash)) {
+        res.status = 400;
+        res.set_content("Invalid hash.", "text/plain");
+        return;
+    }
+    std::error_code ec;
+    fs::create_directories(REPLICATION_PATH, ec);
+    std::string temp_path = REPLICATION_PATH + "/." + hash + "." + generate_send_token(8) + ".part";
+    auto file = getStorage().open(temp_path, StorageMode::Write);
+    Sha256 digest;
+    uint64_t written = 0;
+    bool ok = file && content_reader([&](const char* data, size_t length) {
+        digest.update(data, length);
+        if (!file->write_at(written, data, length)) {
+            return false;
+        }
+        written += length;
+        return true;
+    });
+    ok = ok && file->flush();
+    file.reset();
+    if (ok && digest.hex_digest() == hash) {
+        fs::rename(temp_path, REPLICATION_PATH + "/" + hash, ec);
+        ok = !ec;
+    }
+    else {
+        ok = false;
+    }
+    if (!ok) {
+        fs::remove(temp_path, ec);
+        res.status = 422;
+        res.set_content("Blob rejected.", "text/plain");
+        return;
+    }
+    res.set_content("OK", "text/plain");
+}
+
+/**
+ * @brief Подготовка узла к репликации при запуске
+ * 
+ * Ведущий ставит в очередь накопленное состояние (один раз) и запускает
+ * отправку. Ведомый удаляет недоприменённые блобы: ведущий передаст их снова.
+ */
+void startReplication() {
+    const ServerConfig& config = getServerConfig();
+    if (is_replication_leader()) {
+        if (config.replication_peer.empty() || config.replication_secret.empty()) {
+            logMessage(LogLevel::Error, "replication_peer and replication_secret are required for the leader role");
+            return;
+        }
+        getReplicator().seed();
+        getReplicator().start(std::make_unique<HttpReplicationPeer>(config.replication_peer, config.replication_secret));
+        logMessage(LogLevel::Info, "Replicating to peer", { {"peer", config.replication_peer} });
+    }
+    else if (is_replication_follower()) {
+        std::error_code ec;
+        fs::remove_all(REPLICATION_PATH, ec);
+        fs::create_directories(REPLICATION_PATH, ec);
+        if (config.replication_secret.empty()) {
+            logMessage(LogLevel::Error, "replication_secret is not set, replication requests will be rejected");
+        }
+        logMessage(LogLevel::Info, "Running as a read-only replica");
+    }
+}
+
+/**
+ * @brief Обёртка обработчика маршрута, записывающая его метрики
+ * 
+ * @param method HTTP метод для метки method
+ * @param route Шаблон маршрута для метки route
+ * @param handler Обработчик
+ * @return httplib::Server::Handler Обработчик с замером длительности и подсчётом ответов
+ */
+httplib::Server::Handler instrument(const std::string& method, const std::string& route, httplib::Server::Handler handler) {
+    auto metrics = std::make_shared<RouteMetrics>(method, route);
+    return [metrics, handler](const httplib::Request& req, httplib::Response& res) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            handler(req, res);
+        }
+        catch (...) {
+            metrics->record(start, 500);
+            throw;
+        }
+        metrics->record(start, res.status);
+    };
+}
+
+/**
+ * @brief Обёртка обработчика маршрута с потоковым чтением тела, записывающая его метрики
+ */
+httplib::Server::HandlerWithContentReader instrument(const std::string& method, const std::string& route,
+                                                     httplib::Server::HandlerWithContentReader handler) {
+    auto metrics = std::make_shared<RouteMetrics>(method, route);
+    return [metrics, handler](const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+            handler(req, res, content_reader);
+        }
+        catch (...) {
+            metrics->record(start, 500);
+            throw;
+        }
+        metrics->record(start, res.status);
+    };
+}
+
+/**
+ * @brief Регистрация показателей, которые читаются из состояния процесса
+ */
+void registerProcessMetrics() {
+    MetricsRegistry& metrics = getMetrics();
+    metrics.gauge("hsecloud_log_dropped_messages", "Log messages dropped because the log queue was full.",
+        [] { return static_cast<double>(getDroppedLogMessages()); });
+    metrics.gauge("hsecloud_user_tokens", "Active user tokens.",
+        [] { return static_cast<double>(getTokenIndex().size(TokenKind::User)); });
+    metrics.gauge("hsecloud_send_tokens", "Active share tokens.",
+        [] { return static_cast<double>(getTokenIndex().size(TokenKind::Send)); });
+    metrics.gauge("hsecloud_hot_cache_bytes", "Bytes held by the in-memory file cache.",
+        [] { return static_cast<double>(getHotFileCache().bytes()); });
+    metrics.gauge("hsecloud_hot_cache_entries", "Files held by the in-memory file cache.",
+        [] { return static_cast<double>(getHotFileCache().entries()); });
+    if (is_replication_leader()) {
+        metrics.gauge("hsecloud_replication_pending_entries", "Replication entries not yet acknowledged by the peer.",
+            [] { return static_cast<double>(getReplicator().pending()); });
+    }
+}
+
+/**
+ * @brief Настройка маршрутов и параметров HTTP сервера
+ * 
+ * @param svr Сервер
+ */
+void setupServer(httplib::Server& svr) {
+    const ServerConfig& config = getServerConfig();
+    svr.new_task_queue = [&config] {
+        return new BoundedTaskQueue(config.worker_threads, config.max_queued_requests);
+    };
+    svr.set_keep_alive_max_count(config.keep_alive_max_count);
+    svr.set_keep_alive_timeout(config.keep_alive_timeout);
+    svr.set_read_timeout(config.read_timeout);
+    svr.set_write_timeout(config.write_timeout);
+    svr.set_payload_max_length(config.max_upload_size);
+
+    registerProcessMetrics();
+    static MetricCounter& overloaded = getMetrics().counter("hsecloud_http_overloaded_total", "Requests rejected with 503 because the request queue was full.");
+
+    svr.set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        if (t_server_overloaded) {
+            overloaded.add();
+            res.status = 503;
+            res.set_header("Retry-After", "1");
+            res.set_header("Connection", "close");
+            res.set_content("Server is overloaded.", "text/plain");
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        if (!admit_request(req, res)) {
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        // Ведомый узел только отдаёт файлы, изменения приходят от ведущего
+        if (is_replication_follower() && req.method != "GET" && req.method != "HEAD" && req.path.rfind("/replication/", 0) != 0) {
+            res.status = 403;
+            res.set_content("Read-only replica.", "text/plain");
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+
+    if (is_replication_follower()) {
+        svr.Post("/replication/missing", [](const httplib::Request& req, httplib::Response& res) {
+            if (check_replication_secret(req, res)) {
+                res.set_content(replication_missing_blobs(req.body), "text/plain");
+            }
+        });
+        svr.Put(R"(/replication/blob/([0-9a-f]+))", handle_replication_blob);
+        svr.Post("/replication/log", [](const httplib::Request& req, httplib::Response& res) {
+            if (check_replication_secret(req, res)) {
+                res.set_content(std::to_string(apply_replication_log(req.body)), "text/plain");
+            }
+        });
+    }
+
+    svr.Get("/metrics", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(getMetrics().render(), "text/plain; version=0.0.4");
+    });
+
+    svr.Get("/", instrument("GET", "/", [](const httplib::Request& req, httplib::Response& res) {
+        serve_static_page(req, res, "index.html");
+        logMessage(LogLevel::Debug, "Served index.html");
+    }));
+
+    svr.Get(R"(/files/(.*))", instrument("GET", "/files/<token>", [](const httplib::Request& req, httplib::Response& res) {
+        std::string token = req.matches[1].str();
+        if (validate_token(token)) {
+            auto files = get_files(token_folder(TokenKind::User, token));
+            thread_local std::string file_list_html;
+            file_list_html.clear();
+            generate_file_list_html(*files, "/download/" + token + "/", file_list_html);
+            set_compressed_content(req, res, file_list_html, "text/html");
+        }
+        else {
+            res.set_content("Invalid token.", "text/plain");
+        }
+    }));
+
+    svr.Get(R"(/api/files/([0-9A-Za-z]+))", instrument("GET", "/api/files/<token>", [](const httplib::Request& req, httplib::Response& res) {
+        handle_file_listing(req, res, TokenKind::User);
+    }));
+    svr.Get(R"(/api/sendfile/([0-9A-Za-z]+))", instrument("GET", "/api/sendfile/<token>", [](const httplib::Request& req, httplib::Response& res) {
+        handle_file_listing(req, res, TokenKind::Send);
+    }));
+
+    // Сессии не должны лежать под /upload/: httplib проверяет POST обработчики с ContentReader
+    // раньше обычных независимо от порядка регистрации, и /upload/<token> перехватил бы их
+    svr.Post("/api/upload/session", instrument("POST", "/api/upload/session", handle_upload_session_create));
+    svr.Put(R"(/api/upload/session/([0-9A-Za-z]+))", instrument("PUT", "/api/upload/session/<id>", handle_upload_chunk));
+    svr.Get(R"(/api/upload/session/([0-9A-Za-z]+))", instrument("GET", "/api/upload/session/<id>", handle_upload_session_status));
+    svr.Post(R"(/api/upload/session/([0-9A-Za-z]+)/finalize)", instrument("POST", "/api/upload/session/<id>/finalize", handle_upload_session_finalize));
+
+    svr.Get(R"(/api/signature/([0-9A-Za-z]+)/(.+))", instrument("GET", "/api/signature/<token>/<file>", handle_file_signature));
+    svr.Post(R"(/api/delta/([0-9A-Za-z]+)/(.+))", instrument("POST", "/api/delta/<token>/<file>", handle_delta_upload));
+
+    svr.Post(R"(/upload/([0-9A-Za-z]+))", instrument("POST", "/upload/<token>", [](const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+        std::string token = req.matches[1].str();
+        if (!validate_token(token)) {
+            res.status = 403;
+            res.set_header("Connection", "close");
+            res.set_content("Invalid token.", "text/plain");
+            return;
+        }
+        std::string dir_path = token_folder(TokenKind::User, token);
+        if (!check_upload_request(req, res, dir_path)) {
+            return;
+        }
+
+        std::error_code ec;
+        fs::create_directories(dir_path, ec);
+
+        std::vector<std::string> filenames;
+        uint64_t expected_size = req.has_header("Content-Length") ? req.get_header_value_u64("Content-Length") : 0;
+        UploadResult result = receive_multipart_files(content_reader, dir_path, filenames, expected_size);
+        if (result == UploadResult::QuotaExceeded) {
+            reject_over_quota(res);
+            return;
+        }
+        if (result != UploadResult::Ok) {
+            res.status = 500;
+            res.set_content("File upload failed.", "text/plain");
+            return;
+        }
+        res.set_content("File uploaded successfully.", "text/plain");
+        for (const auto& filename : filenames) {
+            logMessage("File uploaded for token: " + token + ", File: " + filename);
+        }
+    }));
+
+    svr.Get(R"(/download/([0-9A-Za-z]+)\.zip)", instrument("GET", "/download/<token>.zip", [](const httplib::Request& req, httplib::Response& res) {
+        std::string token = req.matches[1].str();
+        if (!validate_token(token)) {
+            res.status = 404;
+            res.set_content("File not found.", "text/plain");
+            return;
+        }
+        serve_folder_zip(res, token_folder(TokenKind::User, token), token + ".zip");
+    }));
+
+    svr.Get(R"(/download/(.*)/(.*))", instrument("GET", "/download/<token>/<file>", [](const httplib::Request& req, httplib::Response& res) {
+        std::string token = req.matches[1].str();
+        std::string file_name = req.matches[2].str();
+        std::string file_path = token_folder(TokenKind::User, token) + "/" + file_name;
+
+        if (!validate_token(token) || sanitize_filename(file_name) != file_name ||
+            !serve_file(req, res, file_path, file_name)) {
+            res.status = 404;
+            res.set_content("File not found.", "text/plain");
+        }
+    }));
+
+    svr.Get("/sendfile", instrument("GET", "/sendfile", [](const httplib::Request& req, httplib::Response& res) {
+        serve_static_page(req, res, "sendfiles.html");
+    }));
+
+    svr.Post("/upload", instrument("POST", "/upload", handle_file_upload));
+    svr.Get(R"(/sendfile/([0-9A-Za-z]+)\.zip)", instrument("GET", "/sendfile/<token>.zip", handle_share_zip));
+    svr.Get(R"(/sendfile/([0-9A-Za-z]+))", instrument("GET", "/sendfile/<token>", handle_file_download_page));
+    svr.Get(R"(/sendfile/([0-9A-Za-z]+)/(.+))", instrument("GET", "/sendfile/<token>/<file>", handle_file_download));
+}
+
+/**
+ * @brief Запуск сервера
+ */
+void startServer() {
+    const ServerConfig& config = getServerConfig();
+    for (const auto& warning : config.warnings) {
+        logMessage(LogLevel::Warning, warning);
+    }
+
+    httplib::Server svr;
+    setupServer(svr);
+
+    logMessage(LogLevel::Info, "Server started", {
+        {"host", config.host}, {"port", std::to_string(config.port)},
+        {"worker_threads", std::to_string(config.worker_threads)},
+        {"max_queued_requests", std::to_string(config.max_queued_requests)},
+        {"cpu_threads", std::to_string(config.cpu_threads)}
+    });
+    svr.listen(config.host, config.port);
+}
+
+/**
+ * @brief Гистограмма длительности обработчика бота
+ * 
+ * @param handler Команда или данные кнопки
+ * @return LatencyHistogram& Гистограмма hsecloud_bot_handler_duration_seconds
+ */
+LatencyHistogram& bot_handler_histogram(const std::string& handler) {
+    return getMetrics().histogram("hsecloud_bot_handler_duration_seconds", "Bot update handler latency.", "handler=\"" + handler + "\"");
+}
+
+/**
+ * @brief Обработка команды /start
+ * 
+ * @param outbox Очередь исходящих сообщений
+ * @param message Сообщение с командой
+ */
+void handleStartCommand(TelegramOutbox& outbox, const TgBot::Message::Ptr& message) {
+    static LatencyHistogram& latency = bot_handler_histogram("start");
+    ScopedTimer timer(latency);
+    addUserToDatabase(message->chat->id);
+
+    std::string token = getUserToken(message->chat->id);
+    std::string responseMessage = "Welcome to Cloud Storage Bot! Here you can upload and manage your files.";
+    if (!token.empty()) {
+        responseMessage += "\n\nYour current token: " + token;
+    }
+    else {
+        responseMessage += "\n\nYou do not have a token yet. Please generate one.";
+    }
+
+    TgBot::InlineKeyboardMarkup::Ptr keyboard(new TgBot::InlineKeyboardMarkup);
+    std::vector<TgBot::InlineKeyboardButton::Ptr> row;
+
+    TgBot::InlineKeyboardButton::Ptr tokenButton(new TgBot::InlineKeyboardButton);
+    tokenButton->text = "Token";
+    tokenButton->callbackData = "token";
+    row.push_back(tokenButton);
+
+    TgBot::InlineKeyboardButton::Ptr uploadButton(new TgBot::InlineKeyboardButton);
+    uploadButton->text = "Upload";
+    uploadButton->callbackData = "upload";
+    row.push_back(uploadButton);
+
+    TgBot::InlineKeyboardButton::Ptr sendButton(new TgBot::InlineKeyboardButton);
+    sendButton->text = "Send";
+    sendButton->callbackData = "send";
+    row.push_back(sendButton);
+
+    keyboard->inlineKeyboard.push_back(row);
+
+    outbox.send(message->chat->id, responseMessage, keyboard);
+    logMessage("Sent welcome message to user. UserID: " + std::to_string(message->chat->id));
+}
+
+/**
+ * @brief Обработка нажатий на кнопки бота
+ * 
+ * @param outbox Очередь исходящих сообщений
+ * @param query Callback-запрос
+ */
+void handleCallbackQuery(TelegramOutbox& outbox, const TgBot::CallbackQuery::Ptr& query) {
+    static const std::unordered_map<std::string, LatencyHistogram*> BRANCHES = [] {
+        std::unordered_map<std::string, LatencyHistogram*> branches;
+        for (const char* name : { "token", "confirm_yes", "confirm_no", "upload", "send" }) {
+            branches[name] = &bot_handler_histogram(name);
+        }
+        return branches;
+    }();
+    static LatencyHistogram& other = bot_handler_histogram("other");
+    auto branch = BRANCHES.find(query->data);
+    ScopedTimer timer(branch != BRANCHES.end() ? *branch->second : other);
+    if (query->data == "token") {
+        TgBot::InlineKeyboardMarkup::Ptr keyboard(new TgBot::InlineKeyboardMarkup);
+        std::vector<TgBot::InlineKeyboardButton::Ptr> rowYesNo;
+
+        TgBot::InlineKeyboardButton::Ptr yesButton(new TgBot::InlineKeyboardButton);
+        yesButton->text = "Yes";
+        yesButton->callbackData = "confirm_yes";
+        rowYesNo.push_back(yesButton);
+
+        TgBot::InlineKeyboardButton::Ptr noButton(new TgBot::InlineKeyboardButton);
+        noButton->text = "No";
+        noButton->callbackData = "confirm_no";
+        rowYesNo.push_back(noButton);
+
+        keyboard->inlineKeyboard.push_back(rowYesNo);
+
+        outbox.send(query->message->chat->id, "Are you sure you want to generate a new token?", keyboard);
+        logMessage("Sent token generation confirmation to user. UserID: " + std::to_string(query->message->chat->id));
+    }
+    else if (query->data == "confirm_yes") {
+        std::string newToken = generateToken();
+        updateUserToken(query->message->chat->id, newToken);
+        outbox.send(query->message->chat->id, "Your new token is: " + newToken);
+        logMessage("Generated new token for user. UserID: " + std::to_string(query->message->chat->id));
+    }
+    else if (query->data == "confirm_no") {
+        outbox.send(query->message->chat->id, "Token generation cancelled. Returning to menu.");
+        logMessage("Token generation cancelled by user. UserID: " + std::to_string(query->message->chat->id));
+    }
+    else if (query->data == "upload") {
+        std::string token = getUserToken(query->message->chat->id);
+        if (token.empty()) {
+            outbox.send(query->message->chat->id, "You do not have a token yet. Please generate one.");
+            logMessage("User attempted to upload without token. UserID: " + std::to_string(query->message->chat->id));
+        }
+        else {
+            createFolderForUser(token);
+            outbox.send(query->message->chat->id, "Folder created for your token.");
+
+            TgBot::InlineKeyboardMarkup::Ptr keyboard(new TgBot::InlineKeyboardMarkup);
+            std::vector<TgBot::InlineKeyboardButton::Ptr> row;
+
+            TgBot::InlineKeyboardButton::Ptr webAppButton(new TgBot::InlineKeyboardButton);
+            webAppButton->text = "Open WebApp";
+            webAppButton->url = "https://monthly-relaxed-molly.ngrok-free.app";
+            row.push_back(webAppButton);
+
+            keyboard->inlineKeyboard.push_back(row);
+
+            outbox.send(query->message->chat->id, "Click the button below to open the web application.", keyboard);
+            logMessage("Sent web app link to user. UserID: " + std::to_string(query->message->chat->id));
+        }
+    }
+    else if (query->data == "send") {
+        TgBot::InlineKeyboardMarkup::Ptr keyboard(new TgBot::InlineKeyboardMarkup);
+        std::vector<TgBot::InlineKeyboardButton::Ptr> row;
+
+        TgBot::InlineKeyboardButton::Ptr webAppButton(new TgBot::InlineKeyboardButton);
+        webAppButton->text = "Open WebApp";
+        webAppButton->url = "https://monthly-relaxed-molly.ngrok-free.app/sendfile";
+        row.push_back(webAppButton);
+
+        keyboard->inlineKeyboard.push_back(row);
+
+        outbox.send(query->message->chat->id, "Click the button below to open the web application.", keyboard);
+        logMessage("Sent web app link to user. UserID: " + std::to_string(query->message->chat->id));
+    }
+    outbox.answerCallbackQuery(query->id);
+}
@@ -0,0 +1,5247 @@
+/**
+ * @file cloudhse.h
+ * @brief Библиотека сервера: хранилище, токены, HTTP обработчики и Telegram бот.
+ * 
+ * Определения функций находятся в cloudhse.cpp. Программа (main.cpp), бенчмарки
+ * и утилиты подключают этот заголовок и компонуются с библиотекой cloudhse.
+ * 
+ * Используемые библиотеки:
+ * - TgBot: Библиотека для работы с Telegram Bot API. Используется для управления ботом и обработки событий.
+ * - SQLiteCpp: Библиотека для работы с базой данных SQLite. Используется для хранения данных пользователей и токенов.
+ * - httplib: Библиотека для создания HTTP сервера. Используется для обработки загрузок и загрузок файлов.
+ * - <filesystem>: Используется для работы с файловой системой.
+ * - <thread>: Используется для запуска сервера в отдельном потоке.
+ * - <fstream>: Используется для работы с файловыми потоками.
+ * - <sstream>: Используется для работы с потоками строк.
+ * - <ctime>, <chrono>: Используются для получения текущего времени для логирования.
+ * - <atomic>: Используется для lock-free очереди журнала.
+ * - OpenSSL: Используется для подсчёта SHA-256 загружаемых файлов и генерации токенов (RAND_bytes).
+ * - zlib, zstd (при HAVE_ZSTD): Используются для сжатия ответов.
+ * 
+ * Основные функции:
+ * - getCurrentDir: Получение текущего рабочего каталога.
+ * - formatLogLine: Форматирование строки журнала.
+ * - AsyncLogger: Асинхронный журнал с фоновой записью и ротацией.
+ * - ServerConfig / getServerConfig: Настройки сервера из server.conf и переменных окружения.
+ * - logMessage: Логирование сообщений.
+ * - flushLog: Ожидание записи журнала на диск.
+ * - MetricCounter / LatencyHistogram / MetricsRegistry: Метрики и вывод в формате Prometheus.
+ * - DbConnection: Соединение с базой данных с кэшем подготовленных запросов.
+ * - DbPool: Пул соединений с базой данных (один писатель, несколько читателей).
+ * - getDbPool: Получение общего пула соединений.
+ * - TokenIndex: Индекс активных токенов в памяти.
+ * - getTokenIndex: Получение общего индекса токенов.
+ * - initDatabase: Инициализация базы данных.
+ * - addUserToDatabase: Добавление пользователя в базу данных.
+ * - fill_random_token / random_token / generate_unique_token: Генерация токенов из CSPRNG.
+ * - generateToken: Генерация случайного токена.
+ * - updateUserToken: Обновление токена пользователя в базе данных.
+ * - getUserToken: Получение токена пользователя из базы данных.
+ * - token_folder / for_each_token_folder: Шардированное размещение папок токенов на диске.
+ * - loadTokenIndex: Заполнение индекса токенов из базы данных и папок.
+ * - createFolderForUser: Создание папки для хранения файлов пользователя.
+ * - content_type_for: Определение MIME-типа по расширению файла.
+ * - FolderCache: Кэш содержимого папок и порядков сортировки с инвалидацией через inotify.
+ * - get_files: Получение списка файлов в папке.
+ * - validate_token: Проверка валидности токена.
+ * - generate_file_list_html: Генерация HTML списка файлов.
+ * - generate_send_token: Генерация токена для отправки файла.
+ * - json_escape: Экранирование строки для JSON.
+ * - sanitize_filename: Очистка имени загружаемого файла.
+ * - Sha256: Подсчёт SHA-256 по мере поступления данных.
+ * - store_blob_reference: Сохранение файла в хранилище блобов с дедупликацией.
+ * - store_plain_file: Сохранение файла в обход хранилища блобов при ошибке.
+ * - negotiate_encoding / StreamCompressor / set_compressed_content: Сжатие ответов gzip/zstd.
+ * - schedule_precompression: Фоновое создание сжатых копий блобов.
+ * - collectGarbageBlobs: Удаление блобов без ссылок.
+ * - add_folder_usage / quota_remaining / reconcileUsage: Учёт занятого места и квоты папок.
+ * - reserve_folder_quota / release_folder_quota: Резервирование квоты под идущие загрузки.
+ * - ShareReaper / register_share / record_share_transfer / loadShares: Сроки жизни и лимиты скачиваний анонимных ссылок (по отданным байтам).
+ * - StorageBackend / PosixStorage / UringStorage / getStorage: Ввод-вывод хранилища (POSIX или io_uring с кольцом на поток и общим пулом буферов).
+ * - UploadFile: Потоковая запись загружаемого файла во временный файл.
+ * - receive_multipart_files: Потоковый приём файлов из multipart-запроса.
+ * - handle_file_upload: Обработка загрузки файла.
+ * - UploadSession: Сессия загрузки файла по частям.
+ * - UploadWriters / getUploadWriters: Учёт записей фрагментов, чтобы завершение сессии не шло параллельно с ними.
+ * - handle_upload_session_create / handle_upload_chunk / handle_upload_session_status /
+ *   handle_upload_session_finalize: Протокол загрузки по частям с докачкой.
+ * - DeltaPatch / handle_file_signature / handle_delta_upload: Дельта-загрузка изменённых файлов по подписям блоков.
+ * - cleanupUploadSessions: Очистка просроченных сессий загрузки.
+ * - TemplateStore / serve_static_page: HTML страницы и шаблоны в памяти с ETag и 304.
+ * - handle_file_download_page: Обработка страницы загрузки файлов.
+ * - handle_file_listing: JSON листинг папки с сортировкой, фильтром и курсором.
+ * - RateLimiter / admit_request / account_download: Ограничение скорости запросов и отдачи по IP и токену (429).
+ * - MappedFile: Отображение файла в память для отдачи без копирования.
+ * - http_date: Форматирование даты для HTTP заголовков.
+ * - HotFileCache / cached_file_body: Кэш популярных файлов в памяти (SLRU с допуском TinyLFU).
+ * - serve_file: Отдача файла с поддержкой Range, ETag и Last-Modified.
+ * - handle_file_download: Обработка загрузки файла.
+ * - Replicator / apply_replication_log / startReplication: Асинхронная репликация файлов и метаданных на ведомый узел.
+ * - ZipStream / serve_folder_zip / handle_share_zip: Потоковая отдача папки ZIP архивом.
+ * - BoundedTaskQueue: Очередь соединений с ограничением и ответом 503 при перегрузке.
+ * - CpuPool: Пул потоков с перехватом задач для вычислительной работы.
+ * - RouteMetrics / instrument: Метрики маршрутов HTTP сервера.
+ * - setupServer: Настройка маршрутов и параметров HTTP сервера (включая GET /metrics).
+ * - startServer: Запуск HTTP сервера.
+ * - TelegramOutbox: Очередь исходящих сообщений бота с учётом лимитов Telegram.
+ * - UpdateDispatcher: Асинхронная обработка обновлений бота с сохранением порядка в чате.
+ * - handleStartCommand / handleCallbackQuery: Обработчики команд и кнопок бота.
+ */
+
+#ifndef CLOUDHSE_H
+#define CLOUDHSE_H
+
+#include <tgbot/tgbot.h>
+#include <iostream>
+#include <memory>
+#include <filesystem>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <httplib.h>
+#include <ctime>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <array>
+#include <map>
+#include <functional>
+#include <deque>
+#include <list>
+#include <queue>
+#include <future>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define SQLITECPP_COMPILE_DLL
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace fs = std::filesystem;
+
+std::string getCurrentDir();
+
+extern const std::string BASE_PATH;
+extern const std::string DB_PATH;
+extern const std::string HTML_PATH;
+extern const std::string LOG_PATH;
+extern const std::string BLOB_PATH;
+extern const std::string UPLOADS_PATH;
+
+/**
+ * @brief Максимальный размер тела запроса на загрузку файлов по умолчанию (в байтах)
+ */
+const size_t MAX_UPLOAD_SIZE = size_t(4) * 1024 * 1024 * 1024;
+
+/**
+ * @brief Число символов токена на один уровень шардирования папок
+ */
+const size_t SHARD_WIDTH = 2;
+
+/**
+ * @brief Наибольшая допустимая глубина шардирования
+ */
+const size_t MAX_SHARD_DEPTH = 3;
+
+/**
+ * @brief Настройки HTTP сервера
+ * 
+ * Значения по умолчанию переопределяются файлом server.conf в BASE_PATH
+ * (строки вида "ключ = значение", # — комментарий), а затем переменными
+ * окружения HSECLOUD_<КЛЮЧ> (например, HSECLOUD_WORKER_THREADS).
+ */
+struct ServerConfig {
+    std::string host = "0.0.0.0";
+    int port = 8080;
+    size_t worker_threads = std::max<size_t>(8, std::thread::hardware_concurrency());  ///< Потоки обработки соединений
+    size_t max_queued_requests = 256;       ///< Очередь соединений, сверх неё — 503
+    size_t keep_alive_max_count = 100;      ///< Запросов на одно keep-alive соединение
+    time_t keep_alive_timeout = 5;          ///< Простой keep-alive соединения (с)
+    time_t read_timeout = 30;               ///< Таймаут чтения (с)
+    time_t write_timeout = 30;              ///< Таймаут записи (с)
+    size_t max_upload_size = MAX_UPLOAD_SIZE;   ///< Максимальный размер тела запроса (байт)
+    size_t cpu_threads = std::max<size_t>(2, std::thread::hardware_concurrency() / 2);   ///< Потоки CpuPool
+    size_t cpu_queue = 1024;                ///< Очередь задач CpuPool
+    bool template_reload = false;           ///< Перечитывать изменённые HTML шаблоны без перезапуска
+    uint64_t user_quota = uint64_t(10) * 1024 * 1024 * 1024;   ///< Квота папки пользователя по умолчанию (байт, 0 — без ограничения)
+    size_t usage_scan_interval = 3600;      ///< Период пересчёта занятого места (с)
+    size_t shard_depth = 0;                 ///< Уровней папок files/ab/cd/<token> (0 — плоское дерево)
+    uint64_t hot_cache_size = 256 * 1024 * 1024;   ///< Объём кэша популярных файлов (байт, 0 — выключен)
+    uint64_t hot_cache_max_file = 8 * 1024 * 1024; ///< Наибольший файл, который кладётся в кэш (байт)
+    std::string io_backend = "posix";       ///< Ввод-вывод хранилища: posix или uring
+    size_t io_queue_depth = 4;              ///< Буферов и операций в полёте на файл для uring
+    bool io_direct = false;                 ///< O_DIRECT для записи загрузок (только uring)
+    uint64_t share_ttl = 7 * 24 * 3600;     ///< Срок жизни анонимной ссылки по умолчанию (с)
+    uint64_t share_max_ttl = 30 * 24 * 3600;   ///< Максимальный срок жизни, который можно запросить (с)
+    double rate_limit_ip = 0;               ///< Запросов в секунду с одного IP (0 — без ограничения)
+    double rate_limit_ip_burst = 50;        ///< Запросов подряд с одного IP сверх скорости
+    double rate_limit_token = 0;            ///< Запросов в секунду к одному токену (0 — без ограничения)
+    double rate_limit_token_burst = 50;     ///< Запросов подряд к одному токену сверх скорости
+    uint64_t bandwidth_ip = 0;              ///< Скорость отдачи файлов на один IP (байт/с, 0 — без ограничения)
+    uint64_t bandwidth_token = 0;           ///< Скорость отдачи файлов одного токена (байт/с, 0 — без ограничения)
+    std::string replication_role;           ///< Роль в репликации: пусто (выключена), leader или follower
+    std::string replication_peer;           ///< Адрес ведомого узла для leader, например http://10.0.0.2:8080
+    std::string replication_secret;         ///< Общий секрет узлов (заголовок X-Replication-Secret)
+    std::vector<std::string> warnings;      ///< Ошибки разбора, выводятся в журнал при запуске
+};
+
+void applyConfigValue(ServerConfig& config, const std::string& key, const std::string& value);
+ServerConfig loadServerConfig();
+const ServerConfig& getServerConfig();
+
+/**
+ * @brief Признак того, что текущий поток обслуживает соединения сверх очереди
+ */
+extern thread_local bool t_server_overloaded;
+
+/**
+ * @brief Очередь соединений httplib с ограничением глубины
+ * 
+ * Соединения обслуживаются worker_threads потоками из очереди длиной до
+ * max_queued_requests. Соединения сверх неё передаются одному отдельному потоку,
+ * который через pre-routing обработчик сразу отвечает 503 с Retry-After и
+ * закрывает соединение. Если переполнена и эта очередь, соединение закрывается.
+ */
+class BoundedTaskQueue : public httplib::TaskQueue {
+public:
+    BoundedTaskQueue(size_t threads, size_t max_queued) : max_queued_(max_queued) {
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { work(queue_, queue_cv_, false); });
+        }
+        workers_.emplace_back([this] { work(overflow_, overflow_cv_, true); });
+    }
+
+    bool enqueue(std::function<void()> fn) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (shutdown_) {
+                return false;
+            }
+            if (queue_.size() < max_queued_) {
+                queue_.push_back(std::move(fn));
+                queue_cv_.notify_one();
+                return true;
+            }
+            if (overflow_.size() >= max_queued_) {
+                return false;
+            }
+            overflow_.push_back(std::move(fn));
+        }
+        overflow_cv_.notify_one();
+        return true;
+    }
+
+    void shutdown() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shutdown_ = true;
+        }
+        queue_cv_.notify_all();
+        overflow_cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+private:
+    void work(std::deque<std::function<void()>>& queue, std::condition_variable& cv, bool overloaded) {
+        t_server_overloaded = overloaded;
+        while (true) {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv.wait(lock, [&] { return shutdown_ || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                fn = std::move(queue.front());
+                queue.pop_front();
+            }
+            fn();
+        }
+    }
+
+    size_t max_queued_;
+    std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable overflow_cv_;
+    std::deque<std::function<void()>> queue_;
+    std::deque<std::function<void()>> overflow_;
+    std::vector<std::thread> workers_;
+    bool shutdown_ = false;
+};
+
+/**
+ * @brief Пул потоков с перехватом задач для вычислительной работы
+ * 
+ * Хеширование, сжатие и подобные задачи выполняются здесь, а не в потоках
+ * httplib, поэтому одновременно занято не больше cpu_threads ядер. У каждого
+ * потока своя очередь: задачи, поставленные из потока пула, кладутся в его
+ * очередь, свободные потоки забирают задачи из чужих очередей. При переполнении
+ * (cpu_queue задач) задача выполняется в вызывающем потоке.
+ */
+class CpuPool {
+public:
+    CpuPool(size_t threads, size_t max_tasks) : workers_(threads), max_tasks_(max_tasks) {
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ~CpuPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    CpuPool(const CpuPool&) = delete;
+    CpuPool& operator=(const CpuPool&) = delete;
+
+    /**
+     * @brief Постановка задачи в пул
+     * 
+     * @param task Задача
+     * @return std::future Результат задачи
+     */
+    template <typename Task>
+    auto submit(Task&& task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        std::future<Result> future = packaged->get_future();
+        if (!push([packaged] { (*packaged)(); })) {
+            (*packaged)();
+        }
+        return future;
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool push(std::function<void()> task) {
+        if (pending_.fetch_add(1) >= max_tasks_) {
+            pending_.fetch_sub(1);
+            return false;
+        }
+        size_t index = current_pool() == this ? current_index() : next_.fetch_add(1) % workers_.size();
+        {
+            std::lock_guard<std::mutex> lock(workers_[index].mutex);
+            workers_[index].tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        sleep_cv_.notify_one();
+        return true;
+    }
+
+    bool pop(size_t self, std::function<void()>& task) {
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            Worker& worker = workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+            // Своя очередь — с конца (свежие данные в кэше), чужая — с начала
+            if (i == 0) {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+            else {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            pending_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        current_pool() = this;
+        current_index() = self;
+        std::function<void()> task;
+        while (true) {
+            if (pop(self, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_cv_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+            if (stop_ && pending_.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    static CpuPool*& current_pool() {
+        static thread_local CpuPool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& current_index() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    std::vector<Worker> workers_;
+    std::vector<std::thread> threads_;
+    size_t max_tasks_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> next_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_ = false;
+};
+
+CpuPool& getCpuPool();
+
+/**
+ * @brief Уровень важности сообщения журнала
+ */
+enum class LogLevel {
+    Debug = 0,
+    Info,
+    Warning,
+    Error
+};
+
+/**
+ * @brief Поле структурированного сообщения журнала (ключ, значение)
+ */
+using LogField = std::pair<std::string, std::string>;
+
+std::string formatLogLine(LogLevel level, const std::string& message, std::initializer_list<LogField> fields);
+
+/**
+ * @brief Ёмкость очереди сообщений журнала (степень двойки)
+ */
+const size_t LOG_QUEUE_CAPACITY = 8192;
+
+/**
+ * @brief Размер файла журнала, после которого выполняется ротация (в байтах)
+ */
+const size_t LOG_MAX_FILE_SIZE = 10 * 1024 * 1024;
+
+/**
+ * @brief Количество хранимых старых файлов журнала (bot.log.1 ... bot.log.N)
+ */
+const size_t LOG_MAX_FILES = 5;
+
+/**
+ * @brief Количество попыток поставить в переполненную очередь сообщение уровня Error
+ */
+const size_t LOG_ERROR_RETRIES = 1024;
+
+/**
+ * @brief Асинхронный журнал с фоновой записью
+ * 
+ * Потоки-производители кладут готовые строки в ограниченную lock-free очередь
+ * (кольцевой буфер с номерами последовательности), фоновый поток забирает их
+ * пачками и записывает в файл одной операцией. При переполнении очереди
+ * сообщение отбрасывается, а число потерь попадает в журнал отдельной строкой.
+ * Порядок сообщений одного потока сохраняется.
+ */
+class AsyncLogger {
+public:
+    explicit AsyncLogger(std::string path)
+        : path_(std::move(path)), slots_(new Slot[LOG_QUEUE_CAPACITY]) {
+        for (size_t i = 0; i < LOG_QUEUE_CAPACITY; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        open();
+        writer_ = std::thread(&AsyncLogger::run, this);
+    }
+
+    ~AsyncLogger() {
+        stop_.store(true);
+        wake();
+        writer_.join();
+    }
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    /**
+     * @brief Постановка строки в очередь записи
+     * 
+     * @param line Готовая строка журнала с переводом строки
+     * @param important Повторять попытку при переполнении очереди
+     * @return true Строка поставлена в очередь
+     * @return false Очередь переполнена, строка отброшена
+     */
+    bool push(std::string line, bool important) {
+        for (size_t attempt = 0; ; ++attempt) {
+            if (try_push(line)) {
+                if (sleeping_.load(std::memory_order_relaxed)) {
+                    wake();
+                }
+                return true;
+            }
+            if (!important || attempt >= LOG_ERROR_RETRIES) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Ожидание записи на диск всех сообщений, поставленных до вызова
+     */
+    void flush() {
+        size_t target = enqueue_pos_.load(std::memory_order_acquire);
+        wake();
+        std::unique_lock<std::mutex> lock(mutex_);
+        flushed_cv_.wait(lock, [&] { return written_pos_.load() >= target; });
+    }
+
+    void set_level(LogLevel level) {
+        level_.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    LogLevel level() const {
+        return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+    }
+
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::string line;
+    };
+
+    bool try_push(std::string& line) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[pos & (LOG_QUEUE_CAPACITY - 1)];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.line = std::move(line);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(std::string& batch) {
+        Slot& slot = slots_[dequeue_pos_ & (LOG_QUEUE_CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+            return false;
+        }
+        batch += slot.line;
+        slot.line.clear();
+        slot.sequence.store(dequeue_pos_ + LOG_QUEUE_CAPACITY, std::memory_order_release);
+        ++dequeue_pos_;
+        return true;
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wake_cv_.notify_one();
+    }
+
+    void open() {
+        file_.open(path_, std::ios_base::app | std::ios_base::binary);
+        std::error_code ec;
+        auto size = fs::file_size(path_, ec);
+        file_size_ = ec ? 0 : static_cast<size_t>(size);
+    }
+
+    void rotate() {
+        file_.close();
+        std::error_code ec;
+        fs::remove(path_ + "." + std::to_string(LOG_MAX_FILES), ec);
+        for (size_t i = LOG_MAX_FILES; i > 1; --i) {
+            fs::rename(path_ + "." + std::to_string(i - 1), path_ + "." + std::to_string(i), ec);
+        }
+        fs::rename(path_, path_ + ".1", ec);
+        open();
+    }
+
+    void write_batch(const std::string& batch) {
+        if (file_size_ > 0 && file_size_ + batch.size() > LOG_MAX_FILE_SIZE) {
+            rotate();
+        }
+        file_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+        file_.flush();
+        file_size_ += batch.size();
+    }
+
+    void run() {
+        std::string batch;
+        uint64_t reported_drops = 0;
+        while (true) {
+            batch.clear();
+            while (batch.size() < LOG_MAX_FILE_SIZE / 16 && try_pop(batch)) {
+            }
+
+            uint64_t drops = dropped();
+            if (drops != reported_drops) {
+                batch += formatLogLine(LogLevel::Warning, "Log queue overflow, messages dropped",
+                    { {"count", std::to_string(drops - reported_drops)} });
+                reported_drops = drops;
+            }
+
+            if (!batch.empty()) {
+                write_batch(batch);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    written_pos_.store(dequeue_pos_);
+                }
+                flushed_cv_.notify_all();
+                continue;
+            }
+
+            if (stop_.load()) {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            sleeping_.store(true);
+            wake_cv_.wait_for(lock, std::chrono::milliseconds(100));
+            sleeping_.store(false);
+        }
+    }
+
+    std::string path_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) size_t dequeue_pos_ = 0;
+    std::atomic<size_t> written_pos_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<int> level_{static_cast<int>(LogLevel::Info)};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> stop_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable flushed_cv_;
+    std::ofstream file_;
+    size_t file_size_ = 0;
+    std::thread writer_;
+};
+
+AsyncLogger& getLogger();
+void logMessage(LogLevel level, const std::string& message, std::initializer_list<LogField> fields = {});
+void logMessage(const std::string& message);
+void flushLog();
+void setLogLevel(LogLevel level);
+uint64_t getDroppedLogMessages();
+
+/**
+ * @brief Количество соединений только для чтения в пуле базы данных
+ */
+const size_t DB_READER_COUNT = 4;
+
+/**
+ * @brief Время ожидания блокировки базы данных (мс)
+ */
+const int DB_BUSY_TIMEOUT_MS = 5000;
+
+/**
+ * @brief Количество полос (stripes) у счётчиков и гистограмм
+ * 
+ * Потоки пишут в разные полосы, поэтому атомарные инкременты из разных
+ * потоков не конкурируют за одну кэш-линию. Значения суммируются при чтении.
+ */
+const size_t METRIC_STRIPES = 8;
+
+size_t metric_stripe();
+
+/**
+ * @brief Монотонно растущий счётчик
+ */
+class MetricCounter {
+public:
+    void add(uint64_t value = 1) {
+        stripes_[metric_stripe()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& stripe : stripes_) {
+            total += stripe.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Stripe, METRIC_STRIPES> stripes_;
+};
+
+/**
+ * @brief Гистограмма задержек в логарифмически-линейных корзинах (как в HdrHistogram)
+ * 
+ * Значения в наносекундах. Каждый интервал [2^k, 2^(k+1)) делится на
+ * HISTOGRAM_SUB_BUCKETS равных корзин, что даёт относительную погрешность
+ * около 12% во всём диапазоне от 1 нс до ~1 часа. Запись — вычисление номера
+ * корзины через clz и два relaxed-инкремента.
+ */
+class LatencyHistogram {
+public:
+    static const size_t SUB_BUCKET_BITS = 3;
+    static const size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static const size_t MAX_EXPONENT = 42;
+    static const size_t BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+    /**
+     * @brief Запись одного значения
+     * 
+     * @param nanoseconds Длительность в наносекундах
+     */
+    void record(uint64_t nanoseconds) {
+        Stripe& stripe = stripes_[metric_stripe()];
+        stripe.buckets[bucket_for(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        stripe.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Номер корзины для значения
+     */
+    static size_t bucket_for(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+#ifdef _MSC_VER
+        unsigned long highest;
+        _BitScanReverse64(&highest, value);
+        size_t exponent = highest;
+#else
+        size_t exponent = 63 - static_cast<size_t>(__builtin_clzll(value));
+#endif
+        if (exponent > MAX_EXPONENT) {
+            return BUCKETS - 1;
+        }
+        size_t sub = static_cast<size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    /**
+     * @brief Верхняя граница корзины (не включительно) в наносекундах
+     */
+    static uint64_t bucket_upper_bound(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket + 1;
+        }
+        size_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        return (uint64_t(1) << exponent) + ((sub + 1) << (exponent - SUB_BUCKET_BITS));
+    }
+
+    /**
+     * @brief Снимок гистограммы: количество значений по корзинам и их сумма
+     */
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        /**
+         * @brief Оценка квантиля по верхней границе корзины
+         * 
+         * @param q Квантиль от 0 до 1
+         * @return uint64_t Значение в наносекундах
+         */
+        uint64_t quantile(double q) const {
+            uint64_t rank = static_cast<uint64_t>(q * count);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen > rank) {
+                    return bucket_upper_bound(i);
+                }
+            }
+            return 0;
+        }
+    };
+
+    Snapshot snapshot() const {
+        Snapshot result;
+        for (const auto& stripe : stripes_) {
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                uint64_t value = stripe.buckets[i].load(std::memory_order_relaxed);
+                result.buckets[i] += value;
+                result.count += value;
+            }
+            result.sum += stripe.sum.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::array<Stripe, METRIC_STRIPES> stripes_;
+};
+
+/**
+ * @brief Замер длительности блока кода в гистограмму
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(LatencyHistogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        histogram_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count()));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    LatencyHistogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Реестр метрик с выводом в текстовом формате Prometheus
+ * 
+ * Метрики регистрируются один раз (обычно в static переменной в месте
+ * использования), после чего запись в них не обращается к реестру.
+ * Адреса метрик стабильны на всё время работы процесса.
+ */
+class MetricsRegistry {
+public:
+    /**
+     * @brief Регистрация или получение счётчика
+     * 
+     * @param name Имя метрики
+     * @param help Описание
+     * @param labels Метки в формате Prometheus, например route="/files"
+     * @return MetricCounter& Счётчик
+     */
+    MetricCounter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Family& family = family_for(name, help, "counter");
+        auto& metric = family.counters[labels];
+        if (!metric) {
+            metric = std::make_unique<MetricCounter>();
+        }
+        return *metric;
+    }
+
+    /**
+     * @brief Регистрация или получение гистограммы задержек
+     * 
+     * @param name Имя метрики (значения выводятся в секундах)
+     * @param help Описание
+     * @param labels Метки в формате Prometheus
+     * @return LatencyHistogram& Гистограмма
+     */
+    LatencyHistogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Family& family = family_for(name, help, "histogram");
+        auto& metric = family.histograms[labels];
+        if (!metric) {
+            metric = std::make_unique<LatencyHistogram>();
+        }
+        return *metric;
+    }
+
+    /**
+     * @brief Регистрация показателя, значение которого вычисляется при выводе
+     * 
+     * @param name Имя метрики
+     * @param help Описание
+     * @param read Функция чтения значения
+     */
+    void gauge(const std::string& name, const std::string& help, std::function<double()> read) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        family_for(name, help, "gauge").gauges[""] = std::move(read);
+    }
+
+    /**
+     * @brief Вывод всех метрик в текстовом формате Prometheus 0.0.4
+     * 
+     * Гистограммы выводятся с границами le по степеням двойки от 1 мкс,
+     * плюс _sum и _count.
+     */
+    std::string render() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        for (const auto& entry : families_) {
+            const std::string& name = entry.first;
+            const Family& family = entry.second;
+            out << "# HELP " << name << " " << family.help << "\n";
+            out << "# TYPE " << name << " " << family.type << "\n";
+            for (const auto& counter : family.counters) {
+                out << name << with_labels(counter.first, "") << " " << counter.second->value() << "\n";
+            }
+            for (const auto& gauge : family.gauges) {
+                out << name << with_labels(gauge.first, "") << " " << gauge.second() << "\n";
+            }
+            for (const auto& histogram : family.histograms) {
+                render_histogram(out, name, histogram.first, histogram.second->snapshot());
+            }
+        }
+        return out.str();
+    }
+
+private:
+    struct Family {
+        std::string help;
+        std::string type;
+        std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+        std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+        std::map<std::string, std::function<double()>> gauges;
+    };
+
+    Family& family_for(const std::string& name, const std::string& help, const std::string& type) {
+        Family& family = families_[name];
+        if (family.type.empty()) {
+            family.help = help;
+            family.type = type;
+        }
+        return family;
+    }
+
+    static std::string with_labels(const std::string& labels, const std::string& extra) {
+        if (labels.empty() && extra.empty()) {
+            return "";
+        }
+        return "{" + labels + (!labels.empty() && !extra.empty() ? "," : "") + extra + "}";
+    }
+
+    static void render_histogram(std::ostringstream& out, const std::string& name, const std::string& labels,
+                                 const LatencyHistogram::Snapshot& snapshot) {
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        // 2^10 нс ≈ 1 мкс ... 2^36 нс ≈ 69 с
+        for (size_t exponent = 10; exponent <= 36; ++exponent) {
+            uint64_t bound = uint64_t(1) << exponent;
+            while (bucket < LatencyHistogram::BUCKETS && LatencyHistogram::bucket_upper_bound(bucket) <= bound) {
+                cumulative += snapshot.buckets[bucket++];
+            }
+            out << name << "_bucket" << with_labels(labels, "le=\"" + format_seconds(bound) + "\"") << " " << cumulative << "\n";
+        }
+        out << name << "_bucket" << with_labels(labels, "le=\"+Inf\"") << " " << snapshot.count << "\n";
+        out << name << "_sum" << with_labels(labels, "") << " " << format_seconds(snapshot.sum) << "\n";
+        out << name << "_count" << with_labels(labels, "") << " " << snapshot.count << "\n";
+    }
+
+    static std::string format_seconds(uint64_t nanoseconds) {
+        std::ostringstream out;
+        out.precision(9);
+        out << static_cast<double>(nanoseconds) / 1e9;
+        return out.str();
+    }
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+MetricsRegistry& getMetrics();
+LatencyHistogram& db_query_histogram(const std::string& query);
+MetricCounter& upload_bytes_counter();
+MetricCounter& download_bytes_counter();
+
+/**
+ * @brief Соединение с базой данных с кэшем подготовленных запросов
+ * 
+ * Запросы подготавливаются один раз на соединение и переиспользуются.
+ * Соединение не потокобезопасно: доступ к нему выдаёт DbPool.
+ */
+class DbConnection {
+public:
+    DbConnection(const std::string& path, int flags, const std::string& pragmas)
+        : db_(path, flags, DB_BUSY_TIMEOUT_MS) {
+        db_.exec(pragmas);
+    }
+
+    SQLite::Database& database() {
+        return db_;
+    }
+
+    /**
+     * @brief Получение подготовленного запроса из кэша
+     * 
+     * @param sql Текст запроса
+     * @return SQLite::Statement& Запрос, готовый к привязке параметров
+     */
+    SQLite::Statement& statement(const std::string& sql) {
+        auto it = statements_.find(sql);
+        if (it == statements_.end()) {
+            it = statements_.emplace(sql, std::make_unique<SQLite::Statement>(db_, sql)).first;
+        }
+        return *it->second;
+    }
+
+    /**
+     * @brief Сброс всех запросов после использования
+     * 
+     * Завершает открытые транзакции чтения, чтобы не блокировать контрольные точки WAL.
+     */
+    void reset_statements() {
+        for (auto& entry : statements_) {
+            entry.second->tryReset();
+            entry.second->clearBindings();
+        }
+    }
+
+private:
+    SQLite::Database db_;
+    std::unordered_map<std::string, std::unique_ptr<SQLite::Statement>> statements_;
+};
+
+/**
+ * @brief Пул соединений с базой данных
+ * 
+ * Держит одно соединение для записи и DB_READER_COUNT соединений только для чтения
+ * в режиме WAL, так что чтения не ждут записи. Безопасен для одновременного
+ * использования из потока TgLongPoll и пула потоков httplib.
+ */
+class DbPool {
+public:
+    /**
+     * @brief Соединение, выданное из пула на время жизни объекта
+     */
+    class Lease {
+    public:
+        Lease(DbPool& pool, DbConnection* connection, bool writer)
+            : pool_(pool), connection_(connection), writer_(writer) {}
+
+        ~Lease() {
+            pool_.release(connection_, writer_);
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        DbConnection* operator->() const {
+            return connection_;
+        }
+
+        DbConnection& operator*() const {
+            return *connection_;
+        }
+
+    private:
+        DbPool& pool_;
+        DbConnection* connection_;
+        bool writer_;
+    };
+
+    DbPool(const std::string& path, size_t readers)
+        : writer_(std::make_unique<DbConnection>(path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE,
+            "PRAGMA journal_mode = WAL;"
+            "PRAGMA synchronous = NORMAL;"
+            "PRAGMA temp_store = MEMORY;"
+            "PRAGMA cache_size = -8000;")) {
+        for (size_t i = 0; i < readers; ++i) {
+            readers_.push_back(std::make_unique<DbConnection>(path, SQLite::OPEN_READONLY,
+                "PRAGMA cache_size = -8000;"
+                "PRAGMA mmap_size = 67108864;"));
+            idle_readers_.push_back(readers_.back().get());
+        }
+    }
+
+    /**
+     * @brief Получение соединения для записи (ожидает, пока писатель свободен)
+     */
+    Lease writer() {
+        writer_mutex_.lock();
+        return Lease(*this, writer_.get(), true);
+    }
+
+    /**
+     * @brief Получение соединения для чтения (ожидает свободного читателя)
+     */
+    Lease reader() {
+        std::unique_lock<std::mutex> lock(readers_mutex_);
+        readers_cv_.wait(lock, [this] { return !idle_readers_.empty(); });
+        DbConnection* connection = idle_readers_.back();
+        idle_readers_.pop_back();
+        return Lease(*this, connection, false);
+    }
+
+private:
+    void release(DbConnection* connection, bool writer) {
+        connection->reset_statements();
+        if (writer) {
+            writer_mutex_.unlock();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(readers_mutex_);
+            idle_readers_.push_back(connection);
+        }
+        readers_cv_.notify_one();
+    }
+
+    std::unique_ptr<DbConnection> writer_;
+    std::vector<std::unique_ptr<DbConnection>> readers_;
+    std::vector<DbConnection*> idle_readers_;
+    std::mutex writer_mutex_;
+    std::mutex readers_mutex_;
+    std::condition_variable readers_cv_;
+};
+
+DbPool& getDbPool();
+bool is_replication_leader();
+bool is_replication_follower();
+void replicate(DbConnection& db, const std::vector<std::string>& fields);
+void replicate(const std::vector<std::string>& fields);
+
+/**
+ * @brief Вид токена в индексе
+ */
+enum class TokenKind {
+    User = 0,   ///< Токен пользователя, папка files/<token>
+    Send = 1    ///< Токен анонимной отправки, папка hidefiles/<token>
+};
+
+/**
+ * @brief Количество сегментов индекса токенов
+ */
+const size_t TOKEN_INDEX_SHARDS = 16;
+
+/**
+ * @brief Индекс активных токенов в памяти
+ * 
+ * Хеш-множества разбиты на сегменты со своими shared_mutex: проверки токена
+ * берут только разделяемую блокировку одного сегмента и не обращаются к диску.
+ */
+class TokenIndex {
+public:
+    void add(TokenKind kind, const std::string& token) {
+        Shard& s = shard(kind, token);
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        s.tokens.insert(token);
+    }
+
+    void remove(TokenKind kind, const std::string& token) {
+        Shard& s = shard(kind, token);
+        std::unique_lock<std::shared_mutex> lock(s.mutex);
+        s.tokens.erase(token);
+    }
+
+    bool contains(TokenKind kind, const std::string& token) const {
+        const Shard& s = shard(kind, token);
+        std::shared_lock<std::shared_mutex> lock(s.mutex);
+        return s.tokens.count(token) > 0;
+    }
+
+    size_t size(TokenKind kind) const {
+        size_t total = 0;
+        for (const Shard& s : shards_[static_cast<size_t>(kind)]) {
+            std::shared_lock<std::shared_mutex> lock(s.mutex);
+            total += s.tokens.size();
+        }
+        return total;
+    }
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_set<std::string> tokens;
+    };
+
+    Shard& shard(TokenKind kind, const std::string& token) {
+        return shards_[static_cast<size_t>(kind)][std::hash<std::string>{}(token) % TOKEN_INDEX_SHARDS];
+    }
+
+    const Shard& shard(TokenKind kind, const std::string& token) const {
+        return shards_[static_cast<size_t>(kind)][std::hash<std::string>{}(token) % TOKEN_INDEX_SHARDS];
+    }
+
+    std::array<Shard, TOKEN_INDEX_SHARDS> shards_[2];
+};
+
+TokenIndex& getTokenIndex();
+void initDatabase();
+void addUserToDatabase(int64_t userId);
+
+/**
+ * @brief Алфавит токенов по умолчанию
+ */
+extern const std::string TOKEN_ALPHABET;
+
+/**
+ * @brief Длина токена пользователя
+ */
+const size_t USER_TOKEN_LENGTH = 18;
+
+/**
+ * @brief Длина токена ссылки на отправленные файлы
+ */
+const size_t SEND_TOKEN_LENGTH = 12;
+
+void fill_random_token(char* out, size_t length, const std::string& alphabet);
+std::string random_token(size_t length, const std::string& alphabet = TOKEN_ALPHABET);
+std::string generate_unique_token(TokenKind kind, size_t length);
+std::string generateToken();
+void updateUserToken(int64_t userId, const std::string& token);
+std::string getUserToken(int64_t userId);
+std::string token_root(TokenKind kind);
+std::string shard_prefix(const std::string& token, size_t depth);
+std::string token_folder(TokenKind kind, const std::string& token);
+void for_each_token_folder(TokenKind kind, size_t depth,
+                           const std::function<void(const std::string&, const fs::path&)>& visit);
+void loadTokenIndex();
+void createFolderForUser(const std::string& token);
+std::time_t to_time_t(fs::file_time_type time);
+std::string content_type_for(const std::string& filename);
+
+/**
+ * @brief Сведения о файле в папке пользователя
+ */
+struct FileEntry {
+    std::string name;
+    uint64_t size = 0;
+    std::time_t mtime = 0;
+    std::string content_type;
+};
+
+/**
+ * @brief Неизменяемый снимок содержимого папки, отсортированный по имени
+ */
+using FileList = std::shared_ptr<const std::vector<FileEntry>>;
+
+/**
+ * @brief Порядок сортировки листинга
+ */
+enum class ListingSort {
+    Name,
+    Size,
+    Mtime
+};
+
+/**
+ * @brief Снимок папки с готовыми порядками сортировки
+ * 
+ * Файлы в files уже упорядочены по имени; by_size и by_mtime — индексы в files,
+ * упорядоченные по размеру и времени изменения (при равенстве — по имени).
+ */
+struct FolderListing {
+    FileList files;
+    std::vector<uint32_t> by_size;
+    std::vector<uint32_t> by_mtime;
+
+    /**
+     * @brief Ключ сортировки файла (для сортировки по имени всегда 0)
+     */
+    int64_t key(ListingSort sort, uint32_t index) const {
+        const FileEntry& file = (*files)[index];
+        switch (sort) {
+        case ListingSort::Size: return static_cast<int64_t>(file.size);
+        case ListingSort::Mtime: return static_cast<int64_t>(file.mtime);
+        default: return 0;
+        }
+    }
+};
+
+using ListingIndex = std::shared_ptr<const FolderListing>;
+
+/**
+ * @brief Кэш содержимого папок с инвалидацией через inotify
+ * 
+ * При первом обращении к папке на неё ставится inotify-наблюдение и читается
+ * содержимое; повторные листинги отдают готовый снимок без обращения к диску.
+ * Любое изменение в папке сбрасывает снимок. Номер поколения защищает от
+ * сохранения снимка, прочитанного во время изменения. Без inotify (не Linux)
+ * папки читаются при каждом обращении.
+ */
+class FolderCache {
+public:
+    FolderCache() {
+#ifdef __linux__
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd_ >= 0) {
+            watcher_ = std::thread(&FolderCache::watch, this);
+        }
+        else {
+            logMessage(LogLevel::Warning, "inotify unavailable, folder cache disabled");
+        }
+#endif
+    }
+
+    ~FolderCache() {
+        stop_.store(true);
+        if (watcher_.joinable()) {
+            watcher_.join();
+        }
+#ifdef __linux__
+        if (inotify_fd_ >= 0) {
+            ::close(inotify_fd_);
+        }
+#endif
+    }
+
+    FolderCache(const FolderCache&) = delete;
+    FolderCache& operator=(const FolderCache&) = delete;
+
+    /**
+     * @brief Получение содержимого папки
+     * 
+     * @param folder_path Путь к папке
+     * @return FileList Снимок содержимого (пустой, если папки нет)
+     */
+    FileList list(const std::string& folder_path) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = folders_.find(folder_path);
+            if (it != folders_.end() && it->second.files) {
+                return it->second.files;
+            }
+        }
+
+        uint64_t generation = 0;
+        bool watched = false;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            auto it = folders_.find(folder_path);
+            if (it != folders_.end() && it->second.files) {
+                return it->second.files;
+            }
+            int wd = add_watch(folder_path);
+            if (wd >= 0) {
+                Folder& folder = folders_[folder_path];
+                folder.wd = wd;
+                generation = folder.generation;
+                watched = true;
+            }
+        }
+
+        FileList files = scan(folder_path);
+        if (watched) {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            auto it = folders_.find(folder_path);
+            if (it != folders_.end() && it->second.generation == generation) {
+                it->second.files = files;
+            }
+        }
+        return files;
+    }
+
+    /**
+     * @brief Получение содержимого папки вместе с порядками сортировки
+     * 
+     * Порядки строятся один раз на снимок и сбрасываются вместе с ним, поэтому
+     * постраничный листинг не сортирует папку заново на каждый запрос.
+     * 
+     * @param folder_path Путь к папке
+     * @return ListingIndex Снимок с индексами по размеру и времени изменения
+     */
+    ListingIndex index(const std::string& folder_path) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = folders_.find(folder_path);
+            if (it != folders_.end() && it->second.index) {
+                return it->second.index;
+            }
+        }
+
+        FileList files = list(folder_path);
+        auto listing = std::make_shared<FolderListing>();
+        listing->files = files;
+        listing->by_size.resize(files->size());
+        for (uint32_t i = 0; i < listing->by_size.size(); ++i) {
+            listing->by_size[i] = i;
+        }
+        listing->by_mtime = listing->by_size;
+        std::stable_sort(listing->by_size.begin(), listing->by_size.end(),
+            [&](uint32_t a, uint32_t b) { return (*files)[a].size < (*files)[b].size; });
+        std::stable_sort(listing->by_mtime.begin(), listing->by_mtime.end(),
+            [&](uint32_t a, uint32_t b) { return (*files)[a].mtime < (*files)[b].mtime; });
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = folders_.find(folder_path);
+        // Индекс сохраняется, только если снимок не успел смениться
+        if (it != folders_.end() && it->second.files == files) {
+            it->second.index = listing;
+        }
+        return listing;
+    }
+
+    /**
+     * @brief Сброс снимка папки
+     * 
+     * Вызывается после собственных изменений сервера, чтобы следующий листинг
+     * не зависел от задержки доставки событий inotify.
+     * 
+     * @param folder_path Путь к папке
+     */
+    void invalidate(const std::string& folder_path) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = folders_.find(folder_path);
+        if (it != folders_.end()) {
+            reset(it->second);
+        }
+    }
+
+    /**
+     * @brief Чтение содержимого папки с диска
+     * 
+     * @param folder_path Путь к папке
+     * @return FileList Снимок содержимого, отсортированный по имени
+     */
+    static FileList scan(const std::string& folder_path) {
+        auto files = std::make_shared<std::vector<FileEntry>>();
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(folder_path, ec)) {
+            std::string filename = entry.path().filename().string();
+            // Скрытые файлы — незавершённые загрузки UploadFile
+            if (filename.empty() || filename[0] == '.') {
+                continue;
+            }
+            FileEntry file;
+            file.size = entry.file_size(ec);
+            if (ec) {
+                continue;
+            }
+            file.mtime = to_time_t(entry.last_write_time(ec));
+            file.content_type = content_type_for(filename);
+            file.name = std::move(filename);
+            files->push_back(std::move(file));
+        }
+        std::sort(files->begin(), files->end(),
+            [](const FileEntry& a, const FileEntry& b) { return a.name < b.name; });
+        return files;
+    }
+
+private:
+    struct Folder {
+        int wd = -1;
+        uint64_t generation = 0;
+        FileList files;
+        ListingIndex index;
+    };
+
+    static void reset(Folder& folder) {
+        ++folder.generation;
+        folder.files.reset();
+        folder.index.reset();
+    }
+
+    int add_watch(const std::string& folder_path) {
+#ifdef __linux__
+        if (inotify_fd_ < 0) {
+            return -1;
+        }
+        int wd = inotify_add_watch(inotify_fd_, folder_path.c_str(),
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB |
+            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (wd >= 0) {
+            watches_[wd] = folder_path;
+        }
+        return wd;
+#else
+        return -1;
+#endif
+    }
+
+#ifdef __linux__
+    void watch() {
+        alignas(struct inotify_event) char buffer[16 * 1024];
+        while (!stop_.load()) {
+            pollfd pfd{ inotify_fd_, POLLIN, 0 };
+            if (::poll(&pfd, 1, 200) <= 0) {
+                continue;
+            }
+            ssize_t length = ::read(inotify_fd_, buffer, sizeof(buffer));
+            if (length <= 0) {
+                continue;
+            }
+
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            for (char* ptr = buffer; ptr < buffer + length; ) {
+                const auto* event = reinterpret_cast<const struct inotify_event*>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    for (auto& folder : folders_) {
+                        reset(folder.second);
+                    }
+                    continue;
+                }
+                auto watch = watches_.find(event->wd);
+                if (watch == watches_.end()) {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED) {
+                    folders_.erase(watch->second);
+                    watches_.erase(watch);
+                    continue;
+                }
+                auto folder = folders_.find(watch->second);
+                if (folder != folders_.end()) {
+                    reset(folder->second);
+                }
+            }
+        }
+    }
+#else
+    void watch() {}
+#endif
+
+    std::shared_mutex mutex_;
+    std::unordered_map<std::string, Folder> folders_;
+    std::unordered_map<int, std::string> watches_;
+    int inotify_fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread watcher_;
+};
+
+FolderCache& getFolderCache();
+FileList get_files(const std::string& folder_path);
+bool validate_token(const std::string& token);
+void append_html_escaped(std::string& out, const std::string& value);
+void append_url_encoded(std::string& out, const std::string& value);
+void generate_file_list_html(const std::vector<FileEntry>& files, const std::string& link_prefix, std::string& out);
+std::string generate_send_token(size_t length);
+std::string json_escape(const std::string& value);
+std::string sanitize_filename(const std::string& filename);
+
+/**
+ * @brief Подсчёт SHA-256 по мере поступления данных
+ */
+class Sha256 {
+public:
+    Sha256() : context_(EVP_MD_CTX_new()) {
+        EVP_DigestInit_ex(context_, EVP_sha256(), nullptr);
+    }
+
+    ~Sha256() {
+        EVP_MD_CTX_free(context_);
+    }
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const char* data, size_t length) {
+        EVP_DigestUpdate(context_, data, length);
+    }
+
+    /**
+     * @brief Завершение подсчёта
+     * 
+     * @return std::string Хеш в шестнадцатеричном виде (64 символа)
+     */
+    std::string hex_digest() {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        EVP_DigestFinal_ex(context_, digest, &length);
+        static const char HEX[] = "0123456789abcdef";
+        std::string hex(length * 2, '0');
+        for (unsigned int i = 0; i < length; ++i) {
+            hex[2 * i] = HEX[digest[i] >> 4];
+            hex[2 * i + 1] = HEX[digest[i] & 0x0f];
+        }
+        return hex;
+    }
+
+private:
+    EVP_MD_CTX* context_;
+};
+
+std::string blob_path_for(const std::string& hash);
+std::string relative_to_base(const std::string& path);
+
+/**
+ * @brief Минимальный размер ответа, который имеет смысл сжимать (в байтах)
+ */
+const size_t COMPRESS_MIN_SIZE = 1024;
+
+/**
+ * @brief Уровень сжатия при отдаче «на лету» (быстрый, чтобы не нагружать CPU)
+ */
+const int COMPRESS_STREAM_LEVEL = 1;
+
+/**
+ * @brief Уровень сжатия для предварительно сжатых копий блобов
+ */
+const int COMPRESS_SIDECAR_LEVEL = 9;
+
+/**
+ * @brief Размер блока чтения при создании сжатых копий (в байтах)
+ */
+const size_t COMPRESS_READ_SIZE = 1024 * 1024;
+
+/**
+ * @brief Кодирование содержимого ответа
+ */
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Zstd
+};
+
+std::vector<ContentEncoding> supported_encodings();
+const char* encoding_name(ContentEncoding encoding);
+const char* encoding_suffix(ContentEncoding encoding);
+ContentEncoding negotiate_encoding(const httplib::Request& req);
+bool is_compressible(const std::string& content_type);
+
+/**
+ * @brief Потоковый компрессор gzip/zstd
+ * 
+ * Данные подаются частями через compress(), сжатый результат дописывается
+ * в выходную строку. Последний вызов должен быть с finish = true.
+ */
+class StreamCompressor {
+public:
+    StreamCompressor(ContentEncoding encoding, int level) : encoding_(encoding) {
+        if (encoding_ == ContentEncoding::Gzip) {
+            valid_ = deflateInit2(&zs_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+#ifdef HAVE_ZSTD
+        else if (encoding_ == ContentEncoding::Zstd) {
+            cctx_ = ZSTD_createCCtx();
+            valid_ = cctx_ != nullptr && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level));
+        }
+#endif
+    }
+
+    ~StreamCompressor() {
+        if (encoding_ == ContentEncoding::Gzip && valid_) {
+            deflateEnd(&zs_);
+        }
+#ifdef HAVE_ZSTD
+        if (cctx_) {
+            ZSTD_freeCCtx(cctx_);
+        }
+#endif
+    }
+
+    StreamCompressor(const StreamCompressor&) = delete;
+    StreamCompressor& operator=(const StreamCompressor&) = delete;
+
+    bool is_valid() const {
+        return valid_;
+    }
+
+    /**
+     * @brief Сжатие очередной части данных
+     * 
+     * @param data Данные
+     * @param length Длина данных
+     * @param finish Последняя часть
+     * @param out Строка, в которую дописывается результат
+     * @return true Успешно
+     * @return false Ошибка компрессора
+     */
+    bool compress(const char* data, size_t length, bool finish, std::string& out) {
+        char buffer[16384];
+        if (encoding_ == ContentEncoding::Gzip) {
+            zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zs_.avail_in = static_cast<uInt>(length);
+            int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+            int ret;
+            do {
+                zs_.next_out = reinterpret_cast<Bytef*>(buffer);
+                zs_.avail_out = sizeof(buffer);
+                ret = deflate(&zs_, flush);
+                if (ret == Z_STREAM_ERROR) {
+                    return false;
+                }
+                out.append(buffer, sizeof(buffer) - zs_.avail_out);
+            } while (zs_.avail_out == 0 || (finish && ret != Z_STREAM_END));
+            return true;
+        }
+#ifdef HAVE_ZSTD
+        if (encoding_ == ContentEncoding::Zstd) {
+            ZSTD_inBuffer input = { data, length, 0 };
+            ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+            size_t remaining;
+            do {
+                ZSTD_outBuffer output = { buffer, sizeof(buffer), 0 };
+                remaining = ZSTD_compressStream2(cctx_, &output, &input, mode);
+                if (ZSTD_isError(remaining)) {
+                    return false;
+                }
+                out.append(buffer, output.pos);
+            } while (finish ? remaining != 0 : input.pos < input.size);
+            return true;
+        }
+#endif
+        return false;
+    }
+
+private:
+    ContentEncoding encoding_;
+    z_stream zs_{};
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* cctx_ = nullptr;
+#endif
+    bool valid_ = false;
+};
+
+void set_compressed_content(const httplib::Request& req, httplib::Response& res, const std::string& body, const std::string& content_type);
+std::string sidecar_path_for(const std::string& hash, ContentEncoding encoding);
+void schedule_precompression(const std::string& hash, const std::string& content_type, uint64_t size);
+std::string blob_hash_for(const std::string& file_path);
+void collectGarbageBlobs();
+bool store_blob_reference(const std::string& temp_path, const std::string& final_path, const std::string& hash, uint64_t size);
+bool store_plain_file(const std::string& temp_path, const std::string& final_path);
+std::string usage_key_for(const std::string& dir_path);
+void add_folder_usage(const std::string& folder, int64_t delta);
+void record_file_usage(const std::string& file_path, uint64_t previous_size, uint64_t size);
+uint64_t existing_file_size(const std::string& path);
+uint64_t quota_remaining(DbConnection& db, const std::string& dir_path);
+uint64_t quota_remaining(const std::string& dir_path);
+bool reserve_folder_quota(const std::string& dir_path, uint64_t bytes);
+void release_folder_quota(const std::string& dir_path, uint64_t bytes);
+void reconcileUsage();
+void startUsageReconciler();
+void reject_over_quota(httplib::Response& res);
+
+/**
+ * @brief Количество ссылок, удаляемых сборщиком за один проход
+ */
+const size_t SHARE_REAP_BATCH = 256;
+
+/**
+ * @brief Пауза между проходами сборщика, чтобы не занимать диск подряд
+ */
+const std::chrono::milliseconds SHARE_REAP_PAUSE(20);
+
+void lower_thread_priority();
+
+/**
+ * @brief Фоновое удаление анонимных ссылок с истёкшим сроком
+ * 
+ * Сроки ссылок хранятся в таблице shares, а в памяти — в min-куче по времени
+ * истечения, так что поток спит до ближайшего срока и не опрашивает базу.
+ * Истёкшая ссылка сразу убирается из индекса токенов (и перестаёт открываться),
+ * а папки удаляются пачками по SHARE_REAP_BATCH с паузами в потоке с низким
+ * приоритетом ввода-вывода. Вместе с папкой удаляются её ссылки на блобы,
+ * строка учёта места и запись в shares.
+ * 
+ * Действующий срок каждой ссылки хранится в expires_. При переносе срока
+ * (expire_now, повторная попытка) старая запись остаётся в куче и при
+ * извлечении пропускается, так как её время уже не совпадает со сроком ссылки.
+ * 
+ * Пока ссылку отдают (hold), её папка не удаляется: истёкшая за это время
+ * ссылка откладывается и удаляется после последнего release.
+ */
+class ShareReaper {
+public:
+    ~ShareReaper() {
+        stop();
+    }
+
+    /**
+     * @brief Запуск потока сборщика
+     */
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable()) {
+            stop_ = false;
+            thread_ = std::thread([this] { run(); });
+        }
+    }
+
+    /**
+     * @brief Остановка потока сборщика
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    /**
+     * @brief Добавление ссылки в расписание или перенос её срока
+     * 
+     * @param token Токен ссылки
+     * @param expires Время истечения
+     */
+    void schedule(const std::string& token, std::time_t expires) {
+        bool earliest;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            earliest = heap_.empty() || expires < heap_.top().first;
+            expires_[token] = expires;
+            heap_.emplace(expires, token);
+        }
+        if (earliest) {
+            cv_.notify_all();
+        }
+    }
+
+    /**
+     * @brief Немедленное истечение ссылки (например, исчерпан лимит скачиваний)
+     * 
+     * @param token Токен ссылки
+     */
+    void expire_now(const std::string& token) {
+        getTokenIndex().remove(TokenKind::Send, token);
+        schedule(token, 0);
+    }
+
+    /**
+     * @brief Удержание папки ссылки на время отдачи
+     * 
+     * @param token Токен ссылки
+     * @return true Папка не будет удалена до release
+     * @return false Ссылка уже удаляется
+     */
+    bool hold(const std::string& token) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (reaping_.count(token)) {
+            return false;
+        }
+        ++holds_[token];
+        return true;
+    }
+
+    /**
+     * @brief Снятие удержания; отложенная ссылка ставится на удаление
+     * 
+     * @param token Токен ссылки
+     */
+    void release(const std::string& token) {
+        bool deferred = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = holds_.find(token);
+            if (it == holds_.end()) {
+                return;
+            }
+            if (--it->second == 0) {
+                holds_.erase(it);
+                deferred = deferred_.erase(token) > 0;
+            }
+        }
+        if (deferred) {
+            schedule(token, 0);
+        }
+    }
+
+    /**
+     * @brief Количество ссылок в расписании
+     */
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return expires_.size();
+    }
+
+    /**
+     * @brief Количество удалённых ссылок с момента запуска
+     */
+    uint64_t reaped() const {
+        return reaped_.load();
+    }
+
+private:
+    using Entry = std::pair<std::time_t, std::string>;
+
+    /**
+     * @brief Запись кучи, срок которой перенесён или ссылка уже удалена
+     */
+    bool stale(const Entry& entry) const {
+        auto it = expires_.find(entry.second);
+        return it == expires_.end() || it->second != entry.first;
+    }
+
+    void run() {
+        lower_thread_priority();
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            if (heap_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            if (stale(heap_.top())) {
+                heap_.pop();
+                continue;
+            }
+            std::time_t now = std::time(nullptr);
+            if (heap_.top().first > now) {
+                cv_.wait_until(lock, std::chrono::system_clock::from_time_t(heap_.top().first));
+                continue;
+            }
+
+            std::vector<std::string> batch;
+            while (!heap_.empty() && heap_.top().first <= now && batch.size() < SHARE_REAP_BATCH) {
+                if (!stale(heap_.top())) {
+                    const std::string& token = heap_.top().second;
+                    expires_.erase(token);
+                    if (holds_.count(token)) {
+                        // Новые скачивания уже не принимаются, папка удалится после release
+                        getTokenIndex().remove(TokenKind::Send, token);
+                        deferred_.insert(token);
+                    }
+                    else {
+                        batch.push_back(token);
+                        reaping_.insert(token);
+                    }
+                }
+                heap_.pop();
+            }
+            if (batch.empty()) {
+                continue;
+            }
+            lock.unlock();
+            reap(batch);
+            lock.lock();
+            reaping_.clear();
+            lock.unlock();
+            std::this_thread::sleep_for(SHARE_REAP_PAUSE);
+            lock.lock();
+        }
+    }
+
+    void reap(const std::vector<std::string>& batch) {
+        TokenIndex& index = getTokenIndex();
+        for (const auto& token : batch) {
+            index.remove(TokenKind::Send, token);
+        }
+
+        bool released = false;
+        try {
+            auto db = getDbPool().writer();
+            SQLite::Transaction transaction(db->database());
+            SQLite::Statement& refs = db->statement("SELECT hash FROM file_refs WHERE path >= ? AND path < ?");
+            SQLite::Statement& release = db->statement("UPDATE blobs SET refcount = refcount - 1 WHERE hash = ?");
+            SQLite::Statement& drop_refs = db->statement("DELETE FROM file_refs WHERE path >= ? AND path < ?");
+            SQLite::Statement& drop_usage = db->statement("DELETE FROM folder_usage WHERE folder = ?");
+            SQLite::Statement& drop_share = db->statement("DELETE FROM shares WHERE token = ?");
+            for (const auto& token : batch) {
+                // Все пути <папка>/... лежат в диапазоне ["<папка>/", "<папка>0")
+                std::string folder = usage_key_for(token_folder(TokenKind::Send, token));
+                std::string from = folder + "/";
+                std::string to = folder + "0";
+                refs.bind(1, from);
+                refs.bind(2, to);
+                while (refs.executeStep()) {
+                    release.bind(1, refs.getColumn(0).getText());
+                    release.exec();
+                    release.tryReset();
+                    released = true;
+                }
+                refs.tryReset();
+                drop_refs.bind(1, from);
+                drop_refs.bind(2, to);
+                drop_refs.exec();
+                drop_refs.tryReset();
+                drop_usage.bind(1, folder);
+                drop_usage.exec();
+                drop_usage.tryReset();
+                drop_share.bind(1, token);
+                drop_share.exec();
+                drop_share.tryReset();
+            }
+            transaction.commit();
+        }
+        catch (const std::exception& e) {
+            logMessage(LogLevel::Error, "Error reaping shares: " + std::string(e.what()));
+            std::time_t retry = std::time(nullptr) + 60;
+            for (const auto& token : batch) {
+                schedule(token, retry);
+            }
+            return;
+        }
+
+        for (const auto& token : batch) {
+            std::error_code ec;
+            fs::remove_all(token_folder(TokenKind::Send, token), ec);
+        }
+        if (released) {
+            collectGarbageBlobs();
+        }
+        reaped_ += batch.size();
+        logMessage(LogLevel::Info, "Expired shares removed", { {"count", std::to_string(batch.size())} });
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap_;
+    std::unordered_map<std::string, std::time_t> expires_;  ///< Действующий срок каждой ссылки в расписании
+    std::unordered_map<std::string, size_t> holds_;         ///< Число идущих отдач каждой ссылки
+    std::unordered_set<std::string> deferred_;              ///< Истёкшие ссылки, ждущие конца отдачи
+    std::unordered_set<std::string> reaping_;               ///< Ссылки текущей пачки удаления
+    std::thread thread_;
+    std::atomic<uint64_t> reaped_{0};
+    bool stop_ = false;
+};
+
+ShareReaper& getShareReaper();
+std::time_t register_share(const std::string& token, uint64_t ttl, uint64_t max_downloads);
+void share_params_from(const httplib::Request& req, uint64_t& ttl, uint64_t& max_downloads);
+uint64_t share_content_size(const std::string& token);
+bool record_share_transfer(const std::string& token, uint64_t bytes);
+bool record_share_download(const std::string& token);
+void loadShares();
+
+/**
+ * @brief Размер буфера одной операции ввода-вывода хранилища (в байтах)
+ */
+const size_t IO_BUFFER_SIZE = 256 * 1024;
+
+/**
+ * @brief Выравнивание буферов, смещений и длин для O_DIRECT
+ */
+const size_t IO_ALIGNMENT = 4096;
+
+/**
+ * @brief Режим открытия файла хранилища
+ */
+enum class StorageMode {
+    Read,       ///< Чтение существующего файла
+    Write,      ///< Создание или усечение файла, последовательная запись
+    Update      ///< Запись по смещениям в существующий файл
+};
+
+/**
+ * @brief Открытый файл хранилища
+ * 
+ * Запись может выполняться отложенно: данные копируются во внутренний буфер,
+ * а результат всех записей становится известен после flush().
+ */
+class StorageFile {
+public:
+    virtual ~StorageFile() = default;
+
+    /**
+     * @brief Размер файла на момент открытия
+     */
+    virtual uint64_t size() const = 0;
+
+    /**
+     * @brief Время изменения файла на момент открытия
+     */
+    virtual std::time_t mtime() const = 0;
+
+    /**
+     * @brief Запись данных по смещению
+     * 
+     * @param offset Смещение от начала файла
+     * @param data Данные (копируются до возврата)
+     * @param length Длина данных
+     * @return true Запись принята
+     * @return false Ошибка одной из предыдущих или текущей записи
+     */
+    virtual bool write_at(uint64_t offset, const char* data, size_t length) = 0;
+
+    /**
+     * @brief Чтение фрагмента (не больше IO_BUFFER_SIZE) во внутренний буфер
+     * 
+     * @param offset Смещение от начала файла
+     * @param length Запрошенная длина
+     * @param data Указатель на данные, действителен до следующего вызова
+     * @param read Прочитано байт (меньше length только в конце файла)
+     * @return true Успешно
+     * @return false Ошибка чтения
+     */
+    virtual bool read_chunk(uint64_t offset, size_t length, const char*& data, size_t& read) = 0;
+
+    /**
+     * @brief Ожидание завершения всех записей
+     * 
+     * @return true Все записи выполнены
+     * @return false Хотя бы одна запись завершилась ошибкой
+     */
+    virtual bool flush() = 0;
+};
+
+/**
+ * @brief Реализация ввода-вывода хранилища
+ */
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief Отдавать файлы через mmap (MappedFile), а не через read_chunk
+     */
+    virtual bool maps_reads() const = 0;
+
+    /**
+     * @brief Открытие файла
+     * 
+     * @param path Путь к файлу
+     * @param mode Режим открытия
+     * @return std::unique_ptr<StorageFile> Файл или nullptr, если он не открылся
+     *         (для чтения — также если это не обычный файл)
+     */
+    virtual std::unique_ptr<StorageFile> open(const std::string& path, StorageMode mode) = 0;
+};
+
+/**
+ * @brief Файл с синхронными pread/pwrite (на Windows — std::fstream)
+ */
+class PosixStorageFile : public StorageFile {
+public:
+#ifndef _WIN32
+    PosixStorageFile(int fd, uint64_t size, std::time_t mtime) : fd_(fd), size_(size), mtime_(mtime) {}
+
+    ~PosixStorageFile() override {
+        ::close(fd_);
+    }
+#else
+    PosixStorageFile(std::fstream stream, uint64_t size, std::time_t mtime)
+        : stream_(std::move(stream)), size_(size), mtime_(mtime) {}
+#endif
+
+    uint64_t size() const override {
+        return size_;
+    }
+
+    std::time_t mtime() const override {
+        return mtime_;
+    }
+
+    bool write_at(uint64_t offset, const char* data, size_t length) override {
+#ifndef _WIN32
+        while (length > 0) {
+            ssize_t written = ::pwrite(fd_, data, length, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                failed_ = true;
+                return false;
+            }
+            data += written;
+            offset += static_cast<uint64_t>(written);
+            length -= static_cast<size_t>(written);
+        }
+#else
+        stream_.seekp(static_cast<std::streamoff>(offset));
+        stream_.write(data, static_cast<std::streamsize>(length));
+        failed_ = failed_ || !stream_.good();
+#endif
+        return !failed_;
+    }
+
+    bool read_chunk(uint64_t offset, size_t length, const char*& data, size_t& read) override {
+        buffer_.resize(std::min(length, IO_BUFFER_SIZE));
+        read = 0;
+#ifndef _WIN32
+        while (read < buffer_.size()) {
+            ssize_t got = ::pread(fd_, buffer_.data() + read, buffer_.size() - read, static_cast<off_t>(offset + read));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                return false;
+            }
+            if (got == 0) {
+                break;
+            }
+            read += static_cast<size_t>(got);
+        }
+#else
+        stream_.clear();
+        stream_.seekg(static_cast<std::streamoff>(offset));
+        stream_.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        read = static_cast<size_t>(stream_.gcount());
+        if (stream_.bad()) {
+            return false;
+        }
+#endif
+        data = buffer_.data();
+        return true;
+    }
+
+    bool flush() override {
+#ifdef _WIN32
+        stream_.flush();
+        failed_ = failed_ || !stream_.good();
+#endif
+        return !failed_;
+    }
+
+private:
+#ifndef _WIN32
+    int fd_;
+#else
+    std::fstream stream_;
+#endif
+    uint64_t size_;
+    std::time_t mtime_;
+    std::vector<char> buffer_;
+    bool failed_ = false;
+};
+
+/**
+ * @brief Ввод-вывод через обычные системные вызовы
+ * 
+ * Отдача файлов идёт через mmap, запись и чтение для хеширования — pwrite/pread.
+ */
+class PosixStorage : public StorageBackend {
+public:
+    const char* name() const override {
+        return "posix";
+    }
+
+    bool maps_reads() const override {
+        return true;
+    }
+
+    std::unique_ptr<StorageFile> open(const std::string& path, StorageMode mode) override {
+#ifndef _WIN32
+        int flags = mode == StorageMode::Read ? O_RDONLY : mode == StorageMode::Write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDWR;
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return nullptr;
+        }
+        return std::make_unique<PosixStorageFile>(fd, static_cast<uint64_t>(st.st_size), st.st_mtime);
+#else
+        std::error_code ec;
+        if (mode != StorageMode::Write && !fs::is_regular_file(path, ec)) {
+            return nullptr;
+        }
+        std::ios::openmode flags = std::ios::binary | (mode == StorageMode::Read ? std::ios::in :
+                                   mode == StorageMode::Write ? std::ios::out | std::ios::trunc : std::ios::in | std::ios::out);
+        std::fstream stream(path, flags);
+        if (!stream.is_open()) {
+            return nullptr;
+        }
+        uint64_t size = mode == StorageMode::Write ? 0 : fs::file_size(path, ec);
+        return std::make_unique<PosixStorageFile>(std::move(stream), size, to_time_t(fs::last_write_time(path, ec)));
+#endif
+    }
+};
+
+#ifdef HAVE_IO_URING
+/**
+ * @brief Кольцо io_uring на системных вызовах без liburing
+ * 
+ * Одна очередь отправки и одна очередь завершений, отображённые в память.
+ * Используется одним потоком, синхронизация нужна только с ядром.
+ */
+class IoRing {
+public:
+    explicit IoRing(unsigned entries) {
+        io_uring_params params{};
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return;
+        }
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (single) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            return;
+        }
+        cq_ptr_ = single ? sq_ptr_ : ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = nullptr;
+            return;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        char* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqe_tail_ = submitted_ = *sq_tail_;
+        valid_ = true;
+    }
+
+    ~IoRing() {
+        if (sqes_) {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+            ::munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_) {
+            ::munmap(sq_ptr_, sq_size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    bool is_valid() const {
+        return valid_;
+    }
+
+    /**
+     * @brief Регистрация фиксированных буферов (READ_FIXED/WRITE_FIXED)
+     */
+    bool register_buffers(const iovec* buffers, unsigned count) {
+        return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    /**
+     * @brief Следующий свободный элемент очереди отправки
+     * 
+     * @return io_uring_sqe* Обнулённый элемент или nullptr, если очередь полна
+     */
+    io_uring_sqe* next_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) {
+            return nullptr;
+        }
+        unsigned index = sqe_tail_ & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    /**
+     * @brief Отправка всех подготовленных элементов одним вызовом io_uring_enter
+     */
+    bool submit() {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        while (submitted_ != sqe_tail_) {
+            int ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, sqe_tail_ - submitted_, 0, 0, nullptr, 0));
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                return false;
+            }
+            submitted_ += static_cast<unsigned>(ret);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Извлечение завершения без ожидания
+     */
+    bool pop(uint64_t& user_data, int& result) {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        user_data = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Ожидание и извлечение завершения
+     */
+    bool wait(uint64_t& user_data, int& result) {
+        while (!pop(user_data, result)) {
+            int ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (ret < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int fd_ = -1;
+    bool valid_ = false;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_size_ = 0;
+    size_t cq_size_ = 0;
+    size_t sqes_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned sqe_tail_ = 0;
+    unsigned submitted_ = 0;
+};
+
+/**
+ * @brief Число файлов, одновременно открытых в одном потоке, на которое рассчитано кольцо потока
+ */
+const unsigned URING_FILES_PER_RING = 4;
+
+/**
+ * @brief Наибольшее число буферов общего пула io_uring (по IO_BUFFER_SIZE)
+ */
+const unsigned URING_POOL_MAX_BUFFERS = 256;
+
+/**
+ * @brief Общий пул буферов io_uring
+ * 
+ * Одна выровненная область из count буферов по IO_BUFFER_SIZE. Кольцо каждого
+ * потока регистрирует область целиком, поэтому номер буфера одинаков во всех
+ * кольцах, а файлы берут буферы из пула при открытии и возвращают при закрытии.
+ */
+class UringBufferPool {
+public:
+    explicit UringBufferPool(unsigned count) {
+        void* memory = nullptr;
+        if (count == 0 || ::posix_memalign(&memory, IO_ALIGNMENT, static_cast<size_t>(count) * IO_BUFFER_SIZE) != 0) {
+            return;
+        }
+        memory_ = static_cast<char*>(memory);
+        iovecs_.resize(count);
+        for (unsigned i = 0; i < count; ++i) {
+            iovecs_[i].iov_base = data(i);
+            iovecs_[i].iov_len = IO_BUFFER_SIZE;
+            free_.push_back(count - 1 - i);
+        }
+    }
+
+    ~UringBufferPool() {
+        std::free(memory_);
+    }
+
+    UringBufferPool(const UringBufferPool&) = delete;
+    UringBufferPool& operator=(const UringBufferPool&) = delete;
+
+    bool is_valid() const {
+        return memory_ != nullptr;
+    }
+
+    const std::vector<iovec>& iovecs() const {
+        return iovecs_;
+    }
+
+    char* data(unsigned index) const {
+        return memory_ + static_cast<size_t>(index) * IO_BUFFER_SIZE;
+    }
+
+    /**
+     * @brief Выдача count свободных буферов
+     * 
+     * @return false Свободных буферов меньше count, ничего не выдано
+     */
+    bool acquire(unsigned count, std::vector<unsigned>& indices) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < count) {
+            return false;
+        }
+        indices.assign(free_.end() - count, free_.end());
+        free_.resize(free_.size() - count);
+        return true;
+    }
+
+    void release(const std::vector<unsigned>& indices) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.insert(free_.end(), indices.begin(), indices.end());
+    }
+
+private:
+    char* memory_ = nullptr;
+    std::vector<iovec> iovecs_;
+    std::mutex mutex_;
+    std::vector<unsigned> free_;
+};
+
+class UringStorageFile;
+
+/**
+ * @brief Буфер файла и операция над ним; адрес служит user_data операции в кольце
+ */
+struct UringSlot {
+    enum class State { Free, Filling, Pending, Ready };
+
+    UringStorageFile* owner = nullptr;
+    char* data = nullptr;
+    int buf_index = -1;         ///< Номер в общем пуле или -1 для собственного буфера файла
+    uint64_t offset = 0;
+    size_t length = 0;
+    size_t done = 0;
+    State state = State::Free;
+    bool error = false;
+};
+
+/**
+ * @brief Кольцо io_uring потока обработки
+ * 
+ * Создаётся один раз на поток и обслуживает все файлы, открытые в нём, так что
+ * открытие файла не требует io_uring_setup, mmap и регистрации буферов, а
+ * операции нескольких файлов потока отправляются общими вызовами io_uring_enter.
+ * Завершение передаётся файлу-владельцу по адресу UringSlot.
+ */
+class UringThreadRing {
+public:
+    UringThreadRing(unsigned entries, const UringBufferPool& pool) : ring_(entries) {
+        fixed_ = ring_.is_valid() && pool.is_valid() &&
+                 ring_.register_buffers(pool.iovecs().data(), static_cast<unsigned>(pool.iovecs().size()));
+    }
+
+    bool is_valid() const {
+        return ring_.is_valid();
+    }
+
+    /**
+     * @brief Зарегистрирован ли общий пул буферов (READ_FIXED/WRITE_FIXED)
+     */
+    bool fixed() const {
+        return fixed_;
+    }
+
+    /**
+     * @brief Свободный элемент очереди отправки
+     * 
+     * Если очередь занята операциями других файлов потока, они отправляются,
+     * а при необходимости обрабатывается одно завершение.
+     */
+    io_uring_sqe* next_sqe() {
+        io_uring_sqe* sqe = ring_.next_sqe();
+        while (!sqe) {
+            if (!ring_.submit()) {
+                return nullptr;
+            }
+            sqe = ring_.next_sqe();
+            if (!sqe && !reap_one()) {
+                return nullptr;
+            }
+        }
+        return sqe;
+    }
+
+    bool submit() {
+        return ring_.submit();
+    }
+
+    bool reap_one();
+
+private:
+    IoRing ring_;
+    bool fixed_ = false;
+};
+
+/**
+ * @brief Файл с асинхронным вводом-выводом через io_uring
+ * 
+ * Операции идут через кольцо потока, открывшего файл (UringThreadRing), поэтому
+ * файл используется только в этом потоке. Файл берёт depth буферов из общего
+ * пула, а если пул исчерпан — выделяет собственные, незарегистрированные.
+ * Запись копирует данные в буфер и отправляет его, когда он заполнен, не
+ * дожидаясь завершения, — поток обработки блокируется, только когда заняты все
+ * буферы. Чтение подряд идущих фрагментов заранее ставит в очередь следующие
+ * фрагменты одним вызовом io_uring_enter. При O_DIRECT последний невыровненный
+ * фрагмент записывается после снятия флага.
+ */
+class UringStorageFile : public StorageFile {
+public:
+    UringStorageFile(int fd, StorageMode mode, unsigned depth, bool direct, uint64_t size, std::time_t mtime,
+                     UringThreadRing& ring, UringBufferPool& pool)
+        : fd_(fd), reading_(mode == StorageMode::Read), direct_(direct), size_(size), mtime_(mtime),
+          ring_(ring), pool_(pool), slots_(depth) {
+        if (!ring_.is_valid()) {
+            return;
+        }
+        if (ring_.fixed() && pool_.acquire(depth, pooled_)) {
+            for (unsigned i = 0; i < depth; ++i) {
+                slots_[i].data = pool_.data(pooled_[i]);
+                slots_[i].buf_index = static_cast<int>(pooled_[i]);
+            }
+        }
+        else {
+            void* memory = nullptr;
+            if (::posix_memalign(&memory, IO_ALIGNMENT, depth * IO_BUFFER_SIZE) != 0) {
+                return;
+            }
+            buffers_ = static_cast<char*>(memory);
+            for (unsigned i = 0; i < depth; ++i) {
+                slots_[i].data = buffers_ + i * IO_BUFFER_SIZE;
+            }
+        }
+        for (auto& slot : slots_) {
+            slot.owner = this;
+        }
+        valid_ = true;
+    }
+
+    ~UringStorageFile() override {
+        if (valid_) {
+            drain();
+        }
+        if (!pooled_.empty()) {
+            pool_.release(pooled_);
+        }
+        std::free(buffers_);
+        ::close(fd_);
+    }
+
+    bool is_valid() const {
+        return valid_;
+    }
+
+    uint64_t size() const override {
+        return size_;
+    }
+
+    std::time_t mtime() const override {
+        return mtime_;
+    }
+
+    bool write_at(uint64_t offset, const char* data, size_t length) override {
+        while (length > 0 && !failed_) {
+            if (filling_ < 0 || offset != slots_[filling_].offset + slots_[filling_].length) {
+                if (filling_ >= 0 && !submit_filling()) {
+                    return false;
+                }
+                filling_ = acquire_slot();
+                if (filling_ < 0) {
+                    return false;
+                }
+                slots_[filling_].offset = offset;
+                slots_[filling_].length = 0;
+                slots_[filling_].state = UringSlot::State::Filling;
+            }
+            UringSlot& slot = slots_[filling_];
+            size_t n = std::min(length, IO_BUFFER_SIZE - slot.length);
+            std::memcpy(slot.data + slot.length, data, n);
+            slot.length += n;
+            data += n;
+            offset += n;
+            length -= n;
+            if (slot.length == IO_BUFFER_SIZE && !submit_filling()) {
+                return false;
+            }
+        }
+        return !failed_;
+    }
+
+    bool read_chunk(uint64_t offset, size_t length, const char*& data, size_t& read) override {
+        length = std::min(length, IO_BUFFER_SIZE);
+        if (returned_ >= 0) {
+            slots_[returned_].state = UringSlot::State::Free;
+            returned_ = -1;
+        }
+
+        int target = -1;
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            if (slots_[i].state != UringSlot::State::Free && slots_[i].offset == offset && slots_[i].length == length) {
+                target = static_cast<int>(i);
+            }
+        }
+        if (target < 0) {
+            // Чтение не с того места, где ожидалось: упреждающие чтения бесполезны
+            drain();
+            for (auto& slot : slots_) {
+                slot.state = UringSlot::State::Free;
+            }
+            target = 0;
+            queue(target, offset, length);
+            ahead_ = offset + length;
+        }
+        for (size_t i = 0; i < slots_.size() && ahead_ < size_; ++i) {
+            if (slots_[i].state == UringSlot::State::Free) {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(length, size_ - ahead_));
+                queue(static_cast<int>(i), ahead_, n);
+                ahead_ += n;
+            }
+        }
+        if (!ring_.submit()) {
+            return false;
+        }
+
+        while (slots_[target].state == UringSlot::State::Pending) {
+            if (!reap()) {
+                return false;
+            }
+        }
+        if (slots_[target].error) {
+            slots_[target].state = UringSlot::State::Free;
+            return false;
+        }
+        data = slots_[target].data;
+        read = slots_[target].done;
+        returned_ = target;
+        return true;
+    }
+
+    bool flush() override {
+        if (filling_ >= 0) {
+            submit_filling();
+        }
+        drain();
+        return !failed_;
+    }
+
+    /**
+     * @brief Обработка завершения операции над буфером slot
+     * 
+     * Вызывается кольцом потока, в том числе пока поток ждёт операцию другого файла.
+     * Неполная операция досылается.
+     */
+    void complete(UringSlot& slot, int result) {
+        --in_flight_;
+        if (result < 0 || (result == 0 && !reading_)) {
+            slot.error = true;
+            slot.state = reading_ ? UringSlot::State::Ready : UringSlot::State::Free;
+            failed_ = failed_ || !reading_;
+            return;
+        }
+        slot.done += static_cast<size_t>(result);
+        if (result > 0 && slot.done < slot.length) {
+            prepare(slot);
+            if (!ring_.submit()) {
+                failed_ = true;
+            }
+            return;
+        }
+        slot.state = reading_ ? UringSlot::State::Ready : UringSlot::State::Free;
+    }
+
+private:
+    void queue(int index, uint64_t offset, size_t length) {
+        UringSlot& slot = slots_[index];
+        slot.offset = offset;
+        slot.length = length;
+        slot.done = 0;
+        slot.error = false;
+        prepare(slot);
+    }
+
+    void prepare(UringSlot& slot) {
+        io_uring_sqe* sqe = ring_.next_sqe();
+        if (!sqe) {
+            slot.error = true;
+            slot.state = UringSlot::State::Ready;
+            failed_ = true;
+            return;
+        }
+        if (slot.buf_index >= 0) {
+            sqe->opcode = reading_ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = static_cast<uint16_t>(slot.buf_index);
+        }
+        else {
+            sqe->opcode = reading_ ? IORING_OP_READ : IORING_OP_WRITE;
+        }
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.data + slot.done);
+        sqe->len = static_cast<uint32_t>(slot.length - slot.done);
+        sqe->off = slot.offset + slot.done;
+        sqe->user_data = reinterpret_cast<uint64_t>(&slot);
+        slot.state = UringSlot::State::Pending;
+        ++in_flight_;
+    }
+
+    bool submit_filling() {
+        int index = filling_;
+        filling_ = -1;
+        UringSlot& slot = slots_[index];
+        if (direct_ && (slot.length % IO_ALIGNMENT != 0 || slot.offset % IO_ALIGNMENT != 0)) {
+            drain();
+            ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            direct_ = false;
+        }
+        slot.done = 0;
+        prepare(slot);
+        if (!ring_.submit()) {
+            failed_ = true;
+        }
+        return !failed_;
+    }
+
+    int acquire_slot() {
+        while (true) {
+            for (size_t i = 0; i < slots_.size(); ++i) {
+                if (slots_[i].state == UringSlot::State::Free) {
+                    return static_cast<int>(i);
+                }
+            }
+            if (in_flight_ == 0 || !reap()) {
+                failed_ = true;
+                return -1;
+            }
+        }
+    }
+
+    /**
+     * @brief Ожидание одного завершения в кольце потока (возможно, чужого файла)
+     */
+    bool reap() {
+        if (!ring_.reap_one()) {
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    void drain() {
+        while (in_flight_ > 0 && reap()) {
+        }
+    }
+
+    int fd_;
+    bool reading_;
+    bool direct_;
+    uint64_t size_;
+    std::time_t mtime_;
+    UringThreadRing& ring_;
+    UringBufferPool& pool_;
+    std::vector<UringSlot> slots_;
+    std::vector<unsigned> pooled_;
+    char* buffers_ = nullptr;
+    bool valid_ = false;
+    bool failed_ = false;
+    int filling_ = -1;
+    int returned_ = -1;
+    unsigned in_flight_ = 0;
+    uint64_t ahead_ = 0;
+};
+
+inline bool UringThreadRing::reap_one() {
+    uint64_t user_data;
+    int result;
+    if (!ring_.wait(user_data, result)) {
+        return false;
+    }
+    UringSlot* slot = reinterpret_cast<UringSlot*>(user_data);
+    slot->owner->complete(*slot, result);
+    return true;
+}
+
+/**
+ * @brief Ввод-вывод через io_uring
+ * 
+ * Держит общий пул буферов и по кольцу на каждый поток, открывающий файлы.
+ * Если кольцо потока создать не удалось (лимиты, seccomp), файл открывается
+ * через PosixStorageFile.
+ */
+class UringStorage : public StorageBackend {
+public:
+    UringStorage(unsigned depth, bool direct, unsigned threads = 1)
+        : depth_(std::max(1u, depth)), direct_(direct),
+          pool_(std::min(URING_POOL_MAX_BUFFERS, depth_ * URING_FILES_PER_RING * std::max(1u, threads))),
+          id_(next_id()) {}
+
+    const char* name() const override {
+        return direct_ ? "uring+direct" : "uring";
+    }
+
+    bool maps_reads() const override {
+        return false;
+    }
+
+    std::unique_ptr<StorageFile> open(const std::string& path, StorageMode mode) override {
+        int flags = mode == StorageMode::Read ? O_RDONLY : mode == StorageMode::Write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDWR;
+        bool direct = direct_ && mode == StorageMode::Write;
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC | (direct ? O_DIRECT : 0), 0644);
+        if (fd < 0 && direct) {
+            // Файловая система без поддержки O_DIRECT (например, tmpfs)
+            direct = false;
+            fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        }
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return nullptr;
+        }
+        auto file = std::make_unique<UringStorageFile>(fd, mode, depth_, direct, static_cast<uint64_t>(st.st_size), st.st_mtime,
+                                                       thread_ring(), pool_);
+        if (file->is_valid()) {
+            return file;
+        }
+        int plain = ::dup(fd);
+        file.reset();
+        if (plain < 0) {
+            return nullptr;
+        }
+        if (direct) {
+            ::fcntl(plain, F_SETFL, ::fcntl(plain, F_GETFL) & ~O_DIRECT);
+        }
+        return std::make_unique<PosixStorageFile>(plain, static_cast<uint64_t>(st.st_size), st.st_mtime);
+    }
+
+private:
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id{0};
+        return ++id;
+    }
+
+    /**
+     * @brief Кольцо текущего потока, создаётся при первом открытии файла в потоке
+     * 
+     * Кольца хранятся по номеру хранилища: в одном потоке могут работать
+     * несколько хранилищ со своими пулами (как в bench_io).
+     */
+    UringThreadRing& thread_ring() {
+        thread_local std::unordered_map<uint64_t, std::unique_ptr<UringThreadRing>> rings;
+        auto& ring = rings[id_];
+        if (!ring) {
+            ring = std::make_unique<UringThreadRing>(depth_ * URING_FILES_PER_RING, pool_);
+        }
+        return *ring;
+    }
+
+    unsigned depth_;
+    bool direct_;
+    UringBufferPool pool_;
+    uint64_t id_;
+};
+#endif
+
+
+StorageBackend& getStorage();
+
+/**
+ * @brief Потоковая запись загружаемого файла
+ * 
+ * Данные пишутся во временный файл в папке назначения через getStorage() с
+ * одновременным подсчётом SHA-256. После успешного приёма файл сохраняется через store_blob_reference,
+ * а при её ошибке атомарно переименовывается в итоговое имя. Если запись не была
+ * завершена вызовом commit(), временный файл удаляется.
+ */
+class UploadFile {
+public:
+    UploadFile(const std::string& dir_path, const std::string& filename)
+        : final_path_(dir_path + "/" + filename),
+          temp_path_(dir_path + "/." + filename + "." + generate_send_token(8) + ".part"),
+          file_(getStorage().open(temp_path_, StorageMode::Write)) {}
+
+    ~UploadFile() {
+        if (!committed_) {
+            file_.reset();
+            std::error_code ec;
+            fs::remove(temp_path_, ec);
+        }
+    }
+
+    UploadFile(const UploadFile&) = delete;
+    UploadFile& operator=(const UploadFile&) = delete;
+
+    bool is_open() const {
+        return file_ != nullptr;
+    }
+
+    bool write(const char* data, size_t length) {
+        hash_.update(data, length);
+        bool ok = file_->write_at(size_, data, length);
+        size_ += length;
+        return ok;
+    }
+
+    uint64_t size() const {
+        return size_;
+    }
+
+    bool commit() {
+        bool flushed = file_ && file_->flush();
+        file_.reset();
+        if (!flushed) {
+            return false;
+        }
+        uint64_t previous_size = existing_file_size(final_path_);
+        if (store_blob_reference(temp_path_, final_path_, hash_.hex_digest(), size_)) {
+            committed_ = true;
+        }
+        else {
+            committed_ = store_plain_file(temp_path_, final_path_);
+        }
+        if (committed_) {
+            record_file_usage(final_path_, previous_size, size_);
+        }
+        return committed_;
+    }
+
+private:
+    std::string final_path_;
+    std::string temp_path_;
+    std::unique_ptr<StorageFile> file_;
+    Sha256 hash_;
+    uint64_t size_ = 0;
+    bool committed_ = false;
+};
+
+/**
+ * @brief Шаг, которым растёт резерв квоты при потоковом приёме (в байтах)
+ */
+const uint64_t QUOTA_RESERVE_STEP = 4 * 1024 * 1024;
+
+/**
+ * @brief Резерв квоты папки на время загрузки
+ * 
+ * Резерв берётся сразу на известный размер запроса или наращивается по мере
+ * приёма данных через reserve_folder_quota и снимается в деструкторе, когда
+ * размер файлов уже учтён record_file_usage.
+ */
+class QuotaReservation {
+public:
+    explicit QuotaReservation(std::string dir_path) : dir_path_(std::move(dir_path)) {}
+
+    ~QuotaReservation() {
+        release_folder_quota(dir_path_, reserved_);
+    }
+
+    QuotaReservation(const QuotaReservation&) = delete;
+    QuotaReservation& operator=(const QuotaReservation&) = delete;
+
+    /**
+     * @brief Резерв ещё bytes байт
+     * 
+     * @param bytes Сколько добавить к резерву
+     * @return true Место есть
+     * @return false Квота исчерпана
+     */
+    bool reserve(uint64_t bytes) {
+        if (!reserve_folder_quota(dir_path_, bytes)) {
+            return false;
+        }
+        reserved_ += bytes;
+        return true;
+    }
+
+    /**
+     * @brief Резерв не меньше total байт при приёме неизвестного размера
+     * 
+     * Чтобы не обращаться к базе на каждый фрагмент, резерв растёт шагами
+     * QUOTA_RESERVE_STEP, а у самой границы квоты — ровно на недостающее.
+     * 
+     * @param total Всего байт, которые должны быть зарезервированы
+     * @return true Место есть
+     * @return false Квота исчерпана
+     */
+    bool ensure(uint64_t total) {
+        if (total <= reserved_) {
+            return true;
+        }
+        uint64_t missing = total - reserved_;
+        return (missing < QUOTA_RESERVE_STEP && reserve(QUOTA_RESERVE_STEP)) || reserve(missing);
+    }
+
+private:
+    std::string dir_path_;
+    uint64_t reserved_ = 0;
+};
+
+/**
+ * @brief Результат приёма загружаемых файлов
+ */
+enum class UploadResult {
+    Ok,
+    Failed,
+    QuotaExceeded
+};
+
+UploadResult receive_multipart_files(const httplib::ContentReader& content_reader, const std::string& dir_path, std::vector<std::string>& filenames, uint64_t expected_size = 0);
+bool check_upload_request(const httplib::Request& req, httplib::Response& res, const std::string& dir_path = "");
+void handle_file_upload(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader);
+
+/**
+ * @brief Рекомендуемый размер фрагмента для загрузки по частям (в байтах)
+ */
+const size_t UPLOAD_CHUNK_SIZE = 4 * 1024 * 1024;
+
+/**
+ * @brief Максимальный размер одного фрагмента (в байтах)
+ */
+const size_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+
+/**
+ * @brief Время жизни незавершённой сессии загрузки (в секундах)
+ */
+const std::time_t UPLOAD_SESSION_TTL = 24 * 60 * 60;
+
+/**
+ * @brief Сессия загрузки файла по частям
+ * 
+ * Состояние хранится в таблицах upload_sessions и upload_chunks, данные — в
+ * разреженном файле uploads/<id>.part, поэтому сессия переживает перезапуск сервера.
+ */
+struct UploadSession {
+    std::string id;
+    std::string token;      ///< Токен пользователя или пустая строка для анонимной отправки
+    std::string filename;
+    uint64_t size = 0;
+    bool finalizing = false;
+};
+
+/**
+ * @brief Время, которое завершение сессии ждёт незаконченные фрагменты (в секундах)
+ */
+const std::time_t UPLOAD_FINALIZE_WAIT = 30;
+
+/**
+ * @brief Учёт фрагментов, которые сейчас пишутся в файлы сессий
+ * 
+ * Завершение сессии считает SHA-256 файла .part и переносит его в хранилище
+ * блобов, поэтому в файл никто не должен писать после начала подсчёта.
+ * Запись фрагмента начинается только через enter(), а claim() запрещает новые
+ * записи в сессию и ждёт окончания начатых.
+ */
+class UploadWriters {
+public:
+    /**
+     * @brief Начало записи фрагмента
+     * 
+     * @return false Сессия уже завершается
+     */
+    bool enter(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (claimed_.count(id)) {
+            return false;
+        }
+        ++writers_[id];
+        return true;
+    }
+
+    void leave(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = writers_.find(id);
+        if (it != writers_.end() && --it->second == 0) {
+            writers_.erase(it);
+            idle_.notify_all();
+        }
+    }
+
+    /**
+     * @brief Захват сессии для завершения
+     * 
+     * Новые фрагменты после захвата отклоняются, начатые дописываются не дольше timeout.
+     * 
+     * @return false Сессию уже завершает другой запрос или фрагменты не успели дописаться
+     */
+    bool claim(const std::string& id, std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!claimed_.insert(id).second) {
+            return false;
+        }
+        if (!idle_.wait_for(lock, timeout, [&] { return writers_.count(id) == 0; })) {
+            claimed_.erase(id);
+            return false;
+        }
+        return true;
+    }
+
+    void unclaim(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        claimed_.erase(id);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::unordered_map<std::string, unsigned> writers_;
+    std::unordered_set<std::string> claimed_;
+};
+
+UploadWriters& getUploadWriters();
+
+std::string upload_session_path(const std::string& id);
+bool load_upload_session(const std::string& id, UploadSession& session);
+std::vector<std::pair<uint64_t, uint64_t>> received_ranges(const std::string& id);
+void delete_upload_session(const std::string& id);
+void cleanupUploadSessions();
+void handle_upload_session_create(const httplib::Request& req, httplib::Response& res);
+void handle_upload_chunk(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader);
+void handle_upload_session_status(const httplib::Request& req, httplib::Response& res);
+void handle_upload_session_finalize(const httplib::Request& req, httplib::Response& res);
+
+/**
+ * @brief Наименьший размер блока подписи для дельта-загрузки
+ */
+const size_t DELTA_MIN_BLOCK = 2 * 1024;
+
+/**
+ * @brief Наибольший размер блока подписи для дельта-загрузки
+ */
+const size_t DELTA_MAX_BLOCK = 64 * 1024;
+
+/**
+ * @brief Наибольшая длина строки команды в теле дельты
+ */
+const size_t DELTA_MAX_COMMAND = 64;
+
+/**
+ * @brief Сборка новой версии файла из дельты
+ * 
+ * Тело дельты — последовательность команд:
+ * - "C <блок> <число блоков>\n" — скопировать блоки из прежней версии;
+ * - "D <длина>\n" и следом столько же байтов — вставить новые данные.
+ * Тело подаётся частями любого размера, как приходит из сети; результат
+ * пишется в UploadFile и не может превысить заявленный размер.
+ */
+class DeltaPatch {
+public:
+    DeltaPatch(StorageFile& base, size_t block, UploadFile& out, uint64_t size)
+        : base_(base), block_(block), out_(out), size_(size) {}
+
+    /**
+     * @brief Обработка очередной части тела
+     * 
+     * @return true Часть разобрана и применена
+     * @return false Ошибка в дельте или при записи
+     */
+    bool feed(const char* data, size_t length) {
+        while (length > 0) {
+            if (literal_left_ > 0) {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(literal_left_, length));
+                if (!out_.write(data, take)) {
+                    return false;
+                }
+                literal_ += take;
+                literal_left_ -= take;
+                data += take;
+                length -= take;
+                continue;
+            }
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', length));
+            size_t take = newline ? static_cast<size_t>(newline - data) : length;
+            if (command_.size() + take > DELTA_MAX_COMMAND) {
+                return false;
+            }
+            command_.append(data, take);
+            data += take;
+            length -= take;
+            if (newline) {
+                ++data;
+                --length;
+                if (!run_command()) {
+                    return false;
+                }
+                command_.clear();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Дельта разобрана до конца и собран файл заявленного размера
+     */
+    bool complete() const {
+        return command_.empty() && literal_left_ == 0 && written() == size_;
+    }
+
+    uint64_t copied() const {
+        return copied_;
+    }
+
+    uint64_t literal() const {
+        return literal_;
+    }
+
+private:
+    uint64_t written() const {
+        return copied_ + literal_;
+    }
+
+    /**
+     * @brief Выполнение разобранной строки команды
+     * 
+     * Команда — буква и неотрицательные десятичные числа через один пробел;
+     * знаки, лишние пробелы и любые символы после чисел отвергаются.
+     */
+    bool run_command() {
+        if (command_.size() < 3 || command_[1] != ' ') {
+            return false;
+        }
+        uint64_t args[2] = { 0, 0 };
+        size_t count = 0;
+        const char* position = command_.data() + 2;
+        const char* end = command_.data() + command_.size();
+        while (true) {
+            const char* space = std::find(position, end, ' ');
+            if (count == 2) {
+                return false;
+            }
+            auto result = std::from_chars(position, space, args[count]);
+            if (result.ec != std::errc() || result.ptr != space) {
+                return false;
+            }
+            ++count;
+            if (space == end) {
+                break;
+            }
+            position = space + 1;
+        }
+
+        char op = command_[0];
+        if (op == 'C' && count == 2) {
+            uint64_t first = args[0];
+            uint64_t second = args[1];
+            uint64_t blocks = (base_.size() + block_ - 1) / block_;
+            if (second == 0 || first >= blocks || second > blocks - first) {
+                return false;
+            }
+            uint64_t offset = first * block_;
+            uint64_t length = std::min<uint64_t>((first + second) * block_, base_.size()) - offset;
+            if (length > size_ - written()) {
+                return false;
+            }
+            return copy(offset, length);
+        }
+        if (op == 'D' && count == 1) {
+            if (args[0] > size_ - written()) {
+                return false;
+            }
+            literal_left_ = args[0];
+            return true;
+        }
+        return false;
+    }
+
+    bool copy(uint64_t offset, uint64_t length) {
+        const char* data;
+        size_t read;
+        while (length > 0) {
+            if (!base_.read_chunk(offset, static_cast<size_t>(std::min<uint64_t>(length, IO_BUFFER_SIZE)), data, read) ||
+                read == 0 || !out_.write(data, read)) {
+                return false;
+            }
+            offset += read;
+            length -= read;
+            copied_ += read;
+        }
+        return true;
+    }
+
+    StorageFile& base_;
+    size_t block_;
+    UploadFile& out_;
+    uint64_t size_;
+    std::string command_;
+    uint64_t literal_left_ = 0;
+    uint64_t copied_ = 0;
+    uint64_t literal_ = 0;
+};
+
+size_t delta_block_size(uint64_t size);
+uint32_t rolling_checksum(const char* data, size_t length);
+std::string signature_path_for(const std::string& hash);
+std::string compute_file_signature(const std::string& hash);
+void handle_file_signature(const httplib::Request& req, httplib::Response& res);
+void handle_delta_upload(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader);
+
+/**
+ * @brief Фрагмент шаблона: статический текст и следующий за ним слот
+ */
+struct TemplateSegment {
+    std::string text;
+    std::string slot;   ///< Имя слота {{slot}}, пустое для последнего фрагмента
+};
+
+/**
+ * @brief Загруженная HTML страница или шаблон
+ * 
+ * Тело, его сжатые варианты и ETag подготавливаются один раз при загрузке,
+ * поэтому отдача статической страницы не читает диск и не копирует тело.
+ */
+struct HtmlPage {
+    std::string body;
+    std::vector<TemplateSegment> segments;
+    std::string etag;
+    std::time_t mtime = 0;
+    std::unordered_map<int, std::string> encoded;   ///< ContentEncoding -> сжатое тело
+
+    /**
+     * @brief Подстановка значений в слоты шаблона
+     * 
+     * @param out Буфер, в который дописывается результат
+     * @param fill Обработчик вида void(const std::string& slot, std::string& out)
+     */
+    template <typename Fill>
+    void render(std::string& out, Fill&& fill) const {
+        for (const auto& segment : segments) {
+            out += segment.text;
+            if (!segment.slot.empty()) {
+                fill(segment.slot, out);
+            }
+        }
+    }
+};
+
+std::vector<TemplateSegment> split_template(const std::string& body);
+
+/**
+ * @brief Хранилище HTML страниц и шаблонов из HTML_PATH
+ * 
+ * Страницы читаются при первом обращении и дальше отдаются из памяти. При
+ * включённом template_reload изменение mtime файла проверяется не чаще раза
+ * в секунду, и изменённая страница перечитывается.
+ */
+class TemplateStore {
+public:
+    /**
+     * @brief Получение страницы
+     * 
+     * @param name Имя файла в HTML_PATH
+     * @return std::shared_ptr<const HtmlPage> Страница или nullptr, если файла нет
+     */
+    std::shared_ptr<const HtmlPage> get(const std::string& name) {
+        auto now = std::chrono::steady_clock::now();
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = pages_.find(name);
+            if (it != pages_.end() && it->second.page && (!getServerConfig().template_reload || now < it->second.next_check)) {
+                return it->second.page;
+            }
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        Entry& entry = pages_[name];
+        if (entry.page && now < entry.next_check) {
+            return entry.page;
+        }
+        entry.next_check = now + std::chrono::seconds(1);
+        std::error_code ec;
+        std::time_t mtime = to_time_t(fs::last_write_time(HTML_PATH + name, ec));
+        if (!entry.page || (!ec && mtime != entry.page->mtime)) {
+            auto page = load(name);
+            if (page) {
+                entry.page = page;
+                logMessage(LogLevel::Info, "HTML template loaded", { {"name", name} });
+            }
+        }
+        return entry.page;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const HtmlPage> page;
+        std::chrono::steady_clock::time_point next_check;
+    };
+
+    static std::shared_ptr<const HtmlPage> load(const std::string& name) {
+        std::ifstream ifs(HTML_PATH + name, std::ios::binary);
+        if (!ifs) {
+            logMessage(LogLevel::Error, "HTML template not found", { {"name", name} });
+            return nullptr;
+        }
+        auto page = std::make_shared<HtmlPage>();
+        page->body.assign((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        page->segments = split_template(page->body);
+        std::error_code ec;
+        page->mtime = to_time_t(fs::last_write_time(HTML_PATH + name, ec));
+
+        std::stringstream etag;
+        etag << "\"" << std::hex << std::hash<std::string>{}(page->body) << "-" << page->body.size() << "\"";
+        page->etag = etag.str();
+
+        if (page->body.size() >= COMPRESS_MIN_SIZE) {
+            for (ContentEncoding encoding : supported_encodings()) {
+                StreamCompressor compressor(encoding, COMPRESS_SIDECAR_LEVEL);
+                std::string compressed;
+                if (compressor.is_valid() && compressor.compress(page->body.data(), page->body.size(), true, compressed)) {
+                    page->encoded[static_cast<int>(encoding)] = std::move(compressed);
+                }
+            }
+        }
+        return page;
+    }
+
+    std::shared_mutex mutex_;
+    std::unordered_map<std::string, Entry> pages_;
+};
+
+TemplateStore& getTemplateStore();
+void serve_static_page(const httplib::Request& req, httplib::Response& res, const std::string& name);
+void handle_file_download_page(const httplib::Request& req, httplib::Response& res);
+
+/**
+ * @brief Размер страницы JSON листинга по умолчанию
+ */
+const size_t LISTING_PAGE_SIZE = 100;
+
+/**
+ * @brief Наибольший размер страницы JSON листинга
+ */
+const size_t LISTING_MAX_PAGE_SIZE = 1000;
+
+/**
+ * @brief Позиция в листинге: ключ сортировки и имя последнего отданного файла
+ */
+struct ListingCursor {
+    int64_t key = 0;
+    std::string name;
+};
+
+char listing_sort_letter(ListingSort sort);
+int hex_value(char c);
+std::string encode_listing_cursor(ListingSort sort, int64_t key, const std::string& name);
+bool decode_listing_cursor(const std::string& value, ListingSort sort, ListingCursor& cursor);
+void handle_file_listing(const httplib::Request& req, httplib::Response& res, TokenKind kind);
+
+/**
+ * @brief Размер фрагмента, передаваемого в DataSink за один вызов
+ */
+const size_t DOWNLOAD_CHUNK_SIZE = 256 * 1024;
+
+/**
+ * @brief Объём, который отдаётся без задержки сверх ограничения скорости отдачи (байт)
+ */
+const double BANDWIDTH_BURST = 4.0 * DOWNLOAD_CHUNK_SIZE;
+
+/**
+ * @brief Число слотов таблицы вёдер RateLimiter (степень двойки)
+ */
+const size_t RATE_LIMIT_SLOTS = 1 << 16;
+
+/**
+ * @brief Число соседних слотов, в которых ищется ведро ключа
+ */
+const size_t RATE_LIMIT_PROBES = 16;
+
+/**
+ * @brief Ведро токенов в форме GCRA
+ * 
+ * Всё состояние — одно атомарное «теоретическое время прибытия» (TAT) в
+ * наносекундах steady_clock, поэтому списание выполняется одним CAS без
+ * блокировок. Ведро полно, если TAT не позже текущего времени.
+ */
+class TokenBucket {
+public:
+    /**
+     * @brief Попытка списать стоимость запроса
+     * 
+     * @param interval Наносекунд на единицу (1 / скорость)
+     * @param tolerance Запас в наносекундах (ёмкость ведра * interval)
+     * @param cost Стоимость в единицах
+     * @param now Текущее время (нс)
+     * @param retry_after Через сколько наносекунд списание пройдёт, если отказано
+     * @return true Стоимость списана
+     * @return false Ведро пусто
+     */
+    bool try_take(double interval, double tolerance, double cost, int64_t now, int64_t& retry_after) {
+        int64_t tat = tat_.load(std::memory_order_relaxed);
+        for (;;) {
+            int64_t next = std::max(tat, now) + static_cast<int64_t>(cost * interval);
+            int64_t excess = next - now - static_cast<int64_t>(tolerance);
+            if (excess > 0) {
+                retry_after = excess;
+                return false;
+            }
+            if (tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Списание в долг для ограничения скорости передачи
+     * 
+     * Каждый вызов занимает следующий отрезок времени, поэтому одновременные
+     * передачи через одно ведро получают скорость по очереди, а не наперегонки.
+     * 
+     * @return int64_t Задержка (нс), после которой переданный объём укладывается в скорость
+     */
+    int64_t take(double interval, double tolerance, double cost, int64_t now) {
+        int64_t tat = tat_.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = std::max(tat, now) + static_cast<int64_t>(cost * interval);
+        } while (!tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+        return std::max<int64_t>(0, next - now - static_cast<int64_t>(tolerance));
+    }
+
+    /**
+     * @brief Проверка, что ведро полно и его можно отдать другому ключу без потери состояния
+     */
+    bool idle(int64_t now) const {
+        return tat_.load(std::memory_order_relaxed) <= now;
+    }
+
+private:
+    std::atomic<int64_t> tat_{0};
+};
+
+/**
+ * @brief Ограничение скорости по ключу (IP или токен) набором вёдер токенов
+ * 
+ * Вёдра лежат в таблице с открытой адресацией фиксированного размера: слот
+ * хранит 64-битный хеш ключа и ведро, занимается и переиспользуется через CAS,
+ * поэтому ни поиск, ни списание не берут блокировок и «жадный» ключ не мешает
+ * соседним. Если в окне пробирования нет свободного слота, занимается полное
+ * (простаивающее) ведро другого ключа; если нет и такого — ключ делит ведро
+ * в своём исходном слоте с тем, кто его занял.
+ */
+class RateLimiter {
+public:
+    /**
+     * @param rate Единиц в секунду (0 — ограничение выключено)
+     * @param burst Ёмкость ведра в единицах
+     */
+    RateLimiter(double rate, double burst)
+        : interval_(rate > 0 ? 1e9 / rate : 0), tolerance_(interval_ * burst),
+          slots_(rate > 0 ? RATE_LIMIT_SLOTS : 0) {}
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    bool enabled() const {
+        return interval_ > 0;
+    }
+
+    /**
+     * @brief Ведро ключа
+     * 
+     * @return TokenBucket& Ведро, которое живёт столько же, сколько ограничитель
+     */
+    TokenBucket& bucket(const std::string& key) {
+        uint64_t hash = static_cast<uint64_t>(std::hash<std::string>{}(key)) | 1;
+        size_t mask = slots_.size() - 1;
+        size_t home = static_cast<size_t>(hash) & mask;
+        for (size_t probe = 0; probe < RATE_LIMIT_PROBES; ++probe) {
+            Slot& slot = slots_[(home + probe) & mask];
+            uint64_t owner = slot.key.load(std::memory_order_acquire);
+            if (owner == hash) {
+                return slot.bucket;
+            }
+            if (owner == 0 && (slot.key.compare_exchange_strong(owner, hash, std::memory_order_acq_rel) || owner == hash)) {
+                return slot.bucket;
+            }
+        }
+        int64_t now = now_ns();
+        for (size_t probe = 0; probe < RATE_LIMIT_PROBES; ++probe) {
+            Slot& slot = slots_[(home + probe) & mask];
+            uint64_t owner = slot.key.load(std::memory_order_acquire);
+            if (slot.bucket.idle(now) && (slot.key.compare_exchange_strong(owner, hash, std::memory_order_acq_rel) || owner == hash)) {
+                return slot.bucket;
+            }
+        }
+        return slots_[home].bucket;
+    }
+
+    /**
+     * @brief Допуск запроса
+     * 
+     * @param key Ключ (IP или токен)
+     * @param retry_after Через сколько секунд повторить, если отказано
+     * @return true Запрос допущен
+     * @return false Скорость по ключу превышена
+     */
+    bool admit(const std::string& key, double& retry_after) {
+        int64_t wait = 0;
+        if (bucket(key).try_take(interval_, tolerance_, 1, now_ns(), wait)) {
+            return true;
+        }
+        retry_after = wait / 1e9;
+        return false;
+    }
+
+    /**
+     * @brief Списание переданного объёма
+     * 
+     * @return std::chrono::nanoseconds Сколько подождать перед передачей
+     */
+    std::chrono::nanoseconds take(TokenBucket& bucket, double cost) {
+        return std::chrono::nanoseconds(bucket.take(interval_, tolerance_, cost, now_ns()));
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0};
+        TokenBucket bucket;
+    };
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double interval_;
+    double tolerance_;
+    std::vector<Slot> slots_;
+};
+
+/**
+ * @brief Ограничения скорости сервера: запросы и отдача по IP и по токену
+ */
+struct RateLimits {
+    RateLimiter ip_requests;
+    RateLimiter token_requests;
+    RateLimiter ip_bytes;
+    RateLimiter token_bytes;
+};
+
+RateLimits& getRateLimits();
+
+/**
+ * @brief Вёдра скорости отдачи для запроса, который обслуживает текущий поток
+ * 
+ * Заполняются в pre-routing обработчике (admit_request). Провайдер содержимого
+ * httplib вызывается в том же потоке, что и обработчик, поэтому отдача файла
+ * находит вёдра своего запроса без передачи их через все функции отдачи.
+ */
+struct DownloadShaper {
+    TokenBucket* ip = nullptr;
+    TokenBucket* token = nullptr;
+};
+
+extern thread_local DownloadShaper t_download_shaper;
+
+void account_download(size_t bytes);
+std::string request_token(const std::string& path);
+bool admit_request(const httplib::Request& req, httplib::Response& res);
+
+/**
+ * @brief Файл, открытый только для чтения и отображённый в память
+ * 
+ * Данные передаются в сокет напрямую из отображения, без промежуточных копий
+ * в std::string. На Windows и с хранилищем, которое не отдаёт файлы через mmap
+ * (io_uring), отображение заменяется чтением фрагментами через StorageFile.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifndef _WIN32
+        if (!getStorage().maps_reads()) {
+            open_reader(path);
+            return;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            size_ = static_cast<size_t>(st.st_size);
+            mtime_ = st.st_mtime;
+            if (size_ > 0) {
+                void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    ::madvise(data, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(data);
+                }
+            }
+            valid_ = size_ == 0 || data_ != nullptr;
+        }
+        ::close(fd);
+#else
+        open_reader(path);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool is_valid() const {
+        return valid_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    std::time_t mtime() const {
+        return mtime_;
+    }
+
+    /**
+     * @brief Передача фрагмента файла в DataSink
+     * 
+     * @param offset Смещение от начала файла
+     * @param length Запрошенная длина
+     * @param sink Приёмник данных httplib
+     * @return true Фрагмент передан
+     * @return false Соединение закрыто или ошибка чтения
+     */
+    bool write_to(size_t offset, size_t length, httplib::DataSink& sink) {
+        return with_chunk(offset, length, [&sink](const char* data, size_t chunk) {
+            return sink.write(data, chunk);
+        });
+    }
+
+    /**
+     * @brief Передача фрагмента файла (не больше DOWNLOAD_CHUNK_SIZE) обработчику
+     * 
+     * @param offset Смещение от начала файла
+     * @param length Запрошенная длина
+     * @param consumer Обработчик вида bool(const char* data, size_t length)
+     * @return true Обработчик вернул true
+     * @return false Ошибка чтения или обработчик вернул false
+     */
+    template <typename Consumer>
+    bool with_chunk(size_t offset, size_t length, Consumer&& consumer) {
+        size_t chunk = std::min(length, DOWNLOAD_CHUNK_SIZE);
+        if (!reader_) {
+            return consumer(data_ + offset, chunk);
+        }
+        const char* data;
+        size_t read;
+        chunk = std::min(chunk, IO_BUFFER_SIZE);
+        return reader_->read_chunk(offset, chunk, data, read) && read == chunk && consumer(data, chunk);
+    }
+
+private:
+    void open_reader(const std::string& path) {
+        reader_ = getStorage().open(path, StorageMode::Read);
+        if (reader_) {
+            size_ = static_cast<size_t>(reader_->size());
+            mtime_ = reader_->mtime();
+            valid_ = true;
+        }
+    }
+
+    const char* data_ = nullptr;
+    std::unique_ptr<StorageFile> reader_;
+    size_t size_ = 0;
+    std::time_t mtime_ = 0;
+    bool valid_ = false;
+};
+
+std::string http_date(std::time_t time);
+
+/**
+ * @brief Частотный скетч (count-min, 4-битные счётчики) для допуска в кэш
+ * 
+ * Оценивает, как часто запрашивался ключ за последнее время: после
+ * sample_size обращений все счётчики делятся пополам (старение, TinyLFU).
+ */
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t width) : mask_(round_up(width) - 1), table_(ROWS * (mask_ + 1), 0),
+                                             sample_size_(10 * (mask_ + 1)) {}
+
+    void increment(size_t hash) {
+        bool added = false;
+        for (size_t row = 0; row < ROWS; ++row) {
+            uint8_t& counter = table_[index(hash, row)];
+            if (counter < 15) {
+                ++counter;
+                added = true;
+            }
+        }
+        if (added && ++additions_ >= sample_size_) {
+            for (auto& counter : table_) {
+                counter >>= 1;
+            }
+            additions_ /= 2;
+        }
+    }
+
+    uint8_t frequency(size_t hash) const {
+        uint8_t result = 15;
+        for (size_t row = 0; row < ROWS; ++row) {
+            result = std::min(result, table_[index(hash, row)]);
+        }
+        return result;
+    }
+
+private:
+    static const size_t ROWS = 4;
+
+    static size_t round_up(size_t value) {
+        size_t result = 64;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    size_t index(size_t hash, size_t row) const {
+        uint64_t mixed = (static_cast<uint64_t>(hash) + row) * 0x9E3779B97F4A7C15ULL;
+        mixed ^= mixed >> 29;
+        return row * (mask_ + 1) + (static_cast<size_t>(mixed) & mask_);
+    }
+
+    size_t mask_;
+    std::vector<uint8_t> table_;
+    size_t sample_size_;
+    size_t additions_ = 0;
+};
+
+/**
+ * @brief Кэш содержимого популярных файлов в памяти
+ * 
+ * Сегментированный LRU (испытательный сегмент 20% и защищённый 80% объёма)
+ * с допуском TinyLFU: когда места нет, новый файл вытесняет жертву, только если
+ * по частотному скетчу запрашивался чаще неё. Поэтому разовые скачивания не
+ * вымывают горячие файлы. Ключ — файл (inode) и вариант кодирования, запись
+ * действительна, пока совпадают размер и mtime файла. Содержимое хранится в неизменяемой строке,
+ * которую ответы разделяют без копирования.
+ */
+class HotFileCache {
+public:
+    HotFileCache(uint64_t capacity, uint64_t max_file)
+        : capacity_(capacity), protected_capacity_(capacity / 5 * 4), max_file_(max_file),
+          sketch_(static_cast<size_t>(std::max<uint64_t>(1024, capacity / 16384))) {}
+
+    bool enabled() const {
+        return capacity_ > 0;
+    }
+
+    /**
+     * @brief Поиск содержимого
+     * 
+     * @param key Ключ (путь и кодирование)
+     * @param size Текущий размер файла
+     * @param mtime Текущее время изменения файла
+     * @return std::shared_ptr<const std::string> Содержимое или nullptr при промахе
+     */
+    std::shared_ptr<const std::string> get(const std::string& key, uint64_t size, std::time_t mtime) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sketch_.increment(std::hash<std::string>()(key));
+        auto it = index_.find(key);
+        if (it == index_.end() || it->second->size != size || it->second->mtime != mtime) {
+            if (it != index_.end()) {
+                remove(it->second);
+            }
+            misses().add(1);
+            return nullptr;
+        }
+        auto entry = it->second;
+        if (!entry->is_protected) {
+            // Повторное обращение переводит файл в защищённый сегмент
+            protected_.splice(protected_.begin(), probation_, entry);
+            entry->is_protected = true;
+            protected_bytes_ += entry->body->size();
+            while (protected_bytes_ > protected_capacity_ && protected_.size() > 1) {
+                auto demoted = std::prev(protected_.end());
+                demoted->is_protected = false;
+                protected_bytes_ -= demoted->body->size();
+                probation_.splice(probation_.begin(), protected_, demoted);
+            }
+        }
+        else {
+            protected_.splice(protected_.begin(), protected_, entry);
+        }
+        hits().add(1);
+        return entry->body;
+    }
+
+    /**
+     * @brief Стоит ли загружать файл в кэш
+     * 
+     * @param key Ключ
+     * @param size Размер содержимого
+     * @return true Файл помещается без вытеснения или популярнее кандидата на вытеснение
+     */
+    bool admit(const std::string& key, uint64_t size) {
+        if (size > max_file_ || size > capacity_) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bytes_ + size <= capacity_) {
+            return true;
+        }
+        const std::list<Entry>& victims = probation_.empty() ? protected_ : probation_;
+        bool admitted = victims.empty() ||
+            sketch_.frequency(std::hash<std::string>()(key)) > sketch_.frequency(std::hash<std::string>()(victims.back().key));
+        if (!admitted) {
+            rejections().add(1);
+        }
+        return admitted;
+    }
+
+    /**
+     * @brief Добавление содержимого в испытательный сегмент
+     */
+    void put(const std::string& key, uint64_t size, std::time_t mtime, std::shared_ptr<const std::string> body) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            remove(it->second);
+        }
+        while (bytes_ + body->size() > capacity_ && (!probation_.empty() || !protected_.empty())) {
+            remove(probation_.empty() ? std::prev(protected_.end()) : std::prev(probation_.end()));
+            evictions().add(1);
+        }
+        bytes_ += body->size();
+        probation_.push_front(Entry{ key, size, mtime, std::move(body), false });
+        index_[key] = probation_.begin();
+    }
+
+    uint64_t bytes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    size_t entries() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return index_.size();
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t size;
+        std::time_t mtime;
+        std::shared_ptr<const std::string> body;
+        bool is_protected;
+    };
+
+    void remove(std::list<Entry>::iterator entry) {
+        bytes_ -= entry->body->size();
+        if (entry->is_protected) {
+            protected_bytes_ -= entry->body->size();
+            index_.erase(entry->key);
+            protected_.erase(entry);
+        }
+        else {
+            index_.erase(entry->key);
+            probation_.erase(entry);
+        }
+    }
+
+    static MetricCounter& hits() {
+        static MetricCounter& counter = getMetrics().counter("hsecloud_hot_cache_hits_total", "Downloads served from the in-memory file cache.");
+        return counter;
+    }
+
+    static MetricCounter& misses() {
+        static MetricCounter& counter = getMetrics().counter("hsecloud_hot_cache_misses_total", "Downloads not found in the in-memory file cache.");
+        return counter;
+    }
+
+    static MetricCounter& evictions() {
+        static MetricCounter& counter = getMetrics().counter("hsecloud_hot_cache_evictions_total", "Files evicted from the in-memory file cache.");
+        return counter;
+    }
+
+    static MetricCounter& rejections() {
+        static MetricCounter& counter = getMetrics().counter("hsecloud_hot_cache_rejections_total", "Files refused by the cache admission policy.");
+        return counter;
+    }
+
+    uint64_t capacity_;
+    uint64_t protected_capacity_;
+    uint64_t max_file_;
+    std::mutex mutex_;
+    std::list<Entry> probation_;
+    std::list<Entry> protected_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    uint64_t bytes_ = 0;
+    uint64_t protected_bytes_ = 0;
+    FrequencySketch sketch_;
+};
+
+HotFileCache& getHotFileCache();
+
+/**
+ * @brief Сведения о файле для отдачи
+ */
+struct FileStat {
+    uint64_t size = 0;
+    std::time_t mtime = 0;
+    std::string identity;   ///< Устройство и inode (на Windows — путь): общий для жёстких ссылок на один блоб
+};
+
+bool stat_file(const std::string& path, FileStat& info);
+std::shared_ptr<const std::string> read_whole_file(const std::string& path, uint64_t size);
+std::shared_ptr<const std::string> cached_file_body(const std::string& file_path, ContentEncoding encoding, const FileStat& info);
+uint64_t ranges_length(const httplib::Ranges& ranges, uint64_t size);
+bool serve_file(const httplib::Request& req, httplib::Response& res, const std::string& file_path, const std::string& filename,
+                const std::function<bool(uint64_t)>& admit = nullptr);
+
+/**
+ * @brief Файлы не меньше этого размера кладутся в ZIP без сжатия
+ * 
+ * Размер сжатых данных заранее неизвестен, поэтому сжимаются только файлы,
+ * которые заведомо останутся меньше 4 ГиБ и не потребуют ZIP64 для размера.
+ */
+const uint64_t ZIP_DEFLATE_LIMIT = 0xF0000000ULL;
+
+/**
+ * @brief Размер порции центрального каталога ZIP за один вызов провайдера
+ */
+const size_t ZIP_DIRECTORY_CHUNK = 64 * 1024;
+
+/**
+ * @brief Потоковая сборка ZIP архива из файлов папки
+ * 
+ * Архив формируется по мере отправки: локальный заголовок, данные файла
+ * фрагментами из MappedFile (store или deflate), дескриптор с CRC и размерами,
+ * затем центральный каталог. В памяти хранятся только текущий фрагмент и по
+ * одной короткой записи на файл для центрального каталога, архив целиком
+ * нигде не собирается. Размеры и смещения за 4 ГиБ, как и больше 65535 файлов,
+ * записываются в формате ZIP64.
+ */
+class ZipStream {
+public:
+    ZipStream(std::string dir_path, FileList files) : dir_path_(std::move(dir_path)), files_(std::move(files)) {
+    }
+
+    ~ZipStream() {
+        if (deflate_ready_) {
+            deflateEnd(&zs_);
+        }
+    }
+
+    ZipStream(const ZipStream&) = delete;
+    ZipStream& operator=(const ZipStream&) = delete;
+
+    bool done() const {
+        return state_ == State::Done;
+    }
+
+    /**
+     * @brief Формирование следующей части архива
+     * 
+     * @param out Буфер, в который дописываются байты архива
+     * @return true Успешно (out может остаться пустым, если файл пропущен)
+     * @return false Ошибка чтения или сжатия, архив оборван
+     */
+    bool next(std::string& out) {
+        size_t before = out.size();
+        bool ok = true;
+        switch (state_) {
+        case State::Header:
+            open_entry(out);
+            break;
+        case State::Data:
+            ok = write_data(out);
+            break;
+        case State::Descriptor:
+            write_descriptor(out);
+            break;
+        case State::Directory:
+            write_directory(out);
+            break;
+        case State::End:
+            write_end(out);
+            break;
+        case State::Done:
+            break;
+        }
+        offset_ += out.size() - before;
+        return ok;
+    }
+
+private:
+    enum class State { Header, Data, Descriptor, Directory, End, Done };
+
+    /**
+     * @brief Запись центрального каталога об одном файле
+     */
+    struct Entry {
+        size_t index;       ///< Позиция в снимке папки
+        uint64_t offset;    ///< Смещение локального заголовка
+        uint64_t compressed;
+        uint64_t size;
+        uint32_t crc;
+        uint16_t method;
+        uint16_t dos_time;
+        uint16_t dos_date;
+        bool zip64;
+    };
+
+    static void put16(std::string& out, uint16_t value) {
+        out += static_cast<char>(value & 0xFF);
+        out += static_cast<char>(value >> 8);
+    }
+
+    static void put32(std::string& out, uint32_t value) {
+        put16(out, static_cast<uint16_t>(value & 0xFFFF));
+        put16(out, static_cast<uint16_t>(value >> 16));
+    }
+
+    static void put64(std::string& out, uint64_t value) {
+        put32(out, static_cast<uint32_t>(value & 0xFFFFFFFF));
+        put32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    static uint32_t clamp32(uint64_t value) {
+        return value >= 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<uint32_t>(value);
+    }
+
+    void open_entry(std::string& out) {
+        if (index_ >= files_->size()) {
+            directory_offset_ = offset_;
+            state_ = State::Directory;
+            return;
+        }
+        const FileEntry& info = (*files_)[index_];
+        file_ = std::make_unique<MappedFile>(dir_path_ + "/" + info.name);
+        if (!file_->is_valid()) {
+            // Файл удалён после снимка папки — пропускаем его целиком
+            file_.reset();
+            ++index_;
+            return;
+        }
+
+        std::tm tm{};
+        std::time_t mtime = file_->mtime();
+#ifndef _WIN32
+        localtime_r(&mtime, &tm);
+#else
+        localtime_s(&tm, &mtime);
+#endif
+        entry_ = Entry{};
+        entry_.index = index_;
+        entry_.offset = offset_;
+        entry_.size = file_->size();
+        entry_.zip64 = entry_.size >= 0xFFFFFFFF;
+        entry_.method = is_compressible(info.content_type) && entry_.size >= COMPRESS_MIN_SIZE &&
+                        entry_.size < ZIP_DEFLATE_LIMIT ? 8 : 0;
+        entry_.dos_time = static_cast<uint16_t>((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+        entry_.dos_date = static_cast<uint16_t>((std::max(tm.tm_year - 80, 0) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+        if (entry_.method == 8 && !reset_deflate()) {
+            entry_.method = 0;
+        }
+
+        // Флаги: 0x08 — размеры и CRC в дескрипторе после данных, 0x800 — имя в UTF-8
+        put32(out, 0x04034b50);
+        put16(out, entry_.zip64 ? 45 : 20);
+        put16(out, 0x0808);
+        put16(out, entry_.method);
+        put16(out, entry_.dos_time);
+        put16(out, entry_.dos_date);
+        put32(out, 0);
+        put32(out, entry_.zip64 ? 0xFFFFFFFF : 0);
+        put32(out, entry_.zip64 ? 0xFFFFFFFF : 0);
+        put16(out, static_cast<uint16_t>(info.name.size()));
+        put16(out, entry_.zip64 ? 20 : 0);
+        out += info.name;
+        if (entry_.zip64) {
+            put16(out, 0x0001);
+            put16(out, 16);
+            put64(out, 0);
+            put64(out, 0);
+        }
+
+        crc_ = crc32(0L, Z_NULL, 0);
+        position_ = 0;
+        data_start_ = offset_ + out.size();
+        state_ = entry_.size == 0 ? State::Descriptor : State::Data;
+    }
+
+    bool write_data(std::string& out) {
+        return file_->with_chunk(position_, file_->size() - position_, [&](const char* data, size_t length) {
+            crc_ = crc32(crc_, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(length));
+            position_ += length;
+            bool finish = position_ >= file_->size();
+            if (finish) {
+                state_ = State::Descriptor;
+            }
+            if (entry_.method == 0) {
+                out.append(data, length);
+                return true;
+            }
+            return deflate_chunk(data, length, finish, out);
+        });
+    }
+
+    void write_descriptor(std::string& out) {
+        entry_.crc = static_cast<uint32_t>(crc_);
+        entry_.compressed = offset_ - data_start_;
+        put32(out, 0x08074b50);
+        put32(out, entry_.crc);
+        if (entry_.zip64) {
+            put64(out, entry_.compressed);
+            put64(out, entry_.size);
+        }
+        else {
+            put32(out, static_cast<uint32_t>(entry_.compressed));
+            put32(out, static_cast<uint32_t>(entry_.size));
+        }
+        entries_.push_back(entry_);
+        file_.reset();
+        ++index_;
+        state_ = State::Header;
+    }
+
+    void write_directory(std::string& out) {
+        while (directory_index_ < entries_.size() && out.size() < ZIP_DIRECTORY_CHUNK) {
+            const Entry& entry = entries_[directory_index_++];
+            const std::string& name = (*files_)[entry.index].name;
+            std::string extra;
+            if (entry.size >= 0xFFFFFFFF) {
+                put64(extra, entry.size);
+            }
+            if (entry.compressed >= 0xFFFFFFFF) {
+                put64(extra, entry.compressed);
+            }
+            if (entry.offset >= 0xFFFFFFFF) {
+                put64(extra, entry.offset);
+            }
+            bool zip64 = !extra.empty();
+
+            put32(out, 0x02014b50);
+            put16(out, (3 << 8) | 45);     // Unix, версия 4.5
+            put16(out, zip64 || entry.zip64 ? 45 : 20);
+            put16(out, 0x0808);
+            put16(out, entry.method);
+            put16(out, entry.dos_time);
+            put16(out, entry.dos_date);
+            put32(out, entry.crc);
+            put32(out, clamp32(entry.compressed));
+            put32(out, clamp32(entry.size));
+            put16(out, static_cast<uint16_t>(name.size()));
+            put16(out, static_cast<uint16_t>(zip64 ? extra.size() + 4 : 0));
+            put16(out, 0);
+            put16(out, 0);
+            put16(out, 0);
+            put32(out, 0100644u << 16);
+            put32(out, clamp32(entry.offset));
+            out += name;
+            if (zip64) {
+                put16(out, 0x0001);
+                put16(out, static_cast<uint16_t>(extra.size()));
+                out += extra;
+            }
+        }
+        if (directory_index_ >= entries_.size()) {
+            state_ = State::End;
+        }
+    }
+
+    void write_end(std::string& out) {
+        uint64_t directory_size = offset_ - directory_offset_;
+        uint64_t count = entries_.size();
+        if (count >= 0xFFFF || directory_size >= 0xFFFFFFFF || directory_offset_ >= 0xFFFFFFFF) {
+            uint64_t record_offset = offset_;
+            put32(out, 0x06064b50);
+            put64(out, 44);
+            put16(out, 45);
+            put16(out, 45);
+            put32(out, 0);
+            put32(out, 0);
+            put64(out, count);
+            put64(out, count);
+            put64(out, directory_size);
+            put64(out, directory_offset_);
+
+            put32(out, 0x07064b50);
+            put32(out, 0);
+            put64(out, record_offset);
+            put32(out, 1);
+        }
+        put32(out, 0x06054b50);
+        put16(out, 0);
+        put16(out, 0);
+        put16(out, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        put16(out, static_cast<uint16_t>(std::min<uint64_t>(count, 0xFFFF)));
+        put32(out, clamp32(directory_size));
+        put32(out, clamp32(directory_offset_));
+        put16(out, 0);
+        state_ = State::Done;
+    }
+
+    bool reset_deflate() {
+        if (!deflate_ready_) {
+            deflate_ready_ = deflateInit2(&zs_, COMPRESS_STREAM_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            return deflate_ready_;
+        }
+        return deflateReset(&zs_) == Z_OK;
+    }
+
+    bool deflate_chunk(const char* data, size_t length, bool finish, std::string& out) {
+        char buffer[16384];
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs_.avail_in = static_cast<uInt>(length);
+        int ret;
+        do {
+            zs_.next_out = reinterpret_cast<Bytef*>(buffer);
+            zs_.avail_out = sizeof(buffer);
+            ret = deflate(&zs_, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                return false;
+            }
+            out.append(buffer, sizeof(buffer) - zs_.avail_out);
+        } while (zs_.avail_out == 0 || (finish && ret != Z_STREAM_END));
+        return true;
+    }
+
+    std::string dir_path_;
+    FileList files_;
+    State state_ = State::Header;
+    size_t index_ = 0;
+    std::unique_ptr<MappedFile> file_;
+    Entry entry_{};
+    uLong crc_ = 0;
+    size_t position_ = 0;
+    uint64_t offset_ = 0;
+    uint64_t data_start_ = 0;
+    std::vector<Entry> entries_;
+    size_t directory_index_ = 0;
+    uint64_t directory_offset_ = 0;
+    z_stream zs_{};
+    bool deflate_ready_ = false;
+};
+
+void serve_folder_zip(httplib::Response& res, const std::string& dir_path, const std::string& archive_name,
+                      httplib::ContentProviderResourceReleaser releaser = nullptr);
+void handle_share_zip(const httplib::Request& req, httplib::Response& res);
+void handle_file_download(const httplib::Request& req, httplib::Response& res);
+
+/**
+ * @brief Количество записей очереди репликации, отправляемых за один проход
+ */
+const size_t REPLICATION_BATCH = 512;
+
+/**
+ * @brief Пауза между проверками очереди репликации, когда она пуста
+ */
+const std::chrono::milliseconds REPLICATION_POLL(500);
+
+/**
+ * @brief Наибольшая пауза между повторами после ошибки отправки
+ */
+const std::chrono::seconds REPLICATION_MAX_BACKOFF(60);
+
+/**
+ * @brief Папка ведомого узла для принятых, но ещё не применённых блобов
+ */
+extern const std::string REPLICATION_PATH;
+
+int64_t replication_state(DbConnection& db, const std::string& key);
+void set_replication_state(DbConnection& db, const std::string& key, int64_t value);
+std::vector<std::string> split_replication_entry(const std::string& entry);
+bool is_blob_hash(const std::string& value);
+bool has_blob(DbConnection& db, const std::string& hash);
+
+/**
+ * @brief Ведомый узел, на который отправляются изменения
+ * 
+ * Отделён от Replicator, чтобы очередь можно было проверить без сети.
+ */
+class ReplicationPeer {
+public:
+    virtual ~ReplicationPeer() = default;
+
+    /**
+     * @brief Какие из блобов ведомому ещё нужно передать
+     * 
+     * @param hashes Хеши, по одному в строке
+     * @param missing Недостающие хеши, по одному в строке
+     * @return true Ответ получен
+     */
+    virtual bool missing(const std::string& hashes, std::string& missing) = 0;
+
+    /**
+     * @brief Передача блоба
+     * 
+     * @param hash Хеш блоба
+     * @param path Путь к блобу на этом узле
+     * @return true Ведомый принял и проверил блоб
+     */
+    virtual bool send_blob(const std::string& hash, const std::string& path) = 0;
+
+    /**
+     * @brief Передача пачки записей "<seq>\t<запись>\n"
+     * 
+     * @param entries Записи по возрастанию seq
+     * @param applied Наибольший seq, который ведомый применил
+     * @return true Ответ получен
+     */
+    virtual bool send_log(const std::string& entries, int64_t& applied) = 0;
+};
+
+/**
+ * @brief Ведомый узел, доступный по HTTP (маршруты /replication/...)
+ */
+class HttpReplicationPeer : public ReplicationPeer {
+public:
+    HttpReplicationPeer(const std::string& url, const std::string& secret)
+        : client_(url), headers_{ { "X-Replication-Secret", secret } } {
+        client_.set_connection_timeout(5);
+        client_.set_read_timeout(60);
+        client_.set_write_timeout(60);
+        client_.set_keep_alive(true);
+    }
+
+    bool missing(const std::string& hashes, std::string& missing) override {
+        auto res = client_.Post("/replication/missing", headers_, hashes, "text/plain");
+        if (!res || res->status != 200) {
+            return false;
+        }
+        missing = res->body;
+        return true;
+    }
+
+    bool send_blob(const std::string& hash, const std::string& path) override {
+        auto file = std::make_shared<MappedFile>(path);
+        if (!file->is_valid()) {
+            return false;
+        }
+        auto res = client_.Put("/replication/blob/" + hash, headers_, static_cast<size_t>(file->size()),
+            [file](size_t offset, size_t length, httplib::DataSink& sink) {
+                return file->write_to(offset, length, sink);
+            }, "application/octet-stream");
+        return res && res->status == 200;
+    }
+
+    bool send_log(const std::string& entries, int64_t& applied) override {
+        auto res = client_.Post("/replication/log", headers_, entries, "text/plain");
+        if (!res || res->status != 200) {
+            return false;
+        }
+        try {
+            applied = std::stoll(res->body);
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    httplib::Client client_;
+    httplib::Headers headers_;
+};
+
+/**
+ * @brief Асинхронная отправка изменений ведомому узлу
+ * 
+ * Изменения копятся в таблице replication_log (см. replicate) в тех же
+ * транзакциях, что и сами изменения, поэтому очередь переживает перезапуск.
+ * Поток берёт записи пачками по REPLICATION_BATCH: сначала спрашивает, каких
+ * блобов у ведомого нет, и передаёт их, затем отправляет сами записи.
+ * Подтверждённый ведомым seq сохраняется как acked, и записи до него
+ * удаляются. При ошибке пачка повторяется с паузой, растущей вдвое до
+ * REPLICATION_MAX_BACKOFF. Запись о файле, блоб которого на этом узле уже
+ * удалён (файл перезаписан или ссылка истекла), пропускается.
+ */
+class Replicator {
+public:
+    ~Replicator() {
+        stop();
+    }
+
+    /**
+     * @brief Запуск потока отправки
+     * 
+     * @param peer Ведомый узел
+     */
+    void start(std::unique_ptr<ReplicationPeer> peer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable()) {
+            peer_ = std::move(peer);
+            stop_ = false;
+            thread_ = std::thread([this] { run(); });
+        }
+    }
+
+    /**
+     * @brief Остановка потока отправки
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    /**
+     * @brief Постановка в очередь всего текущего состояния узла
+     * 
+     * Выполняется один раз, когда репликация включается на узле с уже
+     * накопленными данными: пользователи, папки, ссылки и файлы записываются
+     * в очередь одной транзакцией, дальше ведомый получает их как обычные изменения.
+     */
+    void seed() {
+        try {
+            auto db = getDbPool().writer();
+            if (replication_state(*db, "seeded") != 0) {
+                return;
+            }
+            SQLite::Transaction transaction(db->database());
+            std::vector<std::vector<std::string>> pending;
+            SQLite::Statement& users = db->statement("SELECT id, token FROM users WHERE token IS NOT NULL");
+            while (users.executeStep()) {
+                pending.push_back({ "user", std::to_string(users.getColumn(0).getInt64()), users.getColumn(1).getText() });
+            }
+            users.tryReset();
+            for_each_token_folder(TokenKind::User, getServerConfig().shard_depth, [&](const std::string& token, const fs::path&) {
+                pending.push_back({ "folder", token });
+            });
+            SQLite::Statement& shares = db->statement("SELECT token, created, expires, max_downloads FROM shares");
+            while (shares.executeStep()) {
+                pending.push_back({ "share", shares.getColumn(0).getText(), std::to_string(shares.getColumn(1).getInt64()),
+                                    std::to_string(shares.getColumn(2).getInt64()), std::to_string(shares.getColumn(3).getInt64()) });
+            }
+            shares.tryReset();
+            SQLite::Statement& files = db->statement(
+                "SELECT file_refs.path, file_refs.hash, blobs.size FROM file_refs JOIN blobs ON blobs.hash = file_refs.hash");
+            while (files.executeStep()) {
+                fs::path ref(files.getColumn(0).getText());
+                std::string root = ref.begin()->string();
+                if (root == "files" || root == "hidefiles") {
+                    pending.push_back({ "file", root == "files" ? "user" : "send", ref.parent_path().filename().string(),
+                                        ref.filename().string(), files.getColumn(1).getText(), std::to_string(files.getColumn(2).getInt64()) });
+                }
+            }
+            files.tryReset();
+            for (const auto& fields : pending) {
+                replicate(*db, fields);
+            }
+            set_replication_state(*db, "seeded", 1);
+            transaction.commit();
+            logMessage(LogLevel::Info, "Replication queue seeded", { {"entries", std::to_string(pending.size())} });
+        }
+        catch (const std::exception& e) {
+            logMessage(LogLevel::Error, "Error seeding replication queue: " + std::string(e.what()));
+        }
+    }
+
+    /**
+     * @brief Отправка одной пачки
+     * 
+     * @return int Число обработанных записей или -1 при ошибке
+     */
+    int ship_batch() {
+        static MetricCounter& shipped = getMetrics().counter("hsecloud_replication_entries_total", "Replication entries acknowledged by the peer.");
+        static MetricCounter& blob_bytes = getMetrics().counter("hsecloud_replication_blob_bytes_total", "Blob bytes sent to the replication peer.");
+
+        std::vector<std::pair<int64_t, std::string>> batch;
+        int64_t acked = 0;
+        try {
+            auto db = getDbPool().reader();
+            acked = replication_state(*db, "acked");
+            SQLite::Statement& select = db->statement("SELECT seq, entry FROM replication_log WHERE seq > ? ORDER BY seq LIMIT ?");
+            select.bind(1, acked);
+            select.bind(2, static_cast<int64_t>(REPLICATION_BATCH));
+            while (select.executeStep()) {
+                batch.emplace_back(select.getColumn(0).getInt64(), select.getColumn(1).getText());
+            }
+            select.tryReset();
+        }
+        catch (const std::exception& e) {
+            logMessage(LogLevel::Error, "Error reading replication queue: " + std::string(e.what()));
+            return -1;
+        }
+        if (batch.empty()) {
+            return 0;
+        }
+
+        std::string entries;
+        std::string hashes;
+        std::unordered_set<std::string> seen;
+        int64_t last_sent = 0;
+        for (const auto& item : batch) {
+            std::vector<std::string> fields = split_replication_entry(item.second);
+            if (fields[0] == "file" && fields.size() == 6) {
+                std::error_code ec;
+                if (!fs::exists(blob_path_for(fields[4]), ec)) {
+                    continue;
+                }
+                if (seen.insert(fields[4]).second) {
+                    hashes += fields[4] + "\n";
+                }
+            }
+            entries += std::to_string(item.first) + "\t" + item.second + "\n";
+            last_sent = item.first;
+        }
+
+        if (!hashes.empty()) {
+            std::string missing;
+            if (!peer_->missing(hashes, missing)) {
+                return -1;
+            }
+            std::istringstream lines(missing);
+            std::string hash;
+            while (std::getline(lines, hash)) {
+                if (seen.count(hash) == 0) {
+                    continue;
+                }
+                std::string path = blob_path_for(hash);
+                if (!peer_->send_blob(hash, path)) {
+                    return -1;
+                }
+                blob_bytes.add(existing_file_size(path));
+            }
+        }
+
+        int64_t applied = batch.back().first;
+        if (!entries.empty()) {
+            int64_t confirmed = 0;
+            if (!peer_->send_log(entries, confirmed)) {
+                return -1;
+            }
+            // Пропущенные записи после последней отправленной подтверждаются вместе с ней
+            applied = confirmed >= last_sent ? batch.back().first : confirmed;
+        }
+        if (applied <= acked) {
+            return -1;
+        }
+
+        try {
+            auto db = getDbPool().writer();
+            SQLite::Transaction transaction(db->database());
+            set_replication_state(*db, "acked", applied);
+            SQLite::Statement& trim = db->statement("DELETE FROM replication_log WHERE seq <= ?");
+            trim.bind(1, applied);
+            trim.exec();
+            trim.tryReset();
+            transaction.commit();
+        }
+        catch (const std::exception& e) {
+            logMessage(LogLevel::Error, "Error saving replication progress: " + std::string(e.what()));
+            return -1;
+        }
+        size_t done = 0;
+        for (const auto& item : batch) {
+            done += item.first <= applied ? 1 : 0;
+        }
+        shipped.add(done);
+        return static_cast<int>(done);
+    }
+
+    /**
+     * @brief Число записей, ещё не подтверждённых ведомым
+     */
+    int64_t pending() {
+        try {
+            auto db = getDbPool().reader();
+            int64_t acked = replication_state(*db, "acked");
+            SQLite::Statement& count = db->statement("SELECT COUNT(*) FROM replication_log WHERE seq > ?");
+            count.bind(1, acked);
+            int64_t value = count.executeStep() ? count.getColumn(0).getInt64() : 0;
+            count.tryReset();
+            return value;
+        }
+        catch (const std::exception&) {
+            return 0;
+        }
+    }
+
+private:
+    void run() {
+        static MetricCounter& failures = getMetrics().counter("hsecloud_replication_failures_total", "Failed attempts to ship a replication batch.");
+        std::chrono::milliseconds backoff(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_) {
+            lock.unlock();
+            int shipped = ship_batch();
+            lock.lock();
+            if (shipped < 0) {
+                failures.add();
+                backoff = std::min<std::chrono::milliseconds>(REPLICATION_MAX_BACKOFF, std::max(backoff * 2, std::chrono::milliseconds(1000)));
+                logMessage(LogLevel::Warning, "Replication batch failed, retrying", { {"delay_ms", std::to_string(backoff.count())} });
+                cv_.wait_for(lock, backoff, [this] { return stop_; });
+            }
+            else {
+                backoff = std::chrono::milliseconds(0);
+                if (shipped == 0) {
+                    cv_.wait_for(lock, REPLICATION_POLL, [this] { return stop_; });
+                }
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unique_ptr<ReplicationPeer> peer_;
+    std::thread thread_;
+    bool stop_ = false;
+};
+
+Replicator& getReplicator();
+std::string replication_missing_blobs(const std::string& hashes);
+bool apply_replication_entry(const std::vector<std::string>& fields);
+int64_t apply_replication_log(const std::string& entries);
+bool check_replication_secret(const httplib::Request& req, httplib::Response& res);
+void handle_replication_blob(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader);
+void startReplication();
+
+/**
+ * @brief Метрики одного маршрута HTTP сервера
+ */
+class RouteMetrics {
+public:
+    RouteMetrics(const std::string& method, const std::string& route)
+        : latency_(getMetrics().histogram("hsecloud_http_request_duration_seconds",
+              "Time spent in route handlers (excluding streamed bodies).", labels(method, route))) {
+        for (size_t i = 0; i < responses_.size(); ++i) {
+            responses_[i] = &getMetrics().counter("hsecloud_http_responses_total", "HTTP responses by status class.",
+                labels(method, route) + ",code=\"" + std::to_string(i + 1) + "xx\"");
+        }
+    }
+
+    void record(std::chrono::steady_clock::time_point start, int status) {
+        latency_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+        // httplib выставляет 200 после обработчика, если тот не задал код
+        size_t status_class = status < 100 ? 2 : std::min<size_t>(static_cast<size_t>(status) / 100, 5);
+        responses_[status_class - 1]->add();
+    }
+
+private:
+    static std::string labels(const std::string& method, const std::string& route) {
+        return "method=\"" + method + "\",route=\"" + route + "\"";
+    }
+
+    LatencyHistogram& latency_;
+    std::array<MetricCounter*, 5> responses_{};
+};
+
+httplib::Server::Handler instrument(const std::string& method, const std::string& route, httplib::Server::Handler handler);
+httplib::Server::HandlerWithContentReader instrument(const std::string& method, const std::string& route,
+                                                     httplib::Server::HandlerWithContentReader handler);
+void registerProcessMetrics();
+void setupServer(httplib::Server& svr);
+void startServer();
+
+/**
+ * @brief Количество потоков обработки обновлений бота
+ */
+const size_t BOT_WORKER_THREADS = 4;
+
+/**
+ * @brief Максимальная длина очереди обновлений одного потока
+ */
+const size_t BOT_WORKER_QUEUE = 1024;
+
+/**
+ * @brief Количество потоков отправки сообщений в Telegram
+ */
+const size_t BOT_SENDER_THREADS = 4;
+
+/**
+ * @brief Общий лимит Telegram на отправку (сообщений в секунду)
+ */
+const double BOT_GLOBAL_RATE = 30;
+
+/**
+ * @brief Минимальный интервал между сообщениями в один чат
+ */
+const std::chrono::milliseconds BOT_CHAT_INTERVAL(1000);
+
+/**
+ * @brief Количество попыток отправки сообщения
+ */
+const int BOT_SEND_ATTEMPTS = 3;
+
+/**
+ * @brief Максимальная длина сообщения Telegram
+ */
+const size_t BOT_MESSAGE_LIMIT = 4096;
+
+/**
+ * @brief Транспорт исходящих вызовов Bot API
+ */
+class BotTransport {
+public:
+    virtual ~BotTransport() = default;
+    virtual void sendMessage(int64_t chatId, const std::string& text, TgBot::GenericReply::Ptr markup) = 0;
+    virtual void answerCallbackQuery(const std::string& queryId) = 0;
+};
+
+/**
+ * @brief Транспорт через TgBot::Api
+ */
+class TgBotTransport : public BotTransport {
+public:
+    explicit TgBotTransport(const TgBot::Api& api) : api_(api) {}
+
+    void sendMessage(int64_t chatId, const std::string& text, TgBot::GenericReply::Ptr markup) override {
+        api_.sendMessage(chatId, text, false, 0, markup);
+    }
+
+    void answerCallbackQuery(const std::string& queryId) override {
+        api_.answerCallbackQuery(queryId);
+    }
+
+private:
+    const TgBot::Api& api_;
+};
+
+/**
+ * @brief Очередь исходящих сообщений бота с учётом лимитов Telegram
+ * 
+ * Сообщения отправляются несколькими потоками, при этом в один чат одновременно
+ * уходит не больше одного запроса и не чаще BOT_CHAT_INTERVAL, а всего — не больше
+ * BOT_GLOBAL_RATE в секунду. Накопившиеся сообщения в один чат склеиваются в одно,
+ * если клавиатура есть только у последнего. Ответы на callback-запросы отправляются
+ * вне очереди чатов.
+ */
+class TelegramOutbox {
+public:
+    TelegramOutbox(BotTransport& transport, size_t threads, double global_rate, std::chrono::milliseconds chat_interval)
+        : transport_(transport), global_rate_(global_rate), tokens_(global_rate), chat_interval_(chat_interval),
+          last_refill_(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~TelegramOutbox() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    TelegramOutbox(const TelegramOutbox&) = delete;
+    TelegramOutbox& operator=(const TelegramOutbox&) = delete;
+
+    /**
+     * @brief Постановка сообщения в очередь
+     * 
+     * @param chatId Идентификатор чата
+     * @param text Текст сообщения
+     * @param markup Клавиатура (необязательно)
+     */
+    void send(int64_t chatId, const std::string& text, TgBot::GenericReply::Ptr markup = nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (chats_.size() > 4096) {
+                sweepIdleChats();
+            }
+            ChatQueue& chat = chats_[chatId];
+            chat.messages.push_back({text, std::move(markup), 0});
+            if (chat.messages.size() == 1 && !chat.busy) {
+                ready_.push_back(chatId);
+            }
+        }
+        cv_.notify_one();
+    }
+
+    /**
+     * @brief Постановка ответа на callback-запрос в очередь
+     * 
+     * @param queryId Идентификатор запроса
+     */
+    void answerCallbackQuery(const std::string& queryId) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            callbacks_.push_back(queryId);
+        }
+        cv_.notify_one();
+    }
+
+    /**
+     * @brief Ожидание отправки всех сообщений из очереди
+     */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return callbacks_.empty() && ready_.empty() && in_flight_ == 0; });
+    }
+
+private:
+    struct OutgoingMessage {
+        std::string text;
+        TgBot::GenericReply::Ptr markup;
+        int attempts;
+    };
+
+    struct ChatQueue {
+        std::deque<OutgoingMessage> messages;
+        std::chrono::steady_clock::time_point next_send;
+        bool busy = false;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    void refill(Clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+        tokens_ = std::min(global_rate_, tokens_ + elapsed * global_rate_);
+        last_refill_ = now;
+    }
+
+    void sweepIdleChats() {
+        auto now = Clock::now();
+        for (auto it = chats_.begin(); it != chats_.end();) {
+            if (it->second.messages.empty() && !it->second.busy && it->second.next_send <= now) {
+                it = chats_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (stop_) {
+                return;
+            }
+            auto now = Clock::now();
+            refill(now);
+            Clock::time_point wake = Clock::time_point::max();
+
+            if (tokens_ >= 1 && !callbacks_.empty()) {
+                std::string queryId = std::move(callbacks_.front());
+                callbacks_.pop_front();
+                tokens_ -= 1;
+                ++in_flight_;
+                lock.unlock();
+                try {
+                    transport_.answerCallbackQuery(queryId);
+                }
+                catch (const std::exception& e) {
+                    logMessage(LogLevel::Error, "Error answering callback query", { {"error", e.what()} });
+                }
+                lock.lock();
+                --in_flight_;
+                cv_.notify_all();
+                continue;
+            }
+
+            if (tokens_ >= 1) {
+                auto it = ready_.begin();
+                for (; it != ready_.end(); ++it) {
+                    Clock::time_point next_send = chats_[*it].next_send;
+                    if (next_send <= now) {
+                        break;
+                    }
+                    wake = std::min(wake, next_send);
+                }
+                if (it != ready_.end()) {
+                    int64_t chatId = *it;
+                    ready_.erase(it);
+                    sendBatch(lock, chatId);
+                    continue;
+                }
+            }
+            else {
+                auto refill_wait = std::chrono::duration<double>((1 - tokens_) / global_rate_);
+                wake = std::min(wake, now + std::chrono::duration_cast<Clock::duration>(refill_wait));
+            }
+
+            if (wake == Clock::time_point::max()) {
+                cv_.wait(lock);
+            }
+            else {
+                cv_.wait_until(lock, wake);
+            }
+        }
+    }
+
+    void sendBatch(std::unique_lock<std::mutex>& lock, int64_t chatId) {
+        ChatQueue& chat = chats_[chatId];
+        OutgoingMessage message = std::move(chat.messages.front());
+        chat.messages.pop_front();
+        while (!chat.messages.empty() && !message.markup && message.attempts == 0 &&
+               message.text.size() + 2 + chat.messages.front().text.size() <= BOT_MESSAGE_LIMIT) {
+            message.text += "\n\n" + chat.messages.front().text;
+            message.markup = std::move(chat.messages.front().markup);
+            chat.messages.pop_front();
+        }
+        chat.busy = true;
+        tokens_ -= 1;
+        ++in_flight_;
+        lock.unlock();
+
+        bool sent = true;
+        try {
+            transport_.sendMessage(chatId, message.text, message.markup);
+        }
+        catch (const std::exception& e) {
+            sent = false;
+            logMessage(LogLevel::Error, "Error sending message", {
+                {"chat_id", std::to_string(chatId)}, {"attempt", std::to_string(message.attempts + 1)}, {"error", e.what()}
+            });
+        }
+
+        lock.lock();
+        ChatQueue& after = chats_[chatId];
+        after.busy = false;
+        after.next_send = Clock::now() + chat_interval_ * (sent ? 1 : message.attempts + 1);
+        if (!sent && ++message.attempts < BOT_SEND_ATTEMPTS) {
+            after.messages.push_front(std::move(message));
+        }
+        if (!after.messages.empty()) {
+            ready_.push_back(chatId);
+        }
+        --in_flight_;
+        cv_.notify_all();
+    }
+
+    BotTransport& transport_;
+    double global_rate_;
+    double tokens_;
+    std::chrono::milliseconds chat_interval_;
+    Clock::time_point last_refill_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::unordered_map<int64_t, ChatQueue> chats_;
+    std::deque<int64_t> ready_;
+    std::deque<std::string> callbacks_;
+    size_t in_flight_ = 0;
+    bool stop_ = false;
+    std::vector<std::thread> threads_;
+};
+
+/**
+ * @brief Асинхронная обработка обновлений бота
+ * 
+ * Обновления распределяются по потокам по идентификатору чата, поэтому
+ * обновления одного чата обрабатываются строго по порядку, а медленный чат
+ * не задерживает остальные потоки. Если очередь потока заполнена, post()
+ * ждёт освобождения места, и long poll перестаёт забирать новые обновления.
+ */
+class UpdateDispatcher {
+public:
+    UpdateDispatcher(size_t threads, size_t capacity) : capacity_(capacity) {
+        for (size_t i = 0; i < threads; ++i) {
+            lanes_.push_back(std::make_unique<Lane>());
+        }
+        for (auto& lane : lanes_) {
+            Lane* target = lane.get();
+            lane->thread = std::thread([this, target] { run(*target); });
+        }
+    }
+
+    ~UpdateDispatcher() {
+        for (auto& lane : lanes_) {
+            {
+                std::lock_guard<std::mutex> lock(lane->mutex);
+                lane->stop = true;
+            }
+            lane->not_empty.notify_all();
+        }
+        for (auto& lane : lanes_) {
+            lane->thread.join();
+        }
+    }
+
+    UpdateDispatcher(const UpdateDispatcher&) = delete;
+    UpdateDispatcher& operator=(const UpdateDispatcher&) = delete;
+
+    /**
+     * @brief Постановка обработчика обновления в очередь
+     * 
+     * @param chatId Идентификатор чата, определяет поток обработки
+     * @param task Обработчик
+     */
+    void post(int64_t chatId, std::function<void()> task) {
+        Lane& lane = *lanes_[std::hash<int64_t>{}(chatId) % lanes_.size()];
+        {
+            std::unique_lock<std::mutex> lock(lane.mutex);
+            lane.not_full.wait(lock, [&] { return lane.tasks.size() < capacity_; });
+            lane.tasks.push_back(std::move(task));
+        }
+        lane.not_empty.notify_one();
+    }
+
+    /**
+     * @brief Ожидание обработки всех поставленных обновлений
+     */
+    void drain() {
+        for (auto& lane : lanes_) {
+            std::unique_lock<std::mutex> lock(lane->mutex);
+            lane->not_full.wait(lock, [&] { return lane->tasks.empty() && !lane->busy; });
+        }
+    }
+
+private:
+    struct Lane {
+        std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+        bool busy = false;
+        bool stop = false;
+    };
+
+    void run(Lane& lane) {
+        std::unique_lock<std::mutex> lock(lane.mutex);
+        while (true) {
+            lane.not_empty.wait(lock, [&] { return lane.stop || !lane.tasks.empty(); });
+            if (lane.tasks.empty()) {
+                return;
+            }
+            std::function<void()> task = std::move(lane.tasks.front());
+            lane.tasks.pop_front();
+            lane.busy = true;
+            lock.unlock();
+            lane.not_full.notify_all();
+            try {
+                task();
+            }
+            catch (const std::exception& e) {
+                logMessage(LogLevel::Error, "Error handling bot update", { {"error", e.what()} });
+            }
+            lock.lock();
+            lane.busy = false;
+            lane.not_full.notify_all();
+        }
+    }
+
+    size_t capacity_;
+    std::vector<std::unique_ptr<Lane>> lanes_;
+};
+
+LatencyHistogram& bot_handler_histogram(const std::string& handler);
+void handleStartCommand(TelegramOutbox& outbox, const TgBot::Message::Ptr& message);
+void handleCallbackQuery(TelegramOutbox& outbox, const TgBot::CallbackQuery::Ptr& query);
+
+#endif // CLOUDHSE_H